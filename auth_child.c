@@ -16,13 +16,20 @@ limitations under the License.
 
 #include "auth_child.h"
 
-#include <stdlib.h>  // for NULL, EXIT_FAILURE
-#include <string.h>  // for strlen
-#include <unistd.h>  // for close, _exit, dup2, execl, fork, pipe
+#include <errno.h>       // for errno, EINTR
+#include <fcntl.h>       // for fcntl, FD_CLOEXEC, F_SETFD
+#include <poll.h>        // for poll, pollfd, POLLIN
+#include <signal.h>      // for SIGTERM
+#include <stdio.h>       // for snprintf
+#include <stdlib.h>      // for NULL
+#include <string.h>      // for strlen
+#include <sys/socket.h>  // for socketpair, recv, AF_UNIX, SOCK_SEQPACKET
+#include <unistd.h>      // for close, pipe, write
 
-#include "env_settings.h"      // for GetIntSetting
+#include "env_settings.h"      // for GetIntSetting, GetExecutablePathSetting
 #include "logging.h"           // for LogErrno, Log
-#include "wait_pgrp.h"         // for KillPgrp, WaitPgrp
+#include "trace.h"             // for TRACE_BEGIN, TRACE_END, TRACE_FLOW
+#include "wait_pgrp.h"         // for KillPgrp, WaitPgrp, SpawnProcess
 #include "xscreensaver_api.h"  // for ExportWindowID
 
 //! The PID of a currently running saver child, or 0 if none is running.
@@ -31,6 +38,33 @@ static pid_t auth_child_pid = 0;
 //! If auth_child_pid != 0, the FD which connects to stdin of the auth child.
 static int auth_child_fd = 0;
 
+//! If auth_child_pid != 0, the number of bytes written to auth_child_fd.
+static unsigned long auth_child_bytes_sent = 0;
+
+//! If auth_child_pid != 0, the trace flow base of its input.
+static unsigned long auth_child_flow_base = 0;
+
+//! If auth_child_pid != 0, whether it is in standby and waits to be activated.
+static int auth_child_standby = 0;
+
+//! Whether the last standby auth child exited before it was activated.
+static int standby_failed = 0;
+
+//! The PID of the persistent authproto, or 0 if none is running.
+static pid_t authproto_worker_pid = 0;
+
+//! If authproto_worker_pid != 0, our end of its control socket.
+static int authproto_worker_fd = -1;
+
+//! If authproto_worker_pid != 0, whether it confirmed that it serves attempts.
+static int authproto_worker_ready = 0;
+
+//! Whether the persistent authproto failed; then we no longer use one.
+static int authproto_worker_failed = 0;
+
+//! How long to wait for the persistent authproto to confirm it serves attempts.
+#define AUTHPROTO_WORKER_READY_TIMEOUT_MS 1000
+
 void KillAuthChildSigHandler(int signo) {
   // This is a signal handler, so we're not going to make this too complicated.
   // Just kill it.
@@ -61,7 +95,7 @@ int WantAuthChild(int force_auth) {
   if (force_auth) {
     return 1;
   }
-  return (auth_child_pid != 0);
+  return (auth_child_pid != 0 && !auth_child_standby);
 }
 
 /*! \brief Return whether buf contains exclusively control characters.
@@ -93,68 +127,295 @@ static int ContainsNonControl(const char *buf) {
   return 0;
 }
 
+/*! \brief Returns whether to keep a standby auth child around.
+ *
+ * A standby auth child is started while the screen is locked, does all its
+ * initialization but shows nothing, and is activated by the next wakeup. This
+ * makes the prompt show up without waiting for it to initialize. Usage:
+ *
+ * XSECURELOCK_AUTH_STANDBY=1 xsecurelock
+ */
+static int WantStandbyAuthChild() {
+  return GetIntSetting("XSECURELOCK_AUTH_STANDBY", 0);
+}
+
+/*! \brief Returns whether to keep a persistent authproto around.
+ *
+ * Normally, each auth attempt starts a new authproto, which has to set up PAM
+ * before it can even prompt. A persistent authproto serves all attempts of a
+ * lock session instead, and sets up each attempt's PAM transaction while the
+ * user is still typing. Only authproto_pam supports this. Usage:
+ *
+ * XSECURELOCK_AUTHPROTO_PERSISTENT=1 xsecurelock
+ */
+static int WantAuthprotoWorker() {
+  return GetIntSetting("XSECURELOCK_AUTHPROTO_PERSISTENT", 0);
+}
+
+/*! \brief Starts the persistent authproto if wanted and not running yet.
+ *
+ * It gets one end of a control socket as stdin and stdout, and auth children
+ * get the other end once it confirmed it serves attempts (see
+ * AuthprotoWorkerReady); it exits once all of them are gone.
+ */
+static void StartAuthprotoWorker() {
+  if (authproto_worker_pid != 0 || authproto_worker_failed ||
+      !WantAuthprotoWorker()) {
+    return;
+  }
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)) {
+    LogErrno("socketpair");
+    authproto_worker_failed = 1;
+    return;
+  }
+  // Our end only goes to auth children; see StartAuthChild.
+  if (fcntl(sv[0], F_SETFD, FD_CLOEXEC) != 0) {
+    LogErrno("fcntl");
+  }
+  const char *executable = GetExecutablePathSetting(
+      "XSECURELOCK_AUTHPROTO", AUTHPROTO_EXECUTABLE, 0);
+  const char *args[2] = {executable, NULL};
+  const char *env[2] = {"XSECURELOCK_AUTHPROTO_WORKER=1", NULL};
+  // Also as stdout, so a module that does not support this cannot talk to
+  // whatever our stdout is.
+  pid_t pid =
+      SpawnProcess(executable, args, env, sv[1], sv[1], SPAWN_NEW_PGRP);
+  close(sv[1]);
+  if (pid == -1) {
+    LogErrno("spawn %s", executable);
+    close(sv[0]);
+    authproto_worker_failed = 1;
+    return;
+  }
+  authproto_worker_pid = pid;
+  authproto_worker_fd = sv[0];
+  authproto_worker_ready = 0;
+}
+
+/*! \brief Waits for the persistent authproto's AUTHPROTO_READY record.
+ *
+ * \return 1 if it arrived, 0 if something else did, or nothing in time.
+ */
+static int ReceiveAuthprotoReady() {
+  struct pollfd pfd;
+  pfd.fd = authproto_worker_fd;
+  pfd.events = POLLIN;
+  for (;;) {
+    int ready = poll(&pfd, 1, AUTHPROTO_WORKER_READY_TIMEOUT_MS);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ready < 0) {
+      LogErrno("poll");
+      return 0;
+    }
+    if (ready == 0) {
+      Log("Persistent authproto did not confirm it serves attempts");
+      return 0;
+    }
+    break;
+  }
+  char buf[64];
+  ssize_t got;
+  do {
+    got = recv(authproto_worker_fd, buf, sizeof(buf), MSG_DONTWAIT);
+  } while (got < 0 && errno == EINTR);
+  if (got < 0) {
+    LogErrno("recv");
+    return 0;
+  }
+  // See AUTHPROTO_READY in helpers/authproto.h.
+  if (got != 1 || buf[0] != 'r') {
+    Log("Persistent authproto did not confirm it serves attempts; probably "
+        "only authproto_pam supports XSECURELOCK_AUTHPROTO_PERSISTENT");
+    return 0;
+  }
+  return 1;
+}
+
+/*! \brief Checks whether auth children can use the persistent authproto.
+ *
+ * Only once it confirmed that it serves attempts; other modules would take
+ * the control socket for their conversation. If it does not, it is stopped,
+ * and auth children start their own authproto instead.
+ *
+ * \return Whether it can be used.
+ */
+static int AuthprotoWorkerReady() {
+  if (authproto_worker_pid == 0) {
+    return 0;
+  }
+  if (!authproto_worker_ready && !ReceiveAuthprotoReady()) {
+    KillPgrp(authproto_worker_pid, SIGTERM);
+    int status;
+    WaitPgrp("authproto", &authproto_worker_pid, 1, 1, &status);
+    close(authproto_worker_fd);
+    authproto_worker_fd = -1;
+    authproto_worker_failed = 1;
+    return 0;
+  }
+  authproto_worker_ready = 1;
+  return 1;
+}
+
+/*! \brief Checks whether the persistent authproto has exited.
+ */
+static void ReapAuthprotoWorker() {
+  int status;
+  if (authproto_worker_pid == 0 ||
+      !WaitPgrp("authproto", &authproto_worker_pid, 0, 0, &status)) {
+    return;
+  }
+  close(authproto_worker_fd);
+  authproto_worker_fd = -1;
+  if (status != 0) {
+    // Auth children fall back to starting their own authproto.
+    Log("Persistent authproto exited; not starting another one");
+    authproto_worker_failed = 1;
+  }
+}
+
+/*! \brief Return what to send to a freshly started auth child.
+ *
+ * \param stdinbuf The keypress that woke it up.
+ * \return stdinbuf, or NULL if it is to be discarded.
+ */
+static const char *FirstKeypressToSend(const char *stdinbuf) {
+  if (stdinbuf != NULL &&
+      (DiscardFirstKeypress() || !ContainsNonControl(stdinbuf))) {
+    // The auth child has just been started. Do not send any keystrokes to
+    // it immediately. Exception: when the user requested different
+    // behavior by XSECURELOCK_DISCARD_FIRST_KEYPRESS=0 and there is a
+    // printable character.
+    return NULL;
+  }
+  return stdinbuf;
+}
+
+/*! \brief Starts the auth child.
+ *
+ * \param standby Whether to start it in standby mode.
+ * \return True if it was started.
+ */
+static int StartAuthChild(Window w, const char *executable, int standby) {
+  int pc[2];
+  if (pipe(pc)) {
+    LogErrno("pipe");
+    return 0;
+  }
+  // Our end of the pipe must not leak into the child (or any other).
+  if (fcntl(pc[1], F_SETFD, FD_CLOEXEC) != 0) {
+    LogErrno("fcntl");
+  }
+  StartAuthprotoWorker();
+  char window_id_env[EXPORT_ENV_SIZE], worker_fd_env[64], flow_base_env[64];
+  unsigned long flow_base = TraceNewFlowBase();
+  const char *env[5] = {standby ? "XSECURELOCK_AUTH_STANDBY=1"
+                                : "XSECURELOCK_AUTH_STANDBY=0",
+                        window_id_env, NULL, NULL, NULL};
+  size_t n = 2;
+  ExportWindowID(w, window_id_env);
+  int use_worker = AuthprotoWorkerReady();
+  if (use_worker) {
+    snprintf(worker_fd_env, sizeof(worker_fd_env),
+             "XSECURELOCK_AUTHPROTO_WORKER_FD=%d", authproto_worker_fd);
+    env[n++] = worker_fd_env;
+    // Let this child, and only this one, inherit the control socket.
+    if (fcntl(authproto_worker_fd, F_SETFD, 0) != 0) {
+      LogErrno("fcntl");
+    }
+  }
+  env[n] = TraceExportFlowBase(flow_base, flow_base_env, sizeof(flow_base_env));
+  const char *args[2] = {executable, NULL};
+  pid_t pid = SpawnProcess(executable, args, env, pc[0], -1, SPAWN_NEW_PGRP);
+  close(pc[0]);
+  if (use_worker && fcntl(authproto_worker_fd, F_SETFD, FD_CLOEXEC) != 0) {
+    LogErrno("fcntl");
+  }
+  if (pid == -1) {
+    LogErrno("spawn %s", executable);
+    close(pc[1]);
+    return 0;
+  }
+  auth_child_fd = pc[1];
+  auth_child_pid = pid;
+  auth_child_bytes_sent = 0;
+  auth_child_flow_base = flow_base;
+  auth_child_standby = standby;
+  return 1;
+}
+
+/*! \brief Checks whether the auth child has exited, and cleans up if so.
+ *
+ * \param status Receives the exit status, as returned by WaitPgrp.
+ * \return True if it exited.
+ */
+static int ReapAuthChild(int *status) {
+  if (auth_child_pid == 0 || !WaitPgrp("auth", &auth_child_pid, 0, 0, status)) {
+    return 0;
+  }
+  close(auth_child_fd);
+  if (auth_child_standby) {
+    // Don't try again and again if it fails to initialize.
+    Log("Standby auth child exited before activation; not starting another "
+        "one until the next auth attempt");
+    standby_failed = 1;
+    auth_child_standby = 0;
+    *status = WAIT_ALREADY_DEAD;
+  } else {
+    standby_failed = 0;
+  }
+  return 1;
+}
+
+void WatchStandbyAuthChild(Window w, const char *executable) {
+  ReapAuthprotoWorker();
+  StartAuthprotoWorker();
+  if (auth_child_pid != 0) {
+    if (auth_child_standby) {
+      int status;
+      ReapAuthChild(&status);
+    }
+    return;
+  }
+  if (!standby_failed && WantStandbyAuthChild() &&
+      !StartAuthChild(w, executable, 1)) {
+    // Same as if it exited; the next auth attempt tries again.
+    standby_failed = 1;
+  }
+}
+
 int WatchAuthChild(Window w, const char *executable, int force_auth,
                    const char *stdinbuf, int *auth_running) {
-  if (auth_child_pid != 0) {
-    // Check if auth child returned.
-    int status;
-    if (WaitPgrp("auth", &auth_child_pid, 0, 0, &status)) {
-      // Clean up.
-      close(auth_child_fd);
-
-      // Handle success; this will exit the screen lock.
-      if (status == 0) {
-        *auth_running = 0;
-        return 1;
-      }
+  ReapAuthprotoWorker();
 
-      // To handle failure, we just fall through, as we may want to immediately
-      // launch a new auth child and send it a keypress.
+  // Check if auth child returned.
+  int status;
+  if (ReapAuthChild(&status)) {
+    // Handle success; this will exit the screen lock.
+    if (status == 0) {
+      *auth_running = 0;
+      return 1;
     }
+
+    // To handle failure, we just fall through, as we may want to immediately
+    // launch a new auth child and send it a keypress.
+  }
+
+  if (force_auth && auth_child_pid != 0 && auth_child_standby) {
+    // Activate the standby auth child. The byte is not part of the input.
+    if (write(auth_child_fd, "", 1) != 1) {
+      LogErrno("Failed to activate the standby auth child");
+    }
+    auth_child_standby = 0;
+    stdinbuf = FirstKeypressToSend(stdinbuf);
   }
 
   if (force_auth && auth_child_pid == 0) {
     // Start auth child.
-    int pc[2];
-    if (pipe(pc)) {
-      LogErrno("pipe");
-    } else {
-      pid_t pid = ForkWithoutSigHandlers();
-      if (pid == -1) {
-        LogErrno("fork");
-      } else if (pid == 0) {
-        // Child process.
-        StartPgrp();
-        ExportWindowID(w);
-        close(pc[1]);
-        if (pc[0] != 0) {
-          if (dup2(pc[0], 0) == -1) {
-            LogErrno("dup2");
-            _exit(EXIT_FAILURE);
-          }
-          close(pc[0]);
-        }
-        {
-          const char *args[2] = {executable, NULL};
-          ExecvHelper(executable, args);
-          sleep(2);  // Reduce log spam or other effects from failed execv.
-          _exit(EXIT_FAILURE);
-        }
-      } else {
-        // Parent process after successful fork.
-        close(pc[0]);
-        auth_child_fd = pc[1];
-        auth_child_pid = pid;
-
-        if (stdinbuf != NULL &&
-            (DiscardFirstKeypress() || !ContainsNonControl(stdinbuf))) {
-          // The auth child has just been started. Do not send any keystrokes to
-          // it immediately. Exception: when the user requested different
-          // behavior by XSECURELOCK_DISCARD_FIRST_KEYPRESS=0 and there is a
-          // printable character.
-          stdinbuf = NULL;
-        }
-      }
+    if (StartAuthChild(w, executable, 0)) {
+      stdinbuf = FirstKeypressToSend(stdinbuf);
     }
   }
 
@@ -164,13 +425,24 @@ int WatchAuthChild(Window w, const char *executable, int force_auth,
   // Send the provided keyboard buffer to stdin.
   if (stdinbuf != NULL && stdinbuf[0] != 0) {
     if (auth_child_pid != 0) {
+      TRACE_BEGIN("WriteAuthChild");
       ssize_t to_write = (ssize_t)strlen(stdinbuf);
+      // One flow per byte, identified by its offset only, as the auth child
+      // reads byte by byte.
+      for (ssize_t i = 0; i < to_write; ++i) {
+        TRACE_FLOW('s', TraceInputFlowId(auth_child_flow_base,
+                                         auth_child_bytes_sent + i));
+      }
       ssize_t written = write(auth_child_fd, stdinbuf, to_write);
       if (written < 0) {
         LogErrno("Failed to send all data to the auth child");
-      } else if (written != to_write) {
-        Log("Failed to send all data to the auth child");
+      } else {
+        auth_child_bytes_sent += written;
+        if (written != to_write) {
+          Log("Failed to send all data to the auth child");
+        }
       }
+      TRACE_END();
     } else {
       Log("No auth child. Can't send key events");
     }
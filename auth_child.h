@@ -51,4 +51,19 @@ int WantAuthChild(int force_auth);
 int WatchAuthChild(Window w, const char *executable, int force_auth,
                    const char *stdinbuf, int *auth_running);
 
+/*! \brief Keeps a standby auth child around while no auth child is wanted.
+ *
+ * If XSECURELOCK_AUTH_STANDBY is set, starts the auth child ahead of time, so
+ * it can initialize while nothing is shown; the next WatchAuthChild() call
+ * with force_auth set activates it instead of starting a new one. Each auth
+ * attempt thus gets a fresh process.
+ *
+ * Also keeps the persistent authproto running if
+ * XSECURELOCK_AUTHPROTO_PERSISTENT is set.
+ *
+ * \param w The screen saver window.
+ * \param executable What binary to spawn for authentication.
+ */
+void WatchStandbyAuthChild(Window w, const char *executable);
+
 #endif
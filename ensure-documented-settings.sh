@@ -27,7 +27,11 @@ all_settings=$(
 
 # List of internal settings. These shall not be documented.
 internal_settings='
+XSECURELOCK_AUTHPROTO_WORKER
+XSECURELOCK_AUTHPROTO_WORKER_FD
 XSECURELOCK_INSIDE_SAVER_MULTIPLEX
+XSECURELOCK_STUB_PASSWORD
+XSECURELOCK_TRACE_FLOW
 '
 
 # List of deprecated settings. These shall not be documented.
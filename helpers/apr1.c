@@ -0,0 +1,226 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "apr1.h"
+
+#include <stdint.h>  // for uint32_t, uint64_t
+#include <string.h>  // for memcpy, strlen, strncmp, strcspn
+
+#include "../util.h"  // for explicit_bzero
+
+//! MD5 state (RFC 1321).
+typedef struct {
+  uint32_t state[4];
+  uint64_t bytes;
+  unsigned char buf[64];
+} Md5;
+
+//! The MD5 round constants, floor(abs(sin(i + 1)) * 2^32).
+static const uint32_t MD5_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+//! The MD5 rotation amounts, per round and step.
+static const unsigned char MD5_R[4][4] = {
+    {7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+//! The alphabet of crypt(3) style base64.
+static const char ITOA64[] =
+    "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static void Md5Block(uint32_t state[4], const unsigned char *p) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; ++i) {
+    m[i] = (uint32_t)p[4 * i] | (uint32_t)p[4 * i + 1] << 8 |
+           (uint32_t)p[4 * i + 2] << 16 | (uint32_t)p[4 * i + 3] << 24;
+  }
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t f;
+    int g;
+    switch (i / 16) {
+      case 0:
+        f = (b & c) | (~b & d);
+        g = i;
+        break;
+      case 1:
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) % 16;
+        break;
+      case 2:
+        f = b ^ c ^ d;
+        g = (3 * i + 5) % 16;
+        break;
+      default:
+        f = c ^ (b | ~d);
+        g = (7 * i) % 16;
+        break;
+    }
+    uint32_t x = a + f + MD5_K[i] + m[g];
+    int r = MD5_R[i / 16][i % 4];
+    a = d;
+    d = c;
+    c = b;
+    b += (x << r) | (x >> (32 - r));
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  explicit_bzero(m, sizeof(m));
+}
+
+static void Md5Init(Md5 *ctx) {
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->bytes = 0;
+}
+
+static void Md5Update(Md5 *ctx, const void *data, size_t len) {
+  const unsigned char *p = data;
+  size_t have = ctx->bytes % 64;
+  ctx->bytes += len;
+  if (have != 0) {
+    size_t take = 64 - have;
+    if (take > len) {
+      take = len;
+    }
+    memcpy(ctx->buf + have, p, take);
+    p += take;
+    len -= take;
+    if (have + take < 64) {
+      return;
+    }
+    Md5Block(ctx->state, ctx->buf);
+  }
+  for (; len >= 64; p += 64, len -= 64) {
+    Md5Block(ctx->state, p);
+  }
+  memcpy(ctx->buf, p, len);
+}
+
+static void Md5Final(Md5 *ctx, unsigned char digest[16]) {
+  uint64_t bits = ctx->bytes * 8;
+  static const unsigned char padding[64] = {0x80};
+  Md5Update(ctx, padding, 1 + (119 - ctx->bytes % 64) % 64);
+  unsigned char length[8];
+  for (int i = 0; i < 8; ++i) {
+    length[i] = (unsigned char)(bits >> (8 * i));
+  }
+  Md5Update(ctx, length, sizeof(length));
+  for (int i = 0; i < 16; ++i) {
+    digest[i] = (unsigned char)(ctx->state[i / 4] >> (8 * (i % 4)));
+  }
+  explicit_bzero(ctx, sizeof(*ctx));
+}
+
+//! Appends n characters of crypt(3) style base64 of v.
+static char *To64(char *p, uint32_t v, int n) {
+  while (n-- > 0) {
+    *p++ = ITOA64[v & 0x3f];
+    v >>= 6;
+  }
+  return p;
+}
+
+int Apr1Crypt(const char *key, const char *setting, char *out,
+              size_t out_size) {
+  size_t magic_len = strlen(APR1_MAGIC);
+  if (strncmp(setting, APR1_MAGIC, magic_len)) {
+    return 0;
+  }
+  const char *salt = setting + magic_len;
+  size_t salt_len = strcspn(salt, "$");
+  if (salt_len > 8) {
+    salt_len = 8;
+  }
+  if (out_size < magic_len + salt_len + 1 + 22 + 1) {
+    return 0;
+  }
+  size_t key_len = strlen(key);
+
+  // The algorithm of md5crypt by Poul-Henning Kamp, with a different magic.
+  unsigned char final[16];
+  Md5 ctx, alt;
+  Md5Init(&alt);
+  Md5Update(&alt, key, key_len);
+  Md5Update(&alt, salt, salt_len);
+  Md5Update(&alt, key, key_len);
+  Md5Final(&alt, final);
+
+  Md5Init(&ctx);
+  Md5Update(&ctx, key, key_len);
+  Md5Update(&ctx, APR1_MAGIC, magic_len);
+  Md5Update(&ctx, salt, salt_len);
+  for (size_t left = key_len; left > 0; left -= left > 16 ? 16 : left) {
+    Md5Update(&ctx, final, left > 16 ? 16 : left);
+  }
+  memset(final, 0, sizeof(final));
+  for (size_t i = key_len; i != 0; i >>= 1) {
+    Md5Update(&ctx, (i & 1) ? (const void *)final : (const void *)key, 1);
+  }
+  Md5Final(&ctx, final);
+
+  // Make it slow.
+  for (int i = 0; i < 1000; ++i) {
+    Md5Init(&ctx);
+    if (i & 1) {
+      Md5Update(&ctx, key, key_len);
+    } else {
+      Md5Update(&ctx, final, sizeof(final));
+    }
+    if (i % 3) {
+      Md5Update(&ctx, salt, salt_len);
+    }
+    if (i % 7) {
+      Md5Update(&ctx, key, key_len);
+    }
+    if (i & 1) {
+      Md5Update(&ctx, final, sizeof(final));
+    } else {
+      Md5Update(&ctx, key, key_len);
+    }
+    Md5Final(&ctx, final);
+  }
+
+  char *p = out;
+  memcpy(p, APR1_MAGIC, magic_len);
+  p += magic_len;
+  memcpy(p, salt, salt_len);
+  p += salt_len;
+  *p++ = '$';
+  p = To64(p, (uint32_t)final[0] << 16 | final[6] << 8 | final[12], 4);
+  p = To64(p, (uint32_t)final[1] << 16 | final[7] << 8 | final[13], 4);
+  p = To64(p, (uint32_t)final[2] << 16 | final[8] << 8 | final[14], 4);
+  p = To64(p, (uint32_t)final[3] << 16 | final[9] << 8 | final[15], 4);
+  p = To64(p, (uint32_t)final[4] << 16 | final[10] << 8 | final[5], 4);
+  p = To64(p, final[11], 2);
+  *p = 0;
+  explicit_bzero(final, sizeof(final));
+  return 1;
+}
@@ -0,0 +1,43 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef APR1_H
+#define APR1_H
+
+#include <stddef.h>  // for size_t
+
+//! The prefix of APR1 hashes.
+#define APR1_MAGIC "$apr1$"
+
+//! The size of a buffer that can hold any APR1 hash (including the NUL).
+#define APR1_HASH_SIZE 40
+
+/*! \brief Computes an Apache APR1 (MD5-crypt based) password hash.
+ *
+ * This is the hash `htpasswd -m` writes. crypt(3) does not know it, as it
+ * differs from "$1$" MD5-crypt in the prefix, which also goes into the hash.
+ *
+ * \param key The password.
+ * \param setting A hash or setting starting with APR1_MAGIC; only the salt
+ *   is used.
+ * \param out Receives the hash, in the same form as in htpasswd files.
+ * \param out_size The size of out; should be APR1_HASH_SIZE.
+ * \return 1 on success, 0 if setting is not an APR1 setting or out too small.
+ */
+int Apr1Crypt(const char *key, const char *setting, char *out,
+              size_t out_size);
+
+#endif
@@ -16,6 +16,8 @@ limitations under the License.
 
 #include <X11/X.h>     // for Success, None, Atom, KBBellPitch
 #include <X11/Xlib.h>  // for DefaultScreen, Screen, XFree, True
+#include <errno.h>     // for errno, EINTR
+#include <fcntl.h>     // for fcntl, FD_CLOEXEC, F_SETFD
 #include <locale.h>    // for NULL, setlocale, LC_CTYPE, LC_TIME
 #include <stdio.h>
 #include <stdlib.h>      // for free, rand, mblen, size_t, EXIT_...
@@ -23,7 +25,7 @@ limitations under the License.
 #include <sys/select.h>  // for timeval, select, fd_set, FD_SET
 #include <sys/time.h>    // for gettimeofday, timeval
 #include <time.h>        // for time, nanosleep, localtime_r
-#include <unistd.h>      // for close, _exit, dup2, pipe, dup
+#include <unistd.h>      // for close, pipe, read
 
 #if __STDC_VERSION__ >= 199901L
 #include <inttypes.h>
@@ -36,22 +38,17 @@ limitations under the License.
 #include <fontconfig/fontconfig.h>   // for FcChar8
 #endif
 
-#ifdef HAVE_XKB_EXT
-#include <X11/XKBlib.h>             // for XkbFreeKeyboard, XkbGetControls
-#include <X11/extensions/XKB.h>     // for XkbUseCoreKbd, XkbGroupsWrapMask
-#include <X11/extensions/XKBstr.h>  // for _XkbDesc, XkbStateRec, _XkbControls
-#endif
-
 #include "../env_info.h"          // for GetHostName, GetUserName
 #include "../env_settings.h"      // for GetIntSetting, GetStringSetting
 #include "../logging.h"           // for Log, LogErrno
 #include "../mlock_page.h"        // for MLOCK_PAGE
 #include "../util.h"              // for explicit_bzero
-#include "../wait_pgrp.h"         // for WaitPgrp
+#include "../wait_pgrp.h"         // for WaitProc, SpawnProcess
 #include "../wm_properties.h"     // for SetWMProperties
 #include "../xscreensaver_api.h"  // for ReadWindowID
 #include "authproto.h"            // for WritePacket, ReadPacket, PTYPE_R...
 #include "monitors.h"             // for Monitor, GetMonitors, IsMonitorC...
+#include "xkb_state.h"            // for GetXkbIndicators, InitXkbState, ...
 
 #if __STDC_VERSION__ >= 201112L
 #define STATIC_ASSERT(state, message) _Static_assert(state, message)
@@ -343,206 +340,21 @@ void PlaySound(enum Sound snd) {
 /*! \brief Switch to the next keyboard layout.
  */
 void SwitchKeyboardLayout(void) {
-#ifdef HAVE_XKB_EXT
   if (!have_xkb_ext) {
     return;
   }
-
-  XkbDescPtr xkb;
-  xkb = XkbGetMap(display, 0, XkbUseCoreKbd);
-  if (XkbGetControls(display, XkbGroupsWrapMask, xkb) != Success) {
-    Log("XkbGetControls failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return;
-  }
-  if (xkb->ctrls->num_groups < 1) {
-    Log("XkbGetControls returned less than 1 group");
-    XkbFreeKeyboard(xkb, 0, True);
-    return;
-  }
-  XkbStateRec state;
-  if (XkbGetState(display, XkbUseCoreKbd, &state) != Success) {
-    Log("XkbGetState failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return;
-  }
-
-  XkbLockGroup(display, XkbUseCoreKbd,
-               (state.group + 1) % xkb->ctrls->num_groups);
-
-  XkbFreeKeyboard(xkb, 0, True);
-#endif
+  SwitchXkbGroup(display);
 }
 
 /*! \brief Check which modifiers are active.
  *
- * \param warning Will be set to 1 if something's "bad" with the keyboard
- *     layout (e.g. Caps Lock).
- * \param have_multiple_layouts Will be set to 1 if more than one keyboard
- *     layout is available for switching.
- *
- * \return The current modifier mask as a string.
+ * Returns the string cached by the Xkb event tracking; no round trips.
  */
 const char *GetIndicators(int *warning, int *have_multiple_layouts) {
-#ifdef HAVE_XKB_EXT
-  static char buf[128];
-  char *p;
-
   if (!have_xkb_ext) {
     return "";
   }
-
-  XkbDescPtr xkb;
-  xkb = XkbGetMap(display, 0, XkbUseCoreKbd);
-  if (XkbGetControls(display, XkbGroupsWrapMask, xkb) != Success) {
-    Log("XkbGetControls failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  if (XkbGetNames(
-          display,
-          XkbIndicatorNamesMask | XkbGroupNamesMask | XkbSymbolsNameMask,
-          xkb) != Success) {
-    Log("XkbGetNames failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  XkbStateRec state;
-  if (XkbGetState(display, XkbUseCoreKbd, &state) != Success) {
-    Log("XkbGetState failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  unsigned int istate = 0;
-  if (!show_locks_and_latches) {
-    if (XkbGetIndicatorState(display, XkbUseCoreKbd, &istate) != Success) {
-      Log("XkbGetIndicatorState failed");
-      XkbFreeKeyboard(xkb, 0, True);
-      return "";
-    }
-  }
-
-  // Detect Caps Lock.
-  // Note: in very pathological cases the modifier might be set without an
-  // XkbIndicator for it; then we show the line in red without telling the user
-  // why. Such a situation has not been observd yet though.
-  unsigned int implicit_mods = state.latched_mods | state.locked_mods;
-  if (implicit_mods & LockMask) {
-    *warning = 1;
-  }
-
-  // Provide info about multiple layouts.
-  if (xkb->ctrls->num_groups > 1) {
-    *have_multiple_layouts = 1;
-  }
-
-  p = buf;
-
-  const char *word = "Keyboard: ";
-  size_t n = strlen(word);
-  if (n >= sizeof(buf) - (p - buf)) {
-    Log("Not enough space to store intro '%s'", word);
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  memcpy(p, word, n);
-  p += n;
-
-  int have_output = 0;
-  if (show_keyboard_layout) {
-    Atom layouta = xkb->names->groups[state.group];  // Human-readable.
-    if (layouta == None) {
-      layouta = xkb->names->symbols;  // Machine-readable fallback.
-    }
-    if (layouta != None) {
-      char *layout = XGetAtomName(display, layouta);
-      n = strlen(layout);
-      if (n >= sizeof(buf) - (p - buf)) {
-        Log("Not enough space to store layout name '%s'", layout);
-        XFree(layout);
-        XkbFreeKeyboard(xkb, 0, True);
-        return "";
-      }
-      memcpy(p, layout, n);
-      XFree(layout);
-      p += n;
-      have_output = 1;
-    }
-  }
-
-  if (show_locks_and_latches) {
-#define ADD_INDICATOR(mask, name)                                \
-  do {                                                           \
-    if (!(implicit_mods & (mask))) {                             \
-      continue;                                                  \
-    }                                                            \
-    if (have_output) {                                           \
-      if (2 >= sizeof(buf) - (p - buf)) {                        \
-        Log("Not enough space to store another modifier name");  \
-        break;                                                   \
-      }                                                          \
-      memcpy(p, ", ", 2);                                        \
-      p += 2;                                                    \
-    }                                                            \
-    size_t n = strlen(name);                                     \
-    if (n >= sizeof(buf) - (p - buf)) {                          \
-      Log("Not enough space to store modifier name '%s'", name); \
-      XFree(name);                                               \
-      break;                                                     \
-    }                                                            \
-    memcpy(p, (name), n);                                        \
-    p += n;                                                      \
-    have_output = 1;                                             \
-  } while (0)
-    // TODO(divVerent): There must be a better way to get the names of the
-    // modifiers than explicitly enumerating them. Also, there may even be
-    // something that knows that Mod1 is Alt/Meta and Mod2 is Num lock.
-    ADD_INDICATOR(ShiftMask, "Shift");
-    ADD_INDICATOR(LockMask, "Lock");
-    ADD_INDICATOR(ControlMask, "Control");
-    ADD_INDICATOR(Mod1Mask, "Mod1");
-    ADD_INDICATOR(Mod2Mask, "Mod2");
-    ADD_INDICATOR(Mod3Mask, "Mod3");
-    ADD_INDICATOR(Mod4Mask, "Mod4");
-    ADD_INDICATOR(Mod5Mask, "Mod5");
-  } else {
-    for (int i = 0; i < XkbNumIndicators; i++) {
-      if (!(istate & (1U << i))) {
-        continue;
-      }
-      Atom namea = xkb->names->indicators[i];
-      if (namea == None) {
-        continue;
-      }
-      if (have_output) {
-        if (2 >= sizeof(buf) - (p - buf)) {
-          Log("Not enough space to store another modifier name");
-          break;
-        }
-        memcpy(p, ", ", 2);
-        p += 2;
-      }
-      char *name = XGetAtomName(display, namea);
-      size_t n = strlen(name);
-      if (n >= sizeof(buf) - (p - buf)) {
-        Log("Not enough space to store modifier name '%s'", name);
-        XFree(name);
-        break;
-      }
-      memcpy(p, name, n);
-      XFree(name);
-      p += n;
-      have_output = 1;
-    }
-  }
-  *p = 0;
-  XkbFreeKeyboard(xkb, 0, True);
-  return have_output ? buf : "";
-#else
-  *warning = *warning;                              // Shut up clang-analyzer.
-  *have_multiple_layouts = *have_multiple_layouts;  // Shut up clang-analyzer.
-  return "";
-#endif
+  return GetXkbIndicators(warning, have_multiple_layouts);
 }
 
 void DestroyPerMonitorWindows(size_t keep_windows) {
@@ -1354,6 +1166,8 @@ int Prompt(const char *msg, char **response, int echo) {
       if (IsMonitorChangeEvent(display, priv.ev.type)) {
         per_monitor_windows_dirty = 1;
       }
+      // Keeps the cached indicators current; shown on the next blink.
+      HandleXkbStateEvent(display, &priv.ev);
     }
   }
 
@@ -1366,6 +1180,39 @@ int Prompt(const char *msg, char **response, int echo) {
   return status;
 }
 
+/*! \brief In standby mode, waits until xsecurelock activates us.
+ *
+ * With XSECURELOCK_AUTH_STANDBY, xsecurelock starts the auth child before it
+ * is needed, with XSECURELOCK_AUTH_STANDBY=1 in its environment, and activates
+ * it by sending a single byte, which is not part of the input, to stdin. Until
+ * then, all initialization can be done, but nothing may be shown and no input
+ * read.
+ *
+ * \return True if activated (or not in standby mode), false if xsecurelock
+ *   went away before.
+ */
+int WaitForStandbyActivation(void) {
+  if (!GetIntSetting("XSECURELOCK_AUTH_STANDBY", 0)) {
+    return 1;
+  }
+  // Make sure everything is set up on the server side already.
+  XFlush(display);
+  for (;;) {
+    char activation;
+    ssize_t got = read(0, &activation, 1);
+    if (got == 1) {
+      return 1;
+    }
+    if (got == 0) {
+      return 0;
+    }
+    if (errno != EINTR) {
+      LogErrno("read");
+      return 0;
+    }
+  }
+}
+
 /*! \brief Perform authentication using a helper proxy.
  *
  * \return The authentication status (0 for OK, 1 otherwise).
@@ -1382,68 +1229,43 @@ int Authenticate() {
   }
 
   // Use authproto_pam.
-  pid_t childpid = ForkWithoutSigHandlers();
-  if (childpid == -1) {
-    LogErrno("fork");
-    return 1;
+  // Our ends of the pipes must not leak into the child.
+  if (fcntl(requestfd[0], F_SETFD, FD_CLOEXEC) != 0 ||
+      fcntl(responsefd[1], F_SETFD, FD_CLOEXEC) != 0) {
+    LogErrno("fcntl");
+  }
+
+  // Use the persistent authproto if xsecurelock runs one; if it is gone, fall
+  // back to starting one ourselves.
+  pid_t childpid = 0;
+  int worker_fd = GetIntSetting("XSECURELOCK_AUTHPROTO_WORKER_FD", -1);
+  if (worker_fd >= 0) {
+    // It must not leak into an authproto we start.
+    if (fcntl(worker_fd, F_SETFD, FD_CLOEXEC) != 0) {
+      LogErrno("fcntl");
+    }
+    if (!SendAuthprotoAttempt(worker_fd, requestfd[1], responsefd[0])) {
+      worker_fd = -1;
+    }
   }
-
-  if (childpid == 0) {
-    // Child process. Just run authproto_pam.
-    // But first, move requestfd[1] to 1 and responsefd[0] to 0.
-    close(requestfd[0]);
-    close(responsefd[1]);
-
-    if (requestfd[1] == 0) {
-      // Tricky case. We don't _expect_ this to happen - after all,
-      // initially our own fd 0 should be bound to xsecurelock's main
-      // program - but nevertheless let's handle it.
-      // At least this implies that no other fd is 0.
-      int requestfd1 = dup(requestfd[1]);
-      if (requestfd1 == -1) {
-        LogErrno("dup");
-        _exit(EXIT_FAILURE);
-      }
+  if (worker_fd < 0) {
+    const char *args[2] = {authproto_executable, NULL};
+    childpid = SpawnProcess(authproto_executable, args, NULL, responsefd[0],
+                            requestfd[1], 0);
+    if (childpid == -1) {
+      LogErrno("spawn %s", authproto_executable);
+      close(requestfd[0]);
       close(requestfd[1]);
-      if (dup2(responsefd[0], 0) == -1) {
-        LogErrno("dup2");
-        _exit(EXIT_FAILURE);
-      }
       close(responsefd[0]);
-      if (requestfd1 != 1) {
-        if (dup2(requestfd1, 1) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(requestfd1);
-      }
-    } else {
-      if (responsefd[0] != 0) {
-        if (dup2(responsefd[0], 0) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(responsefd[0]);
-      }
-      if (requestfd[1] != 1) {
-        if (dup2(requestfd[1], 1) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(requestfd[1]);
-      }
-    }
-    {
-      const char *args[2] = {authproto_executable, NULL};
-      ExecvHelper(authproto_executable, args);
-      sleep(2);  // Reduce log spam or other effects from failed execv.
-      _exit(EXIT_FAILURE);
+      close(responsefd[1]);
+      return 1;
     }
   }
 
-  // Otherwise, we're in the parent process.
+  // Parent process.
   close(requestfd[1]);
   close(responsefd[0]);
+  int status = 1;
   for (;;) {
     char *message;
     char *response;
@@ -1487,6 +1309,15 @@ int Authenticate() {
         free(message);
         DisplayMessage("Processing...", "", 0);
         break;
+      case PTYPE_TIMING:
+        Log("authproto: %s", message);
+        free(message);
+        break;
+      case PTYPE_RESULT:
+        // Only sent by the persistent authproto.
+        status = strcmp(message, "0") != 0;
+        free(message);
+        break;
       case 0:
         goto done;
       default:
@@ -1497,10 +1328,10 @@ int Authenticate() {
     }
   }
 done:
+  DropBufferedPacketData(requestfd[0]);
   close(requestfd[0]);
   close(responsefd[1]);
-  int status;
-  if (!WaitProc("authproto", &childpid, 1, 0, &status)) {
+  if (childpid != 0 && !WaitProc("authproto", &childpid, 1, 0, &status)) {
     Log("WaitPgrp returned false but we were blocking");
     abort();
   }
@@ -1630,11 +1461,8 @@ int main(int argc_local, char **argv_local) {
   }
 
 #ifdef HAVE_XKB_EXT
-  int xkb_opcode, xkb_event_base, xkb_error_base;
-  int xkb_major_version = XkbMajorVersion, xkb_minor_version = XkbMinorVersion;
-  have_xkb_ext =
-      XkbQueryExtension(display, &xkb_opcode, &xkb_event_base, &xkb_error_base,
-                        &xkb_major_version, &xkb_minor_version);
+  have_xkb_ext = InitXkbState(display, show_keyboard_layout,
+                              show_locks_and_latches);
 #endif
 
   if (!GetHostName(hostname, sizeof(hostname))) {
@@ -1739,7 +1567,7 @@ int main(int argc_local, char **argv_local) {
 
   InitWaitPgrp();
 
-  int status = Authenticate();
+  int status = WaitForStandbyActivation() ? Authenticate() : 1;
 
   // Clear any possible processing message by closing our windows.
   DestroyPerMonitorWindows(0);
@@ -28,7 +28,14 @@ limitations under the License.
  * The including file must also define:
  *   void DisplayMessage(const char *, const char *, int);
  *   int Prompt(const char *, char **, int);
+ *   int HaveBackgroundWork(void);
+ *   void DoBackgroundWork(void);
+ *   void PlayResultAnimation(int);
+ *   void LogAuthprotoTiming(const char *);
  * since Authenticate() calls them, and they differ between auth modules.
+ * DisplayMessage and Prompt must draw the ActiveMessage() overlay, if any,
+ * and then set displayed_message_generation to message_generation.
+ * DoBackgroundWork is called in small slices while waiting for authproto.
  */
 
 #ifndef AUTH_X11_COMMON_INC_C_
@@ -37,236 +44,315 @@ limitations under the License.
 /* Forward declarations for functions defined differently in each auth module. */
 void DisplayMessage(const char *title, const char *str, int is_warning);
 int Prompt(const char *msg, char **response, int echo);
-
-/*! \brief Play a sound sequence.
- */
-void PlaySound(enum Sound snd) {
-  XKeyboardState state;
-  XKeyboardControl control;
-  struct timespec sleeptime;
-
-  if (!auth_sounds) {
-    return;
+int HaveBackgroundWork(void);
+void DoBackgroundWork(void);
+void PlayResultAnimation(int success);
+void LogAuthprotoTiming(const char *timing);
+
+//! Maximum number of queued bell events (two per sound).
+#define MAX_BELL_EVENTS 8
+
+//! A bell tone scheduled for a point in time.
+struct BellEvent {
+  //! When this tone is due.
+  struct timeval due;
+  //! The pitch to ring at.
+  int pitch;
+  //! Whether to restore the saved keyboard control after ringing.
+  int restore;
+};
+
+//! The pending bell events, sorted by due time.
+static struct BellEvent bell_events[MAX_BELL_EVENTS];
+static size_t num_bell_events = 0;
+
+//! When the most recently queued sound has finished (including its pause).
+static struct timeval bell_sequence_end;
+
+//! The keyboard control state to restore after each sound.
+static XKeyboardState bell_saved_state;
+static int bell_state_saved = 0;
+
+//! Whether a tone has changed the keyboard control since the last restore.
+static int bell_state_changed = 0;
+
+static void TimevalAddMs(struct timeval *tv, int ms) {
+  tv->tv_sec += ms / 1000;
+  tv->tv_usec += 1000L * (ms % 1000);
+  if (tv->tv_usec >= 1000000L) {
+    tv->tv_sec += 1;
+    tv->tv_usec -= 1000000L;
   }
+}
 
-  XGetKeyboardControl(display, &state);
-
-  control.bell_percent = 50;
-  control.bell_duration = SOUND_TONE_MS;
-  control.bell_pitch = sounds[snd][0];
-  XChangeKeyboardControl(display, KBBellPercent | KBBellDuration | KBBellPitch,
-                         &control);
-  XBell(display, 0);
-
-  XFlush(display);
-
-  sleeptime.tv_sec = SOUND_SLEEP_MS / 1000;
-  sleeptime.tv_nsec = 1000000L * (SOUND_SLEEP_MS % 1000);
-  nanosleep(&sleeptime, NULL);
+static int TimevalBefore(const struct timeval *a, const struct timeval *b) {
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_usec < b->tv_usec);
+}
 
-  control.bell_pitch = sounds[snd][1];
-  XChangeKeyboardControl(display, KBBellPitch, &control);
-  XBell(display, 0);
+//! Returns a - b, or zero if b is not before a.
+static struct timeval TimevalDiff(const struct timeval *a,
+                                  const struct timeval *b) {
+  struct timeval d;
+  d.tv_sec = a->tv_sec - b->tv_sec;
+  d.tv_usec = a->tv_usec - b->tv_usec;
+  if (d.tv_usec < 0) {
+    d.tv_sec -= 1;
+    d.tv_usec += 1000000L;
+  }
+  if (d.tv_sec < 0) {
+    d.tv_sec = 0;
+    d.tv_usec = 0;
+  }
+  return d;
+}
 
-  control.bell_percent = state.bell_percent;
-  control.bell_duration = state.bell_duration;
-  control.bell_pitch = state.bell_pitch;
+/*! \brief Restore the keyboard control state saved by PlaySound.
+ */
+static void RestoreBellState(void) {
+  XKeyboardControl control;
+  control.bell_percent = bell_saved_state.bell_percent;
+  control.bell_duration = bell_saved_state.bell_duration;
+  control.bell_pitch = bell_saved_state.bell_pitch;
   XChangeKeyboardControl(display, KBBellPercent | KBBellDuration | KBBellPitch,
                          &control);
+  bell_state_changed = 0;
+}
 
+/*! \brief Ring all bell events that are due.
+ *
+ * Must be called from every loop that waits while a sound may be playing;
+ * NextSoundTimeout() tells how long such a loop may sleep.
+ */
+void ServiceSounds(void) {
+  if (num_bell_events == 0) {
+    return;
+  }
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  size_t fired = 0;
+  while (fired < num_bell_events &&
+         !TimevalBefore(&now, &bell_events[fired].due)) {
+    XKeyboardControl control;
+    control.bell_percent = 50;
+    control.bell_duration = SOUND_TONE_MS;
+    control.bell_pitch = bell_events[fired].pitch;
+    XChangeKeyboardControl(display,
+                           KBBellPercent | KBBellDuration | KBBellPitch,
+                           &control);
+    XBell(display, 0);
+    bell_state_changed = 1;
+    if (bell_events[fired].restore) {
+      RestoreBellState();
+    }
+    ++fired;
+  }
+  if (fired == 0) {
+    return;
+  }
+  memmove(bell_events, bell_events + fired,
+          (num_bell_events - fired) * sizeof(*bell_events));
+  num_bell_events -= fired;
+  if (num_bell_events == 0) {
+    bell_state_saved = 0;
+  }
   XFlush(display);
+}
 
-  nanosleep(&sleeptime, NULL);
+/*! \brief Limit a select() timeout so the next bell event is not missed.
+ *
+ * \param timeout The timeout to lower, if needed.
+ * \return 1 if a sound is pending, 0 otherwise.
+ */
+int NextSoundTimeout(struct timeval *timeout) {
+  if (num_bell_events == 0) {
+    return 0;
+  }
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  struct timeval left = TimevalDiff(&bell_events[0].due, &now);
+  if (TimevalBefore(&left, timeout)) {
+    *timeout = left;
+  }
+  return 1;
 }
 
-/*! \brief Switch to the next keyboard layout.
+/*! \brief Drop all pending tones and restore the keyboard control state.
  */
-void SwitchKeyboardLayout(void) {
-#ifdef HAVE_XKB_EXT
-  if (!have_xkb_ext) {
-    return;
+void StopSounds(void) {
+  num_bell_events = 0;
+  if (bell_state_changed) {
+    RestoreBellState();
+    XFlush(display);
   }
+  bell_state_saved = 0;
+}
 
-  XkbDescPtr xkb;
-  xkb = XkbGetMap(display, 0, XkbUseCoreKbd);
-  if (XkbGetControls(display, XkbGroupsWrapMask, xkb) != Success) {
-    Log("XkbGetControls failed");
-    XkbFreeKeyboard(xkb, 0, True);
+/*! \brief Play a sound sequence.
+ *
+ * The tones are only queued here and rung by ServiceSounds() when due, so
+ * this never sleeps. A sound requested while another one is still playing
+ * starts once the previous one is over.
+ */
+void PlaySound(enum Sound snd) {
+  if (!auth_sounds) {
     return;
   }
-  if (xkb->ctrls->num_groups < 1) {
-    Log("XkbGetControls returned less than 1 group");
-    XkbFreeKeyboard(xkb, 0, True);
+  if (num_bell_events + 2 > MAX_BELL_EVENTS) {
+    Log("Too many queued sounds - dropping one");
     return;
   }
-  XkbStateRec state;
-  if (XkbGetState(display, XkbUseCoreKbd, &state) != Success) {
-    Log("XkbGetState failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return;
+
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  if (TimevalBefore(&start, &bell_sequence_end)) {
+    start = bell_sequence_end;
   }
 
-  XkbLockGroup(display, XkbUseCoreKbd,
-               (state.group + 1) % xkb->ctrls->num_groups);
+  if (!bell_state_saved) {
+    XGetKeyboardControl(display, &bell_saved_state);
+    bell_state_saved = 1;
+  }
 
-  XkbFreeKeyboard(xkb, 0, True);
-#endif
+  struct BellEvent *ev = &bell_events[num_bell_events];
+  ev[0].due = start;
+  ev[0].pitch = sounds[snd][0];
+  ev[0].restore = 0;
+  ev[1].due = start;
+  TimevalAddMs(&ev[1].due, SOUND_SLEEP_MS);
+  ev[1].pitch = sounds[snd][1];
+  ev[1].restore = 1;
+  num_bell_events += 2;
+  bell_sequence_end = ev[1].due;
+  TimevalAddMs(&bell_sequence_end, SOUND_SLEEP_MS);
+
+  ServiceSounds();
 }
 
-/*! \brief Check which modifiers are active.
- */
-const char *GetIndicators(int *warning, int *have_multiple_layouts) {
-#ifdef HAVE_XKB_EXT
-  static char buf[128];
-  char *p;
+//! Maximum number of messages waiting to be shown.
+#define MAX_QUEUED_MESSAGES 4
+
+//! A message shown on top of the normal UI for a minimum duration.
+typedef struct {
+  char title[128];
+  char text[256];
+  int is_warning;
+  //! How long to show the message at least, unless a key is pressed.
+  int min_ms;
+  //! Whether the message has been shown yet (and thus expires is valid).
+  int shown;
+  struct timeval expires;
+} QueuedMessage;
+
+static QueuedMessage message_queue[MAX_QUEUED_MESSAGES];
+static size_t num_queued_messages = 0;
+
+//! Incremented whenever the active message changes.
+static unsigned long message_generation = 0;
+
+//! The message_generation the screen currently reflects.
+static unsigned long displayed_message_generation = 0;
+
+static void PopMessage(void) {
+  explicit_bzero(&message_queue[0], sizeof(message_queue[0]));
+  memmove(message_queue, message_queue + 1,
+          (num_queued_messages - 1) * sizeof(*message_queue));
+  --num_queued_messages;
+  explicit_bzero(&message_queue[num_queued_messages],
+                 sizeof(message_queue[num_queued_messages]));
+  ++message_generation;
+}
 
-  if (!have_xkb_ext) {
-    return "";
+/*! \brief Queue a message to be shown by the render loop.
+ *
+ * \param min_ms The message stays up at least this long unless a key is
+ *   pressed; the oldest message is dropped if the queue is full.
+ */
+void QueueMessage(const char *title, const char *text, int is_warning,
+                  int min_ms) {
+  if (num_queued_messages == MAX_QUEUED_MESSAGES) {
+    PopMessage();
+  }
+  QueuedMessage *msg = &message_queue[num_queued_messages++];
+  strncpy(msg->title, title, sizeof(msg->title) - 1);
+  msg->title[sizeof(msg->title) - 1] = 0;
+  strncpy(msg->text, text, sizeof(msg->text) - 1);
+  msg->text[sizeof(msg->text) - 1] = 0;
+  msg->is_warning = is_warning;
+  msg->min_ms = min_ms;
+  msg->shown = 0;
+  if (num_queued_messages == 1) {
+    ++message_generation;
   }
+}
 
-  XkbDescPtr xkb;
-  xkb = XkbGetMap(display, 0, XkbUseCoreKbd);
-  if (XkbGetControls(display, XkbGroupsWrapMask, xkb) != Success) {
-    Log("XkbGetControls failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  if (XkbGetNames(
-          display,
-          XkbIndicatorNamesMask | XkbGroupNamesMask | XkbSymbolsNameMask,
-          xkb) != Success) {
-    Log("XkbGetNames failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  XkbStateRec state;
-  if (XkbGetState(display, XkbUseCoreKbd, &state) != Success) {
-    Log("XkbGetState failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  unsigned int istate = 0;
-  if (!show_locks_and_latches) {
-    if (XkbGetIndicatorState(display, XkbUseCoreKbd, &istate) != Success) {
-      Log("XkbGetIndicatorState failed");
-      XkbFreeKeyboard(xkb, 0, True);
-      return "";
+/*! \brief Return the message to show now, or NULL.
+ *
+ * Expires messages whose time is up; the display time of a message starts
+ * counting the first time it is returned here.
+ */
+const QueuedMessage *ActiveMessage(void) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  while (num_queued_messages > 0) {
+    QueuedMessage *msg = &message_queue[0];
+    if (!msg->shown) {
+      msg->shown = 1;
+      msg->expires = now;
+      TimevalAddMs(&msg->expires, msg->min_ms);
+      return msg;
+    }
+    if (TimevalBefore(&now, &msg->expires)) {
+      return msg;
     }
+    PopMessage();
   }
+  return NULL;
+}
 
-  unsigned int implicit_mods = state.latched_mods | state.locked_mods;
-  if (implicit_mods & LockMask) {
-    *warning = 1;
+/*! \brief Drop all queued messages (e.g. because the user typed something).
+ */
+void DismissMessages(void) {
+  while (num_queued_messages > 0) {
+    PopMessage();
   }
+}
 
-  if (xkb->ctrls->num_groups > 1) {
-    *have_multiple_layouts = 1;
+/*! \brief Limit a select() timeout so the active message expires on time.
+ *
+ * \return 1 if a message is being shown, 0 otherwise.
+ */
+int NextMessageTimeout(struct timeval *timeout) {
+  if (num_queued_messages == 0 || !message_queue[0].shown) {
+    return num_queued_messages > 0;
   }
-
-  p = buf;
-
-  const char *word = "Keyboard: ";
-  size_t n = strlen(word);
-  if (n >= sizeof(buf) - (p - buf)) {
-    Log("Not enough space to store intro '%s'", word);
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  struct timeval left = TimevalDiff(&message_queue[0].expires, &now);
+  if (TimevalBefore(&left, timeout)) {
+    *timeout = left;
   }
-  memcpy(p, word, n);
-  p += n;
+  return 1;
+}
 
-  int have_output = 0;
-  if (show_keyboard_layout) {
-    Atom layouta = xkb->names->groups[state.group];
-    if (layouta == None) {
-      layouta = xkb->names->symbols;
-    }
-    if (layouta != None) {
-      char *layout = XGetAtomName(display, layouta);
-      n = strlen(layout);
-      if (n >= sizeof(buf) - (p - buf)) {
-        Log("Not enough space to store layout name '%s'", layout);
-        XFree(layout);
-        XkbFreeKeyboard(xkb, 0, True);
-        return "";
-      }
-      memcpy(p, layout, n);
-      XFree(layout);
-      p += n;
-      have_output = 1;
-    }
+/*! \brief Switch to the next keyboard layout.
+ */
+void SwitchKeyboardLayout(void) {
+  if (!have_xkb_ext) {
+    return;
   }
+  SwitchXkbGroup(display);
+}
 
-  if (show_locks_and_latches) {
-#define ADD_INDICATOR(mask, name)                                \
-  do {                                                           \
-    if (!(implicit_mods & (mask))) {                             \
-      continue;                                                  \
-    }                                                            \
-    if (have_output) {                                           \
-      if (2 >= sizeof(buf) - (p - buf)) {                        \
-        Log("Not enough space to store another modifier name");  \
-        break;                                                   \
-      }                                                          \
-      memcpy(p, ", ", 2);                                        \
-      p += 2;                                                    \
-    }                                                            \
-    size_t n = strlen(name);                                     \
-    if (n >= sizeof(buf) - (p - buf)) {                          \
-      Log("Not enough space to store modifier name '%s'", name); \
-      XFree(name);                                               \
-      break;                                                     \
-    }                                                            \
-    memcpy(p, (name), n);                                        \
-    p += n;                                                      \
-    have_output = 1;                                             \
-  } while (0)
-    ADD_INDICATOR(ShiftMask, "Shift");
-    ADD_INDICATOR(LockMask, "Lock");
-    ADD_INDICATOR(ControlMask, "Control");
-    ADD_INDICATOR(Mod1Mask, "Mod1");
-    ADD_INDICATOR(Mod2Mask, "Mod2");
-    ADD_INDICATOR(Mod3Mask, "Mod3");
-    ADD_INDICATOR(Mod4Mask, "Mod4");
-    ADD_INDICATOR(Mod5Mask, "Mod5");
-  } else {
-    for (int i = 0; i < XkbNumIndicators; i++) {
-      if (!(istate & (1U << i))) {
-        continue;
-      }
-      Atom namea = xkb->names->indicators[i];
-      if (namea == None) {
-        continue;
-      }
-      if (have_output) {
-        if (2 >= sizeof(buf) - (p - buf)) {
-          Log("Not enough space to store another modifier name");
-          break;
-        }
-        memcpy(p, ", ", 2);
-        p += 2;
-      }
-      char *name = XGetAtomName(display, namea);
-      size_t n = strlen(name);
-      if (n >= sizeof(buf) - (p - buf)) {
-        Log("Not enough space to store modifier name '%s'", name);
-        XFree(name);
-        break;
-      }
-      memcpy(p, name, n);
-      XFree(name);
-      p += n;
-      have_output = 1;
-    }
+/*! \brief Check which modifiers are active.
+ *
+ * Returns the string cached by the Xkb event tracking; no round trips.
+ */
+const char *GetIndicators(int *warning, int *have_multiple_layouts) {
+  if (!have_xkb_ext) {
+    return "";
   }
-  *p = 0;
-  XkbFreeKeyboard(xkb, 0, True);
-  return have_output ? buf : "";
-#else
-  *warning = *warning;                              // Shut up clang-analyzer.
-  *have_multiple_layouts = *have_multiple_layouts;  // Shut up clang-analyzer.
-  return "";
-#endif
+  return GetXkbIndicators(warning, have_multiple_layouts);
 }
 
 int TextAscent(void) {
@@ -347,15 +433,90 @@ void BuildTitle(char *output, size_t output_size, const char *input) {
   output[output_size - 1] = 0;
 }
 
-void WaitForKeypress(int seconds) {
-  struct timeval timeout;
-  timeout.tv_sec = seconds;
-  timeout.tv_usec = 0;
-  fd_set set;
-  memset(&set, 0, sizeof(set));
-  FD_ZERO(&set);
-  FD_SET(0, &set);
-  select(1, &set, NULL, NULL, &timeout);
+/*! \brief Wait until fd becomes readable, keeping the screen alive meanwhile.
+ *
+ * Queued sounds are rung, queued messages are shown and expired, and monitor
+ * changes are handled. A keypress dismisses the queued messages but is left
+ * unread for the next prompt.
+ *
+ * \param fd The file descriptor to wait for; if negative, wait until all
+ *   queued messages are gone instead.
+ */
+void WaitForReadable(int fd) {
+  int watch_stdin = 1;
+  for (;;) {
+    int need_redraw = 0;
+    XEvent ev;
+    while (XPending(display) && (XNextEvent(display, &ev), 1)) {
+      if (IsMonitorChangeEvent(display, ev.type)) {
+        per_monitor_windows_dirty = 1;
+        need_redraw = 1;
+      }
+      HandleXkbStateEvent(display, &ev);
+    }
+
+    const QueuedMessage *msg = ActiveMessage();
+    if (fd < 0 && msg == NULL) {
+      return;
+    }
+    if (need_redraw || displayed_message_generation != message_generation) {
+      DisplayMessage(CFG_TEXT_PROCESSING, "", 0);
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    int have_timeout = NextSoundTimeout(&timeout);
+    have_timeout |= NextMessageTimeout(&timeout);
+    // With background work pending, only poll, and do a slice of it when
+    // nothing else is ready.
+    int background_work = HaveBackgroundWork();
+    if (background_work) {
+      timeout.tv_sec = 0;
+      timeout.tv_usec = 0;
+      have_timeout = 1;
+    }
+
+    if (fd >= 0 && HaveBufferedPacketData(fd)) {
+      // The next packet has been read already.
+      return;
+    }
+
+    fd_set set;
+    memset(&set, 0, sizeof(set));
+    FD_ZERO(&set);
+    int maxfd = ConnectionNumber(display);
+    FD_SET(maxfd, &set);
+    if (fd >= 0) {
+      FD_SET(fd, &set);
+      if (fd > maxfd) {
+        maxfd = fd;
+      }
+    }
+    if (msg != NULL && watch_stdin) {
+      FD_SET(0, &set);
+    }
+    int nfds = select(maxfd + 1, &set, NULL, NULL,
+                      have_timeout ? &timeout : NULL);
+    ServiceSounds();
+    if (nfds < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LogErrno("select");
+      return;
+    }
+    if (fd >= 0 && FD_ISSET(fd, &set)) {
+      return;
+    }
+    if (msg != NULL && watch_stdin && FD_ISSET(0, &set)) {
+      DismissMessages();
+      watch_stdin = 0;
+    }
+    if (nfds == 0 && background_work) {
+      DoBackgroundWork();
+    }
+  }
 }
 
 #ifdef HAVE_XFT_EXT
@@ -378,6 +539,39 @@ XftFont *FixedXftFontOpenName(Display *display, int screen,
 }
 #endif
 
+/*! \brief In standby mode, waits until xsecurelock activates us.
+ *
+ * With XSECURELOCK_AUTH_STANDBY, xsecurelock starts the auth child before it
+ * is needed, with XSECURELOCK_AUTH_STANDBY=1 in its environment, and activates
+ * it by sending a single byte, which is not part of the input, to stdin. Until
+ * then, all initialization can be done, but nothing may be shown and no input
+ * read.
+ *
+ * \return True if activated (or not in standby mode), false if xsecurelock
+ *   went away before.
+ */
+int WaitForStandbyActivation(void) {
+  if (!GetIntSetting("XSECURELOCK_AUTH_STANDBY", 0)) {
+    return 1;
+  }
+  // Make sure everything is set up on the server side already.
+  XFlush(display);
+  for (;;) {
+    char activation;
+    ssize_t got = read(0, &activation, 1);
+    if (got == 1) {
+      return 1;
+    }
+    if (got == 0) {
+      return 0;
+    }
+    if (errno != EINTR) {
+      LogErrno("read");
+      return 0;
+    }
+  }
+}
+
 /*! \brief Perform authentication using a helper proxy.
  *
  * \return The authentication status (0 for OK, 1 otherwise).
@@ -393,80 +587,60 @@ int Authenticate() {
     return 1;
   }
 
-  pid_t childpid = ForkWithoutSigHandlers();
-  if (childpid == -1) {
-    LogErrno("fork");
-    return 1;
+  // Our ends of the pipes must not leak into the child.
+  if (fcntl(requestfd[0], F_SETFD, FD_CLOEXEC) != 0 ||
+      fcntl(responsefd[1], F_SETFD, FD_CLOEXEC) != 0) {
+    LogErrno("fcntl");
   }
 
-  if (childpid == 0) {
-    close(requestfd[0]);
-    close(responsefd[1]);
-
-    if (requestfd[1] == 0) {
-      int requestfd1 = dup(requestfd[1]);
-      if (requestfd1 == -1) {
-        LogErrno("dup");
-        _exit(EXIT_FAILURE);
-      }
+  // Use the persistent authproto if xsecurelock runs one; if it is gone, fall
+  // back to starting one ourselves.
+  pid_t childpid = 0;
+  int worker_fd = GetIntSetting("XSECURELOCK_AUTHPROTO_WORKER_FD", -1);
+  if (worker_fd >= 0) {
+    // It must not leak into an authproto we start.
+    if (fcntl(worker_fd, F_SETFD, FD_CLOEXEC) != 0) {
+      LogErrno("fcntl");
+    }
+    if (!SendAuthprotoAttempt(worker_fd, requestfd[1], responsefd[0])) {
+      worker_fd = -1;
+    }
+  }
+  if (worker_fd < 0) {
+    const char *args[2] = {authproto_executable, NULL};
+    childpid = SpawnProcess(authproto_executable, args, NULL, responsefd[0],
+                            requestfd[1], 0);
+    if (childpid == -1) {
+      LogErrno("spawn %s", authproto_executable);
+      close(requestfd[0]);
       close(requestfd[1]);
-      if (dup2(responsefd[0], 0) == -1) {
-        LogErrno("dup2");
-        _exit(EXIT_FAILURE);
-      }
       close(responsefd[0]);
-      if (requestfd1 != 1) {
-        if (dup2(requestfd1, 1) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(requestfd1);
-      }
-    } else {
-      if (responsefd[0] != 0) {
-        if (dup2(responsefd[0], 0) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(responsefd[0]);
-      }
-      if (requestfd[1] != 1) {
-        if (dup2(requestfd[1], 1) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(requestfd[1]);
-      }
-    }
-    {
-      const char *args[2] = {authproto_executable, NULL};
-      ExecvHelper(authproto_executable, args);
-      sleep(2);
-      _exit(EXIT_FAILURE);
+      close(responsefd[1]);
+      return 1;
     }
   }
 
   // Parent process.
   close(requestfd[1]);
   close(responsefd[0]);
+  int status = 1;
   for (;;) {
     char *message;
     char *response;
+    WaitForReadable(requestfd[0]);
     char type = ReadPacket(requestfd[0], &message, 1);
     switch (type) {
       case PTYPE_INFO_MESSAGE:
-        DisplayMessage(CFG_TEXT_PAM_SAYS, message, 0);
+        QueueMessage(CFG_TEXT_PAM_SAYS, message, 0, CFG_MESSAGE_INFO_MS);
         explicit_bzero(message, strlen(message));
         free(message);
         PlaySound(SOUND_INFO);
-        WaitForKeypress(1);
         break;
       case PTYPE_ERROR_MESSAGE:
-        DisplayMessage(CFG_TEXT_ERROR, message, 1);
+        QueueMessage(CFG_TEXT_ERROR, message, 1, CFG_MESSAGE_ERROR_MS);
         explicit_bzero(message, strlen(message));
         free(message);
         PlaySound(SOUND_ERROR);
-        WaitForKeypress(1);
         break;
       case PTYPE_PROMPT_LIKE_USERNAME:
         if (Prompt(message, &response, 1)) {
@@ -492,6 +666,15 @@ int Authenticate() {
         free(message);
         DisplayMessage(CFG_TEXT_PROCESSING, "", 0);
         break;
+      case PTYPE_TIMING:
+        LogAuthprotoTiming(message);
+        free(message);
+        break;
+      case PTYPE_RESULT:
+        // Only sent by the persistent authproto.
+        status = strcmp(message, "0") != 0;
+        free(message);
+        break;
       case 0:
         goto done;
       default:
@@ -502,16 +685,22 @@ int Authenticate() {
     }
   }
 done:
+  DropBufferedPacketData(requestfd[0]);
   close(requestfd[0]);
   close(responsefd[1]);
-  int status;
-  if (!WaitProc("authproto", &childpid, 1, 0, &status)) {
+  if (childpid != 0 && !WaitProc("authproto", &childpid, 1, 0, &status)) {
     Log("WaitPgrp returned false but we were blocking");
     abort();
   }
   if (status == 0) {
     PlaySound(SOUND_SUCCESS);
+    PlayResultAnimation(1);
+  } else {
+    PlayResultAnimation(0);
+    // Let the user read why it failed; on success, don't delay the unlock.
+    WaitForReadable(-1);
   }
+  DismissMessages();
   return status != 0;
 }
 
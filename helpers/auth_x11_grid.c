@@ -21,19 +21,28 @@ limitations under the License.
  * Cyberpunk 2077 "Breach Protocol" hacking minigame visualization.
  * The actual password is still typed normally underneath — the grid UI
  * is a purely visual/decorative layer.
+ *
+ * For testing, "auth_x11_grid --render <script> <prefix>" renders scripted
+ * frames to PPM images without a lock; see RunRenderScript().
  */
 
 #include <X11/X.h>     // for Success, None, Atom, KBBellPitch
 #include <X11/Xlib.h>  // for DefaultScreen, Screen, XFree, True
+#include <X11/Xutil.h> // for XGetPixel, XDestroyImage
+#include <errno.h>     // for errno, EINTR, EAGAIN
+#include <fcntl.h>     // for fcntl, F_SETFL, O_NONBLOCK, FD_CLOEXEC
+#include <limits.h>    // for PTHREAD_STACK_MIN
 #include <locale.h>    // for NULL, setlocale, LC_CTYPE, LC_TIME
 #include <math.h>      // for sqrtf
+#include <pthread.h>   // for pthread_create, pthread_mutex_lock, ...
 #include <stdio.h>
-#include <stdlib.h>      // for free, rand, mblen, size_t, EXIT_...
+#include <stdlib.h>      // for free, rand, posix_memalign, size_t, EXIT_...
 #include <string.h>      // for strlen, memcpy, memset, strcspn
 #include <sys/select.h>  // for timeval, select, fd_set, FD_SET
 #include <sys/time.h>    // for gettimeofday, timeval
 #include <time.h>        // for time, nanosleep, localtime_r
-#include <unistd.h>      // for close, _exit, dup2, pipe, dup
+#include <unistd.h>      // for close, pipe, read
+#include <wchar.h>       // for mbrlen, mbstate_t
 
 #if __STDC_VERSION__ >= 199901L
 #include <inttypes.h>
@@ -46,45 +55,28 @@ limitations under the License.
 #include <fontconfig/fontconfig.h>   // for FcChar8
 #endif
 
-#ifdef HAVE_XKB_EXT
-#include <X11/XKBlib.h>             // for XkbFreeKeyboard, XkbGetControls
-#include <X11/extensions/XKB.h>     // for XkbUseCoreKbd, XkbGroupsWrapMask
-#include <X11/extensions/XKBstr.h>  // for _XkbDesc, XkbStateRec, _XkbControls
-#endif
-
 #include "../env_info.h"          // for GetHostName, GetUserName
 #include "../env_settings.h"      // for GetIntSetting, GetStringSetting
 #include "../logging.h"           // for Log, LogErrno
+#include "../trace.h"             // for TRACE_BEGIN, TRACE_END, TRACE_FLOW
 #include "../mlock_page.h"        // for MLOCK_PAGE
 #include "../util.h"              // for explicit_bzero
-#include "../wait_pgrp.h"         // for WaitPgrp
+#include "../wait_pgrp.h"         // for WaitProc, SpawnProcess
 #include "../wm_properties.h"     // for SetWMProperties
+#include "../xrequest_stats.h"    // for BeginXRequestPhase, EndXRequestPhase
 #include "../xscreensaver_api.h"  // for ReadWindowID
 #include "authproto.h"            // for WritePacket, ReadPacket, PTYPE_R...
+#include "breach_puzzle.h"        // for BreachPuzzle, GenerateBreachPuzzle...
 #include "monitors.h"             // for Monitor, GetMonitors, IsMonitorC...
+#include "xkb_state.h"            // for GetXkbIndicators, InitXkbState, ...
 
 /*! ===========================================================
  *  TYPE DEFINITIONS
  *  =========================================================== */
 
-//! A position in the grid.
-typedef struct {
-  int row;
-  int col;
-} GridPos;
-
 //! Axis for selection highlight.
 enum Axis { AXIS_HORIZONTAL = 0, AXIS_VERTICAL = 1 };
 
-//! A target sequence to complete.
-#define MAX_TARGET_LEN 4
-
-typedef struct {
-  const char *name;
-  int codes[MAX_TARGET_LEN];  // indices into HEX_CODES
-  int length;
-} TargetSequence;
-
 //! Color identifiers for drawing.
 enum DrawColor {
   COLOR_FOREGROUND = 0,
@@ -170,6 +162,9 @@ int prompt_timeout;
 #define CFG_OUTLINE_THICKNESS     1      /* Default rectangle outline width in pixels */
 #define CFG_REGION_W              2160   /* Content region width (0 = auto from layout) */
 #define CFG_REGION_H              1350   /* Content region height (0 = auto from layout) */
+#define CFG_SCALE_MIN             0.5f   /* Smallest per-monitor layout/font scale */
+#define CFG_SCALE_MAX             4.0f   /* Largest per-monitor layout/font scale */
+#define CFG_MAX_SCALED_FONTS      32     /* Size of the scaled Xft font cache */
 
 // --- Common: Text Labels ---
 
@@ -178,6 +173,16 @@ int prompt_timeout;
 #define CFG_TEXT_PROCESSING        "Processing..."
 #define CFG_TEXT_MLOCK_WARN        "Password will not be stored securely."
 #define CFG_TEXT_MLOCK_ERR         "Password has not been stored securely."
+#define CFG_MESSAGE_INFO_MS       1000   /* Minimum display time of info messages */
+#define CFG_MESSAGE_ERROR_MS      1000   /* Minimum display time of error messages */
+#define CFG_MESSAGE_Y_PERCENT     80     /* Vertical center of message overlays */
+
+// --- Result Animations (played when authproto exits) ---
+
+#define CFG_RESULT_SUCCESS_MS     300    /* Hard cap on success playback */
+#define CFG_RESULT_FAILURE_MS     600    /* Failure playback duration */
+#define CFG_TEXT_RESULT_SUCCESS    "BREACH SUCCESSFUL"
+#define CFG_TEXT_RESULT_FAILURE    "BREACH FAILED"
 
 // --- Common: Auth ---
 
@@ -309,10 +314,12 @@ int prompt_timeout;
 
 // --- Grid Data ---
 
-#define GRID_SIZE         5
-#define BUFFER_SIZE       6
-#define NUM_HEX_CODES     4
-#define NUM_TARGETS       3
+#define DEFAULT_GRID_SIZE    5
+#define DEFAULT_BUFFER_SIZE  6
+#define DEFAULT_NUM_TARGETS  3
+#define DEFAULT_TARGET_LEN   4
+#define CFG_PUZZLE_BUDGET_SMALL_US 1000   /* Generation budget up to 5x5 */
+#define CFG_PUZZLE_BUDGET_LARGE_US 10000  /* Generation budget above 5x5 */
 
 // --- Decorative elements ---
 # define DYNAMIC_MATRIX_X_OFFSET 50
@@ -321,8 +328,8 @@ int prompt_timeout;
 //! The hex code strings displayed in cells.
 static const char *HEX_CODES[NUM_HEX_CODES] = {"BD", "1C", "55", "7A"};
 
-//! CODE_MATRIX[row][col] — index into HEX_CODES for each cell.
-static const int CODE_MATRIX[GRID_SIZE][GRID_SIZE] = {
+//! DEFAULT_CODE_MATRIX[row][col] — index into HEX_CODES for each cell.
+static const int DEFAULT_CODE_MATRIX[DEFAULT_GRID_SIZE][DEFAULT_GRID_SIZE] = {
     {1, 3, 0, 2, 1},  // row 0: 1C 7A BD 55 1C
     {0, 2, 1, 3, 0},  // row 1: BD 55 1C 7A BD
     {2, 0, 3, 1, 2},  // row 2: 55 BD 7A 1C 55
@@ -331,7 +338,7 @@ static const int CODE_MATRIX[GRID_SIZE][GRID_SIZE] = {
 };
 
 //! The hardcoded path through the grid. Each keypress advances one step.
-static const GridPos HACK_SEQUENCE[BUFFER_SIZE] = {
+static const GridPos DEFAULT_HACK_SEQUENCE[DEFAULT_BUFFER_SIZE] = {
     {0, 2},  // BD  (row 0, horizontal)
     {3, 2},  // BD  (col 2, vertical)
     {3, 1},  // 1C  (row 3, horizontal)
@@ -341,7 +348,7 @@ static const GridPos HACK_SEQUENCE[BUFFER_SIZE] = {
 };
 
 //! The three target sequences (subsequences of the hack sequence buffer).
-static const TargetSequence TARGETS[NUM_TARGETS] = {
+static const TargetSequence DEFAULT_TARGETS[DEFAULT_NUM_TARGETS] = {
     {"DATAMINE_V1", {0, 0}, 2},        // BD BD
     {"DATAMINE_V2", {0, 1, 0}, 3},     // BD 1C BD
     {"DATAMINE_V3", {1, 0, 1, 1}, 4},  // 1C BD 1C 1C
@@ -351,17 +358,46 @@ static const TargetSequence TARGETS[NUM_TARGETS] = {
  *  RUNTIME STATE
  *  =========================================================== */
 
+//! The puzzle being played.
+static BreachPuzzle puzzle;
+
+//! Automaton over the targets of the puzzle being played.
+static TargetMatcher target_matcher;
+
+//! Longest target of generated puzzles.
+static int puzzle_target_len;
+
+//! If set, each password prompt gets a freshly generated puzzle.
+static int random_puzzle;
+
+//! Flow base for tracing stdin bytes back to xsecurelock's KeyPress spans.
+static unsigned long trace_flow_base;
+
+//! Bytes read from stdin so far, across prompts. Protected by the prompt lock.
+static unsigned long stdin_bytes_read;
+
 //! Runtime grid state.
 typedef struct {
   int current_step;
-  int buffer_codes[BUFFER_SIZE];  // indices into HEX_CODES for filled slots
+  int buffer_codes[MAX_BUFFER_SIZE];  // indices into HEX_CODES
   int buffer_count;
   enum Axis current_axis;
   int active_row;
   int active_col;
-  int sequence_complete[NUM_TARGETS];
+  // The next cell to pick as a row bit and a column bit; both 0 once the
+  // buffer is full.
+  GridBits active_rows;
+  GridBits active_cols;
+  // Picked cells, one bitboard per row. The hack sequence never revisits a
+  // cell, so rewinding clears a single bit.
+  GridBits used[MAX_GRID_SIZE];
+  // Per-step history, indexed by step; entry current_step is the live one, so
+  // rewinding is a pop.
+  int match_state[MAX_BUFFER_SIZE + 1];         // TargetMatcher state
+  uint32_t complete_mask[MAX_BUFFER_SIZE + 1];  // bit t: target t installed
 } GridState;
 
+
 //! If set, we can start a new login session.
 int have_switch_user_command;
 
@@ -420,6 +456,25 @@ static int auth_sounds = 0;
 //! Whether we only want a single auth window.
 static int single_auth_window = 0;
 
+//! Whether to prepare and play the success/failure animations.
+static int result_animation = 1;
+
+//! Frame profiling: 0 = off, 1 = periodic log summary, 2 = also an on-screen
+//! HUD.
+static int profile_level = 0;
+
+//! If set, render this script to images instead of authenticating.
+static const char *render_script = NULL;
+
+//! File name prefix of images written by --render ("-" = write none).
+static const char *render_prefix = NULL;
+
+//! The monitor to render to in --render mode, instead of GetMonitors().
+static Monitor render_monitor = {0, 0, CFG_REGION_W, CFG_REGION_H};
+
+//! The animation clock in --render mode.
+static struct timeval render_clock;
+
 //! If set, we need to re-query monitor data and adjust windows.
 int per_monitor_windows_dirty = 1;
 
@@ -447,6 +502,12 @@ Pixmap backbuf[MAX_WINDOWS];
 int backbuf_w[MAX_WINDOWS];
 int backbuf_h[MAX_WINDOWS];
 
+//! Layout and font scale factor of each window, derived from its monitor.
+float window_scale[MAX_WINDOWS];
+
+//! The monitor each window was last placed on.
+Monitor window_monitor[MAX_WINDOWS];
+
 #ifdef HAVE_XFT_EXT
 //! The Xft draw contexts — targeting backbuffers.
 XftDraw *xft_draws[MAX_WINDOWS];
@@ -471,13 +532,172 @@ int sounds[][2] = {
 #define SOUND_SLEEP_MS 125
 #define SOUND_TONE_MS 100
 
-/* Shared functions: PlaySound, SwitchKeyboardLayout, GetIndicators,
- * TextAscent, TextDescent, XGlyphInfoExpandAmount, TextWidth,
- * StrAppend, BuildTitle, WaitForKeypress, FixedXftFontOpenName,
- * Authenticate.
+/* Shared functions: PlaySound, ServiceSounds, NextSoundTimeout, StopSounds,
+ * QueueMessage, ActiveMessage, DismissMessages, NextMessageTimeout,
+ * SwitchKeyboardLayout, GetIndicators, TextAscent, TextDescent,
+ * XGlyphInfoExpandAmount, TextWidth, StrAppend, BuildTitle, WaitForReadable,
+ * FixedXftFontOpenName, Authenticate.
  */
 #include "auth_x11_common.inc.c"
 
+/*! ===========================================================
+ *  PER-MONITOR SCALING
+ *  =========================================================== */
+
+//! The scale factor of the window currently being drawn.
+static float render_scale = 1.0f;
+
+/*! \brief Scale a CFG_* pixel length by the current render scale.
+ *
+ * Non-zero lengths never collapse to zero, so 1px outlines stay visible.
+ */
+static inline int ScalePixels(int v) {
+  if (v == 0) return 0;
+  int s = (int)(v * render_scale + (v > 0 ? 0.5f : -0.5f));
+  if (s == 0) return v > 0 ? 1 : -1;
+  return s;
+}
+#define SCALED(v) ScalePixels(v)
+
+/*! \brief Compute the layout scale factor for a monitor.
+ *
+ * The layout is designed for a CFG_REGION_W x CFG_REGION_H screen; scale it
+ * so that it fits the monitor's resolution, within CFG_SCALE_MIN/MAX.
+ */
+static float ComputeMonitorScale(const Monitor *monitor) {
+  float sx = (float)monitor->width / CFG_REGION_W;
+  float sy = (float)monitor->height / CFG_REGION_H;
+  float scale = sx < sy ? sx : sy;
+  if (scale < CFG_SCALE_MIN) scale = CFG_SCALE_MIN;
+  if (scale > CFG_SCALE_MAX) scale = CFG_SCALE_MAX;
+  return scale;
+}
+
+#ifdef HAVE_XFT_EXT
+//! A font opened at a given scale; kept open until FreeScaledXftFonts().
+typedef struct {
+  const char *name;  /* Unscaled font pattern (static storage) */
+  int scale_pct;     /* Scale factor in percent */
+  XftFont *font;     /* NULL if opening failed */
+} ScaledXftFontEntry;
+
+static ScaledXftFontEntry scaled_xft_fonts[CFG_MAX_SCALED_FONTS];
+static int num_scaled_xft_fonts = 0;
+
+//! The default font as loaded in main(), and the pattern it came from.
+static XftFont *default_xft_font = NULL;
+static const char *default_xft_font_name = NULL;
+
+/*! \brief Open font_name with its size multiplied by scale_pct / 100.
+ */
+static XftFont *OpenScaledXftFont(const char *font_name, int scale_pct) {
+  if (scale_pct == 100) {
+    return FixedXftFontOpenName(display, DefaultScreen(display), font_name);
+  }
+#ifdef HAVE_FONTCONFIG
+  FcPattern *pattern = XftNameParse(font_name);
+  if (pattern == NULL) {
+    return NULL;
+  }
+  double size;
+  const char *size_key = FC_SIZE;
+  if (FcPatternGetDouble(pattern, FC_SIZE, 0, &size) != FcResultMatch) {
+    if (FcPatternGetDouble(pattern, FC_PIXEL_SIZE, 0, &size) ==
+        FcResultMatch) {
+      size_key = FC_PIXEL_SIZE;
+    } else {
+      size = 12.0;  // fontconfig's default point size.
+    }
+  }
+  FcPatternDel(pattern, size_key);
+  FcPatternAddDouble(pattern, size_key, size * scale_pct / 100.0);
+  FcChar8 *scaled_name = FcNameUnparse(pattern);
+  FcPatternDestroy(pattern);
+  if (scaled_name == NULL) {
+    return NULL;
+  }
+  XftFont *font = FixedXftFontOpenName(display, DefaultScreen(display),
+                                       (const char *)scaled_name);
+  free(scaled_name);
+  return font;
+#else
+  return FixedXftFontOpenName(display, DefaultScreen(display), font_name);
+#endif
+}
+
+/*! \brief Get font_name scaled by the current render scale.
+ *
+ * Each (font, size) pair goes through fontconfig only once; later calls, such
+ * as redraws, repeated prompts and monitor hotplug, reuse the cached font.
+ *
+ * \return The scaled font, or NULL if it can't be opened or the cache is
+ *   full; callers then use the unscaled default font.
+ */
+XftFont *ScaledXftFont(const char *font_name) {
+  int scale_pct = (int)(render_scale * 100 + 0.5f);
+  for (int i = 0; i < num_scaled_xft_fonts; ++i) {
+    if (scaled_xft_fonts[i].scale_pct == scale_pct &&
+        (scaled_xft_fonts[i].name == font_name ||
+         !strcmp(scaled_xft_fonts[i].name, font_name))) {
+      return scaled_xft_fonts[i].font;
+    }
+  }
+  if (num_scaled_xft_fonts >= CFG_MAX_SCALED_FONTS) {
+    // Cached fonts may still be in use this frame, so none can be closed;
+    // and an uncached one would leak. Draw unscaled instead.
+    static int logged = 0;
+    if (!logged) {
+      Log("Scaled font cache full; drawing %s unscaled", font_name);
+      logged = 1;
+    }
+    return NULL;
+  }
+  XftFont *font = OpenScaledXftFont(font_name, scale_pct);
+  scaled_xft_fonts[num_scaled_xft_fonts].name = font_name;
+  scaled_xft_fonts[num_scaled_xft_fonts].scale_pct = scale_pct;
+  scaled_xft_fonts[num_scaled_xft_fonts].font = font;
+  ++num_scaled_xft_fonts;
+  return font;
+}
+
+/*! \brief Close all fonts opened by ScaledXftFont().
+ */
+void FreeScaledXftFonts(void) {
+  for (int i = 0; i < num_scaled_xft_fonts; ++i) {
+    if (scaled_xft_fonts[i].font != NULL) {
+      XftFontClose(display, scaled_xft_fonts[i].font);
+    }
+  }
+  num_scaled_xft_fonts = 0;
+}
+#endif
+
+/*! \brief Select the scale and default font for drawing on a window.
+ */
+void BeginWindowScale(size_t i) {
+  render_scale = window_scale[i] > 0 ? window_scale[i] : 1.0f;
+#ifdef HAVE_XFT_EXT
+  if (default_xft_font != NULL) {
+    XftFont *f = NULL;
+    if ((int)(render_scale * 100 + 0.5f) != 100) {
+      f = ScaledXftFont(default_xft_font_name);
+    }
+    xft_font = f ? f : default_xft_font;
+  }
+#endif
+}
+
+/*! \brief Revert to unscaled drawing (e.g. for measuring window sizes).
+ */
+void EndWindowScale(void) {
+  render_scale = 1.0f;
+#ifdef HAVE_XFT_EXT
+  if (default_xft_font != NULL) {
+    xft_font = default_xft_font;
+  }
+#endif
+}
+
 void DestroyPerMonitorWindows(size_t keep_windows) {
   for (size_t i = keep_windows; i < num_windows; ++i) {
 #ifdef HAVE_XFT_EXT
@@ -503,6 +723,9 @@ void CreateOrUpdatePerMonitorWindow(size_t i, const Monitor *monitor,
                                     int y_offset) {
   int w, h, x, y;
 
+  window_scale[i] = ComputeMonitorScale(monitor);
+  window_monitor[i] = *monitor;
+
   // Check for full-monitor mode (signaled by negative dimensions).
   if (region_w < 0 || region_h < 0) {
     // Full-monitor mode: use entire monitor dimensions.
@@ -511,9 +734,9 @@ void CreateOrUpdatePerMonitorWindow(size_t i, const Monitor *monitor,
     x = monitor->x + x_offset;
     y = monitor->y + y_offset;
   } else {
-    // Normal mode: center the region on the monitor.
-    w = region_w;
-    h = region_h;
+    // Normal mode: center the (scaled) region on the monitor.
+    w = (int)(region_w * window_scale[i] + 0.5f);
+    h = (int)(region_h * window_scale[i] + 0.5f);
     x = monitor->x + (monitor->width - w) / 2 + x_offset;
     y = monitor->y + (monitor->height - h) / 2 + y_offset;
     // Clip to monitor.
@@ -601,8 +824,11 @@ void CreateOrUpdatePerMonitorWindow(size_t i, const Monitor *monitor,
       DefaultColormap(display, DefaultScreen(display)));
 #endif
 
-  // This window is now ready to use.
-  XMapWindow(display, windows[i]);
+  // This window is now ready to use. In --render mode, we only ever draw
+  // into the backbuffer.
+  if (render_script == NULL) {
+    XMapWindow(display, windows[i]);
+  }
   num_windows = i + 1;
 }
 
@@ -611,8 +837,13 @@ void UpdatePerMonitorWindows(int monitors_changed, int region_w, int region_h,
   static size_t num_monitors = 0;
   static Monitor monitors[MAX_WINDOWS];
 
-  if (monitors_changed) {
+  if (render_script != NULL) {
+    num_monitors = 1;
+    monitors[0] = render_monitor;
+  } else if (monitors_changed) {
+    BeginXRequestPhase(display, "GetMonitors");
     num_monitors = GetMonitors(display, parent_window, monitors, MAX_WINDOWS);
+    EndXRequestPhase(display);
   }
 
   if (single_auth_window) {
@@ -654,6 +885,18 @@ void UpdatePerMonitorWindows(int monitors_changed, int region_w, int region_h,
   }
 }
 
+/*! \brief Get the current time for animations.
+ *
+ * This is the wall clock, except in --render mode, where the script sets it.
+ */
+static void GetAnimationTime(struct timeval *tv) {
+  if (render_script != NULL) {
+    *tv = render_clock;
+    return;
+  }
+  gettimeofday(tv, NULL);
+}
+
 /*! ===========================================================
  *  TEXT HELPERS (grid-specific)
  *  =========================================================== */
@@ -725,7 +968,8 @@ int ActiveTextDescent(void) {
 }
 
 int ActiveLineSpacing(void) {
-  return (override_line_spacing >= 0) ? override_line_spacing : CFG_LINE_SPACING;
+  return SCALED((override_line_spacing >= 0) ? override_line_spacing
+                                             : CFG_LINE_SPACING);
 }
 
 int ActiveTextWidth(const char *string, int len) {
@@ -793,7 +1037,7 @@ void DrawRectGlow(int monitor, int x, int y, int w, int h) {
   int layers = CFG_GLOW_LAYERS;
   if (layers > 3) layers = 3;
   for (int g = layers; g >= 1; --g) {
-    int off = g * CFG_GLOW_SPREAD;
+    int off = g * SCALED(CFG_GLOW_SPREAD);
     DrawRect(monitor, x - off, y - off,
              w + 2 * off, h + 2 * off, glow_colors[g - 1], 1);
   }
@@ -825,7 +1069,7 @@ void DrawPolygonGlow(int monitor, XPoint *points, int npoints, int filled) {
 
   XPoint glow_pts[16];
   for (int g = layers; g >= 1; --g) {
-    float off = (float)(g * CFG_GLOW_SPREAD);
+    float off = (float)(g * SCALED(CFG_GLOW_SPREAD));
     for (int i = 0; i < npoints; ++i) {
       float dx = points[i].x - cx;
       float dy = points[i].y - cy;
@@ -875,7 +1119,7 @@ void DrawBox(int monitor, int x, int y, int w, int h,
     FillRect(monitor, x, y, w, h, bg);
   }
   if (outline != NO_COLOR) {
-    DrawRect(monitor, x, y, w, h, outline, CFG_OUTLINE_THICKNESS);
+    DrawRect(monitor, x, y, w, h, outline, SCALED(CFG_OUTLINE_THICKNESS));
   }
   if (text_fg != NO_COLOR && text != NULL && text_len > 0) {
     int cell_to = (h + TextAscent() - TextDescent()) / 2;
@@ -889,7 +1133,7 @@ void DrawBox(int monitor, int x, int y, int w, int h,
  */
 void DrawLine(int monitor, int x1, int y1, int x2, int y2,
               enum DrawColor color) {
-  for (int t = 0; t < CFG_OUTLINE_THICKNESS; ++t) {
+  for (int t = 0; t < SCALED(CFG_OUTLINE_THICKNESS); ++t) {
     XDrawLine(display, backbuf[monitor], gcs_all[color][monitor],
               x1 + t, y1, x2 + t, y2);
   }
@@ -930,79 +1174,125 @@ void DrawPoly(int monitor, XPoint *points, int npoints,
  *  GRID LOGIC
  *  =========================================================== */
 
+/*! \brief Set up the fixed puzzle for the given dimensions.
+ *
+ * The default dimensions use the hand-made tables above; any other size gets
+ * a staircase puzzle with a fixed seed.
+ */
+static void BuildFixedPuzzle(BreachPuzzle *p, int grid_size, int buffer_size,
+                             int num_targets, int target_len) {
+  if (grid_size != DEFAULT_GRID_SIZE || buffer_size != DEFAULT_BUFFER_SIZE ||
+      num_targets != DEFAULT_NUM_TARGETS || target_len != DEFAULT_TARGET_LEN) {
+    BuildStaircasePuzzle(p, grid_size, buffer_size, num_targets, target_len,
+                         0x9E3779B9u);
+    return;
+  }
+
+  memset(p, 0, sizeof(*p));
+  p->grid_size = grid_size;
+  p->buffer_size = buffer_size;
+  p->num_targets = num_targets;
+  for (int row = 0; row < grid_size; ++row) {
+    for (int col = 0; col < grid_size; ++col) {
+      p->code_matrix[row][col] = DEFAULT_CODE_MATRIX[row][col];
+    }
+  }
+  memcpy(p->hack_sequence, DEFAULT_HACK_SEQUENCE,
+         sizeof(DEFAULT_HACK_SEQUENCE));
+  memcpy(p->targets, DEFAULT_TARGETS, sizeof(DEFAULT_TARGETS));
+}
+
+/*! \brief Replace the puzzle with a freshly generated one of the same size.
+ *
+ * Must not be called while an input thread is using the grid state.
+ */
+static void NewRandomPuzzle(void) {
+  long budget_usec = (puzzle.grid_size <= DEFAULT_GRID_SIZE)
+                         ? CFG_PUZZLE_BUDGET_SMALL_US
+                         : CFG_PUZZLE_BUDGET_LARGE_US;
+  if (!GenerateBreachPuzzle(&puzzle, puzzle.grid_size, puzzle.buffer_size,
+                            puzzle.num_targets, puzzle_target_len,
+                            (uint32_t)rand(), budget_usec)) {
+    Log("Puzzle generation ran out of time; using a fallback puzzle");
+  }
+  BuildTargetMatcher(&target_matcher, &puzzle);
+}
+
 /*! \brief Initialize the grid state for a new prompt.
  */
 void InitGridState(GridState *gs) {
   gs->current_step = 0;
   gs->buffer_count = 0;
   gs->current_axis = AXIS_HORIZONTAL;
-  gs->active_row = HACK_SEQUENCE[0].row;
-  gs->active_col = HACK_SEQUENCE[0].col;
+  gs->active_row = puzzle.hack_sequence[0].row;
+  gs->active_col = puzzle.hack_sequence[0].col;
+  gs->active_rows = (GridBits)(1u << gs->active_row);
+  gs->active_cols = (GridBits)(1u << gs->active_col);
   memset(gs->buffer_codes, 0, sizeof(gs->buffer_codes));
-  memset(gs->sequence_complete, 0, sizeof(gs->sequence_complete));
+  memset(gs->used, 0, sizeof(gs->used));
+  gs->match_state[0] = 0;
+  gs->complete_mask[0] = 0;
+}
+
+/*! \brief Check if a cell is the next one to pick.
+ */
+static int IsCellCurrent(const GridState *gs, int row, int col) {
+  return (gs->active_rows >> row) & (gs->active_cols >> col) & 1;
 }
 
 /*! \brief Check if a cell has already been used in the hack sequence.
  */
 int IsCellUsed(const GridState *gs, int row, int col) {
-  for (int i = 0; i < gs->current_step; ++i) {
-    if (HACK_SEQUENCE[i].row == row && HACK_SEQUENCE[i].col == col) {
-      return 1;
-    }
-  }
-  return 0;
+  return (gs->used[row] >> col) & 1;
 }
 
-/*! \brief Check if each target appears as a contiguous subsequence in the
- * buffer.
+/*! \brief Check if a target appears as a contiguous subsequence in the buffer.
  */
-void CheckSequenceCompletion(GridState *gs) {
-  for (int t = 0; t < NUM_TARGETS; ++t) {
-    gs->sequence_complete[t] = 0;
-    if (TARGETS[t].length > gs->buffer_count) {
-      continue;
-    }
-    // Check all possible starting positions.
-    for (int start = 0; start <= gs->buffer_count - TARGETS[t].length;
-         ++start) {
-      int match = 1;
-      for (int j = 0; j < TARGETS[t].length; ++j) {
-        if (gs->buffer_codes[start + j] != TARGETS[t].codes[j]) {
-          match = 0;
-          break;
-        }
-      }
-      if (match) {
-        gs->sequence_complete[t] = 1;
-        break;
-      }
-    }
-  }
+static int IsSequenceComplete(const GridState *gs, int t) {
+  return (gs->complete_mask[gs->current_step] >> t) & 1;
+}
+
+/*! \brief Length of the longest prefix of a target matching a buffer suffix.
+ */
+static int SequenceMatchLength(const GridState *gs, int t) {
+  return target_matcher.prefix_len[gs->match_state[gs->current_step]][t];
 }
 
 /*! \brief Advance the grid state by one step (on keypress).
  */
 void GridAdvanceStep(GridState *gs) {
-  if (gs->current_step >= BUFFER_SIZE) {
+  if (gs->current_step >= puzzle.buffer_size) {
     return;
   }
 
   // Record the hex code at the current position.
-  int row = HACK_SEQUENCE[gs->current_step].row;
-  int col = HACK_SEQUENCE[gs->current_step].col;
-  gs->buffer_codes[gs->buffer_count] = CODE_MATRIX[row][col];
+  int step = gs->current_step;
+  int row = puzzle.hack_sequence[step].row;
+  int col = puzzle.hack_sequence[step].col;
+  int code = puzzle.code_matrix[row][col];
+  gs->buffer_codes[gs->buffer_count] = code;
   gs->buffer_count++;
   gs->current_step++;
 
+  // Push the next matcher state.
+  int state = target_matcher.next[gs->match_state[step]][code];
+  gs->match_state[step + 1] = state;
+  gs->complete_mask[step + 1] =
+      gs->complete_mask[step] | target_matcher.output[state];
+  gs->used[row] |= (GridBits)(1u << col);
+
   // Toggle axis and update active row/col from next hack sequence entry.
-  if (gs->current_step < BUFFER_SIZE) {
+  if (gs->current_step < puzzle.buffer_size) {
     gs->current_axis =
         (gs->current_axis == AXIS_HORIZONTAL) ? AXIS_VERTICAL : AXIS_HORIZONTAL;
-    gs->active_row = HACK_SEQUENCE[gs->current_step].row;
-    gs->active_col = HACK_SEQUENCE[gs->current_step].col;
+    gs->active_row = puzzle.hack_sequence[gs->current_step].row;
+    gs->active_col = puzzle.hack_sequence[gs->current_step].col;
+    gs->active_rows = (GridBits)(1u << gs->active_row);
+    gs->active_cols = (GridBits)(1u << gs->active_col);
+  } else {
+    gs->active_rows = 0;
+    gs->active_cols = 0;
   }
-
-  CheckSequenceCompletion(gs);
 }
 
 /*! \brief Rewind the grid state by one step (on backspace).
@@ -1012,16 +1302,18 @@ void GridRewindStep(GridState *gs) {
     return;
   }
 
+  // Pop; the per-step history below current_step is still valid.
   gs->current_step--;
   gs->buffer_count--;
 
   // Recompute axis: step 0 = horizontal, step 1 = vertical, etc.
   gs->current_axis =
       (gs->current_step % 2 == 0) ? AXIS_HORIZONTAL : AXIS_VERTICAL;
-  gs->active_row = HACK_SEQUENCE[gs->current_step].row;
-  gs->active_col = HACK_SEQUENCE[gs->current_step].col;
-
-  CheckSequenceCompletion(gs);
+  gs->active_row = puzzle.hack_sequence[gs->current_step].row;
+  gs->active_col = puzzle.hack_sequence[gs->current_step].col;
+  gs->active_rows = (GridBits)(1u << gs->active_row);
+  gs->active_cols = (GridBits)(1u << gs->active_col);
+  gs->used[gs->active_row] &= (GridBits)~(1u << gs->active_col);
 }
 
 /*! ===========================================================
@@ -1042,68 +1334,94 @@ typedef struct {
 
 void ComputeLayout(LayoutInfo *L) {
   // 1. Font metrics.
-  L->th = TextAscent() + TextDescent() + CFG_LINE_SPACING;
-  L->to = TextAscent() + CFG_LINE_SPACING / 2;
+  L->th = TextAscent() + TextDescent() + SCALED(CFG_LINE_SPACING);
+  L->to = TextAscent() + SCALED(CFG_LINE_SPACING) / 2;
 
   // 2. Cell/box sizes (0 = auto from font).
   int hex_tw = TextWidth("BD", 2);
 
-  L->grid_cw = (CFG_GRID_CELL_W > 0) ? CFG_GRID_CELL_W : hex_tw + CFG_GRID_PAD_H;
-  L->grid_ch = (CFG_GRID_CELL_H > 0) ? CFG_GRID_CELL_H : L->th + CFG_GRID_PAD_V;
-  L->buf_cw  = (CFG_BUF_CELL_W > 0)  ? CFG_BUF_CELL_W  : hex_tw + CFG_BUF_PAD_H;
-  L->buf_ch  = (CFG_BUF_CELL_H > 0)  ? CFG_BUF_CELL_H  : L->th + CFG_BUF_PAD_V;
-  L->seq_cw  = (CFG_SEQ_CELL_W > 0)  ? CFG_SEQ_CELL_W  : hex_tw + CFG_SEQ_PAD_H;
-  L->seq_ch  = (CFG_SEQ_CELL_H > 0)  ? CFG_SEQ_CELL_H  : L->th + CFG_SEQ_PAD_V;
+  L->grid_cw = (CFG_GRID_CELL_W > 0) ? SCALED(CFG_GRID_CELL_W)
+                                     : hex_tw + SCALED(CFG_GRID_PAD_H);
+  L->grid_ch = (CFG_GRID_CELL_H > 0) ? SCALED(CFG_GRID_CELL_H)
+                                     : L->th + SCALED(CFG_GRID_PAD_V);
+  L->buf_cw  = (CFG_BUF_CELL_W > 0) ? SCALED(CFG_BUF_CELL_W)
+                                    : hex_tw + SCALED(CFG_BUF_PAD_H);
+  L->buf_ch  = (CFG_BUF_CELL_H > 0) ? SCALED(CFG_BUF_CELL_H)
+                                    : L->th + SCALED(CFG_BUF_PAD_V);
+  L->seq_cw  = (CFG_SEQ_CELL_W > 0) ? SCALED(CFG_SEQ_CELL_W)
+                                    : hex_tw + SCALED(CFG_SEQ_PAD_H);
+  L->seq_ch  = (CFG_SEQ_CELL_H > 0) ? SCALED(CFG_SEQ_CELL_H)
+                                    : L->th + SCALED(CFG_SEQ_PAD_V);
+
+  // Larger puzzles shrink their cells to keep the default footprint.
+  if (puzzle.grid_size > DEFAULT_GRID_SIZE) {
+    L->grid_cw = L->grid_cw * DEFAULT_GRID_SIZE / puzzle.grid_size;
+    L->grid_ch = L->grid_ch * DEFAULT_GRID_SIZE / puzzle.grid_size;
+  }
+  if (puzzle.buffer_size > DEFAULT_BUFFER_SIZE) {
+    L->buf_cw = L->buf_cw * DEFAULT_BUFFER_SIZE / puzzle.buffer_size;
+  }
+  int max_target_len = 0;
+  for (int t = 0; t < puzzle.num_targets; ++t) {
+    if (puzzle.targets[t].length > max_target_len) {
+      max_target_len = puzzle.targets[t].length;
+    }
+  }
+  if (max_target_len > DEFAULT_TARGET_LEN) {
+    L->seq_cw = L->seq_cw * DEFAULT_TARGET_LEN / max_target_len;
+  }
 
   // 3. Bar dimensions.
-  L->bar_h = (CFG_BAR_H > 0) ? CFG_BAR_H : L->th / 2;
-  if (L->bar_h < CFG_BAR_H_MIN) L->bar_h = CFG_BAR_H_MIN;
+  L->bar_h = (CFG_BAR_H > 0) ? SCALED(CFG_BAR_H) : L->th / 2;
+  if (L->bar_h < SCALED(CFG_BAR_H_MIN)) L->bar_h = SCALED(CFG_BAR_H_MIN);
 
   if (CFG_BAR_W > 0) {
-    L->bar_w = CFG_BAR_W;
+    L->bar_w = SCALED(CFG_BAR_W);
   } else {
     int right_w;
     if (CFG_RIGHT_PANEL_W > 0) {
-      right_w = CFG_RIGHT_PANEL_W;
+      right_w = SCALED(CFG_RIGHT_PANEL_W);
     } else {
       int widest = TextWidth(CFG_TEXT_SEQ_HEADER, strlen(CFG_TEXT_SEQ_HEADER));
-      int buf_slots_w = BUFFER_SIZE * (L->buf_cw + CFG_SLOT_GAP);
+      int buf_slots_w =
+          puzzle.buffer_size * (L->buf_cw + SCALED(CFG_SLOT_GAP));
       if (buf_slots_w > widest) widest = buf_slots_w;
-      right_w = widest + CFG_RIGHT_PANEL_PAD;
+      right_w = widest + SCALED(CFG_RIGHT_PANEL_PAD);
     }
     L->bar_w = right_w;
   }
 
   // 4. Timer box dimensions.
-  L->timer_w = (CFG_TIMER_W > 0) ? CFG_TIMER_W
-             : TextWidth("99.99", 5) + CFG_TIMER_PAD_H * 2;
-  L->timer_h = (CFG_TIMER_H > 0) ? CFG_TIMER_H : L->th;
+  L->timer_w = (CFG_TIMER_W > 0) ? SCALED(CFG_TIMER_W)
+             : TextWidth("99.99", 5) + SCALED(CFG_TIMER_PAD_H) * 2;
+  L->timer_h = (CFG_TIMER_H > 0) ? SCALED(CFG_TIMER_H) : L->th;
 
   // 5. Region size.
-  L->region_w = CFG_REGION_W;
-  L->region_h = CFG_REGION_H;
+  L->region_w = SCALED(CFG_REGION_W);
+  L->region_h = SCALED(CFG_REGION_H);
 
   // 6. Right panel outline bounds (region-relative, around seq content).
-  int rp_pad = CFG_RIGHT_PANEL_OUTLINE_PAD;
-  int abs_seq_x = CFG_PANEL_X + CFG_SEQ_X;
-  int abs_seq_content_y = CFG_PANEL_Y + CFG_SEQ_Y + L->th;
+  int rp_pad = SCALED(CFG_RIGHT_PANEL_OUTLINE_PAD);
+  int abs_seq_x = SCALED(CFG_PANEL_X) + SCALED(CFG_SEQ_X);
+  int abs_seq_content_y = SCALED(CFG_PANEL_Y) + SCALED(CFG_SEQ_Y) + L->th;
 
   int rpanel_right_w;
   if (CFG_RIGHT_PANEL_W > 0) {
-    rpanel_right_w = CFG_RIGHT_PANEL_W;
+    rpanel_right_w = SCALED(CFG_RIGHT_PANEL_W);
   } else {
     int widest = TextWidth(CFG_TEXT_SEQ_HEADER, strlen(CFG_TEXT_SEQ_HEADER));
-    int buf_slots_w = BUFFER_SIZE * (L->buf_cw + CFG_SLOT_GAP);
+    int buf_slots_w = puzzle.buffer_size * (L->buf_cw + SCALED(CFG_SLOT_GAP));
     if (buf_slots_w > widest) widest = buf_slots_w;
-    rpanel_right_w = widest + CFG_RIGHT_PANEL_PAD;
+    rpanel_right_w = widest + SCALED(CFG_RIGHT_PANEL_PAD);
   }
 
   L->rpanel_x = abs_seq_x - rp_pad;
   L->rpanel_y = abs_seq_content_y - rp_pad;
-  L->rpanel_w = (CFG_RIGHT_PANEL_W > 0) ? CFG_RIGHT_PANEL_W
+  L->rpanel_w = (CFG_RIGHT_PANEL_W > 0) ? SCALED(CFG_RIGHT_PANEL_W)
               : rpanel_right_w + 2 * rp_pad;
-  L->rpanel_h = (CFG_RIGHT_PANEL_H > 0) ? CFG_RIGHT_PANEL_H
-              : NUM_TARGETS * (L->seq_ch + CFG_LINE_SPACING) + 2 * rp_pad;
+  L->rpanel_h = (CFG_RIGHT_PANEL_H > 0) ? SCALED(CFG_RIGHT_PANEL_H)
+              : puzzle.num_targets * (L->seq_ch + SCALED(CFG_LINE_SPACING))
+                + 2 * rp_pad;
 }
 
 /*! \brief Compute centiseconds remaining from deadline to now.
@@ -1140,7 +1458,7 @@ void DrawAnimatedText(int monitor, int x, int y, enum DrawColor color,
   if (total <= 0) return;
 
   struct timeval now;
-  gettimeofday(&now, NULL);
+  GetAnimationTime(&now);
   double t = (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
   // Position within current cycle.
   double pos = t - (double)(long long)(t / total) * total;
@@ -1156,11 +1474,233 @@ void DrawAnimatedText(int monitor, int x, int y, enum DrawColor color,
   DrawText(monitor, x, y, color, strings[idx]);
 }
 
+/*! ===========================================================
+ *  FRAME PROFILING
+ *  =========================================================== */
+
+// Client-side CPU time per section of a full frame, plus the X requests the
+// frame generated. Drawing calls only queue requests, so server-side
+// rendering time shows up in the blit section (XFlush) or not at all.
+
+#define CFG_PROFILE_FRAMES          512    /* Frames kept for percentiles */
+#define CFG_PROFILE_HUD_INTERVAL_MS 1000   /* HUD text refresh interval */
+#define CFG_PROFILE_LOG_INTERVAL_MS 10000  /* Log() summary interval */
+#define CFG_PROFILE_HUD_FONT        "monospace:size=8"
+
+enum ProfileSection {
+  PROF_RAIN,
+  PROF_DECORATIONS,
+  PROF_PANELS,
+  PROF_MATRIX,
+  PROF_BUFFER,
+  PROF_SEQUENCES,
+  PROF_BLIT,
+  PROF_TICK,  // RedrawTimerOnly(); not part of a full frame
+  NUM_PROF_SECTIONS
+};
+
+static const char *const PROFILE_SECTION_NAMES[NUM_PROF_SECTIONS] = {
+    "rain", "deco", "panels", "matrix", "buffer", "seq", "blit", "tick",
+};
+
+typedef struct {
+  //! Set between ProfileFrameBegin and ProfileFrameEnd.
+  int in_frame;
+  long long frame_start_us;
+  long long section_start_us;
+  unsigned long frame_start_request;
+  //! Ring of the most recent full frames.
+  long frame_us[CFG_PROFILE_FRAMES];
+  unsigned long frame_requests[CFG_PROFILE_FRAMES];
+  int next_frame;
+  int num_frames;
+  //! Totals since the last log summary.
+  long long section_us[NUM_PROF_SECTIONS];
+  long section_count[NUM_PROF_SECTIONS];
+  long frames_since_log;
+  long long last_hud_us;
+  long long last_log_us;
+  char hud[256];
+} FrameProfile;
+
+static FrameProfile profile;
+
+//! Start timing a section; no-op unless profiling.
+#define PROFILE_BEGIN()       \
+  do {                        \
+    if (profile_level) {      \
+      ProfileSectionBegin();  \
+    }                         \
+  } while (0)
+
+//! Stop timing a section and charge it to the given ProfileSection.
+#define PROFILE_END(section)         \
+  do {                               \
+    if (profile_level) {             \
+      ProfileSectionEnd(section);    \
+    }                                \
+  } while (0)
+
+static long long ProfileNowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void ProfileSectionBegin(void) {
+  profile.section_start_us = ProfileNowUs();
+}
+
+static void ProfileSectionEnd(enum ProfileSection section) {
+  // Sections drawn outside a full frame (e.g. baking result animations) are
+  // not charged, as they would skew the per-frame averages.
+  if (!profile.in_frame && section != PROF_TICK) {
+    return;
+  }
+  profile.section_us[section] += ProfileNowUs() - profile.section_start_us;
+  profile.section_count[section]++;
+}
+
+static int CompareLong(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+/*! \brief Format the current statistics.
+ *
+ * \param sep Separator between the frame line and the section line.
+ */
+static void FormatProfileSummary(char *buf, size_t size, const char *sep) {
+  long sorted[CFG_PROFILE_FRAMES];
+  int n = profile.num_frames;
+  unsigned long requests = 0;
+  for (int f = 0; f < n; ++f) {
+    sorted[f] = profile.frame_us[f];
+    requests += profile.frame_requests[f];
+  }
+  qsort(sorted, n, sizeof(sorted[0]), CompareLong);
+  long p50 = n ? sorted[n / 2] : 0;
+  long p95 = n ? sorted[n * 95 / 100] : 0;
+  long p99 = n ? sorted[n * 99 / 100] : 0;
+  int len = snprintf(buf, size,
+                     "frame p50 %.2f p95 %.2f p99 %.2f ms, %lu req/frame%s",
+                     p50 / 1000.0, p95 / 1000.0, p99 / 1000.0,
+                     n ? requests / n : 0, sep);
+  long frames = profile.frames_since_log ? profile.frames_since_log : 1;
+  for (int s = 0; s < NUM_PROF_SECTIONS && len > 0 && (size_t)len < size;
+       ++s) {
+    long count = (s == PROF_TICK) ? profile.section_count[s] : frames;
+    len += snprintf(buf + len, size - len, "%s%s %.2f", s ? " " : "",
+                    PROFILE_SECTION_NAMES[s],
+                    count ? profile.section_us[s] / 1000.0 / count : 0.0);
+  }
+  if (len > 0 && (size_t)len < size) {
+    snprintf(buf + len, size - len, " ms");
+  }
+}
+
+static void ProfileFrameBegin(void) {
+  profile.frame_start_us = ProfileNowUs();
+  profile.frame_start_request = NextRequest(display);
+  profile.in_frame = 1;
+}
+
+static void ProfileFrameEnd(void) {
+  long long now = ProfileNowUs();
+  profile.in_frame = 0;
+  profile.frame_us[profile.next_frame] = (long)(now - profile.frame_start_us);
+  profile.frame_requests[profile.next_frame] =
+      NextRequest(display) - profile.frame_start_request;
+  profile.next_frame = (profile.next_frame + 1) % CFG_PROFILE_FRAMES;
+  if (profile.num_frames < CFG_PROFILE_FRAMES) {
+    profile.num_frames++;
+  }
+  profile.frames_since_log++;
+
+  if (profile_level >= 2 &&
+      now - profile.last_hud_us >= CFG_PROFILE_HUD_INTERVAL_MS * 1000LL) {
+    FormatProfileSummary(profile.hud, sizeof(profile.hud), "\n");
+    profile.last_hud_us = now;
+  }
+  if (profile.last_log_us == 0) {
+    profile.last_log_us = now;
+  } else if (now - profile.last_log_us >= CFG_PROFILE_LOG_INTERVAL_MS * 1000LL) {
+    char line[256];
+    FormatProfileSummary(line, sizeof(line), "; ");
+    Log("Profile: %ld frames; %s", profile.frames_since_log, line);
+    memset(profile.section_us, 0, sizeof(profile.section_us));
+    memset(profile.section_count, 0, sizeof(profile.section_count));
+    profile.frames_since_log = 0;
+    profile.last_log_us = now;
+  }
+}
+
+/*! \brief Log the timing of an authentication attempt sent by authproto.
+ *
+ * With frame profiling, the frame statistics of the same period go along.
+ */
+void LogAuthprotoTiming(const char *timing) {
+  if (!profile_level) {
+    Log("authproto: %s", timing);
+    return;
+  }
+  char line[256];
+  FormatProfileSummary(line, sizeof(line), "; ");
+  Log("Profile: authproto %s; %s", timing, line);
+}
+
+/*! \brief Draw the profiling HUD into the bottom left corner.
+ */
+static void DrawProfileHud(int monitor) {
+  if (profile_level < 2 || profile.hud[0] == 0) {
+    return;
+  }
+  FontPush(ScaledXftFont(CFG_PROFILE_HUD_FONT), NULL, -1);
+  int line_h = ActiveTextAscent() + ActiveTextDescent();
+  DrawText(monitor, SCALED(8), backbuf_h[monitor] - 2 * line_h - SCALED(8),
+           COLOR_CYBER_YELLOW, profile.hud);
+  FontPop();
+}
+
 /*! ===========================================================
  *  DRAWING FUNCTIONS
  *  =========================================================== */
 
-/*! \brief Draw the 5x5 CODE MATRIX section.
+/*! \brief Draw the cells of the CODE MATRIX.
+ *
+ * DrawCodeMatrix calls this with a literal grid size for the common sizes, so
+ * the compiler can specialize and unroll those loops.
+ *
+ * \param n The grid size; must equal puzzle.grid_size.
+ */
+static inline void DrawCodeMatrixCells(int monitor, int gx, int gy,
+                                       int cell_w, int cell_h,
+                                       const GridState *gs, int started,
+                                       int n) {
+  for (int row = 0; row < n; ++row) {
+    for (int col = 0; col < n; ++col) {
+      int cx = gx + col * cell_w;
+      int cy = gy + row * cell_h;
+
+      int is_current = started && IsCellCurrent(gs, row, col);
+      int used = IsCellUsed(gs, row, col);
+
+      enum DrawColor bg = is_current ? CFG_GRID_CELL_ACTIVE_BG : NO_COLOR;
+      enum DrawColor ol = used ? CFG_GRID_CELL_USED_OUTLINE : NO_COLOR;
+      enum DrawColor text_color = used ? CFG_GRID_CELL_USED_FG
+                                  : is_current ? CFG_GRID_CELL_ACTIVE_FG
+                                  : CFG_GRID_CELL_FG;
+
+      const char *hex =
+          used ? "[  ]" : HEX_CODES[puzzle.code_matrix[row][col]];
+      int hxlen = strlen(hex);
+      DrawBox(monitor, cx, cy, cell_w, cell_h, bg, ol, hex, hxlen,
+              text_color, 0);
+    }
+  }
+}
+
+/*! \brief Draw the CODE MATRIX section.
  *
  * \param monitor The window index.
  * \param ox X origin of the matrix area.
@@ -1171,20 +1711,21 @@ void DrawAnimatedText(int monitor, int x, int y, enum DrawColor color,
  */
 void DrawCodeMatrix(int monitor, int ox, int oy, int cell_w, int cell_h,
                     const GridState *gs) {
-  int inset_l = CFG_GRID_OUTLINE_THICKNESS + CFG_GRID_OUTLINE_PAD_LEFT;
-  int inset_t = CFG_GRID_OUTLINE_THICKNESS + CFG_GRID_OUTLINE_PAD_TOP;
-  int cells_w = GRID_SIZE * cell_w;
-  int cells_h = GRID_SIZE * cell_h;
-  int outline_w = CFG_GRID_OUTLINE_PAD_LEFT + cells_w + CFG_GRID_OUTLINE_PAD_RIGHT
-                  + 2 * CFG_GRID_OUTLINE_THICKNESS;
-  int outline_h = CFG_GRID_OUTLINE_PAD_TOP + cells_h + CFG_GRID_OUTLINE_PAD_BOTTOM
-                  + 2 * CFG_GRID_OUTLINE_THICKNESS;
+  int thickness = SCALED(CFG_GRID_OUTLINE_THICKNESS);
+  int inset_l = thickness + SCALED(CFG_GRID_OUTLINE_PAD_LEFT);
+  int inset_t = thickness + SCALED(CFG_GRID_OUTLINE_PAD_TOP);
+  int cells_w = puzzle.grid_size * cell_w;
+  int cells_h = puzzle.grid_size * cell_h;
+  int outline_w = inset_l + cells_w + SCALED(CFG_GRID_OUTLINE_PAD_RIGHT)
+                  + thickness;
+  int outline_h = inset_t + cells_h + SCALED(CFG_GRID_OUTLINE_PAD_BOTTOM)
+                  + thickness;
 
   // Draw grid outline.
   if (CFG_GRID_OUTLINE_THICKNESS > 0) {
     DrawRectGlow(monitor, ox, oy, outline_w, outline_h);
     DrawRect(monitor, ox, oy, outline_w, outline_h,
-             CFG_GRID_OUTLINE_COLOR, CFG_GRID_OUTLINE_THICKNESS);
+             CFG_GRID_OUTLINE_COLOR, thickness);
     // Pentagon sitting on top of grid outline (adjust points as needed).
     XPoint pentagon[5] = {
       { ox + outline_w / 30,  oy - outline_h / 10  },  // top apex
@@ -1201,7 +1742,7 @@ void DrawCodeMatrix(int monitor, int ox, int oy, int cell_w, int cell_h,
       int pent_top = oy - outline_h / 10;
       int pent_bot = oy;
       int text_y = (pent_top + pent_bot + TextAscent() - TextDescent()) / 2;
-      int text_x = ox + outline_w / 30 + 8;
+      int text_x = ox + outline_w / 30 + SCALED(8);
       DrawText(monitor, text_x, text_y, COLOR_BACKGROUND, CFG_TEXT_CODE_MATRIX);
     }
   }
@@ -1209,10 +1750,10 @@ void DrawCodeMatrix(int monitor, int ox, int oy, int cell_w, int cell_h,
   // Cell origin (inset from outline).
   int gx = ox + inset_l;
   int gy = oy + inset_t;
-  int inner_x = ox + CFG_GRID_OUTLINE_THICKNESS;
-  int inner_y = oy + CFG_GRID_OUTLINE_THICKNESS;
-  int inner_w = outline_w - 2 * CFG_GRID_OUTLINE_THICKNESS;
-  int inner_h = outline_h - 2 * CFG_GRID_OUTLINE_THICKNESS;
+  int inner_x = ox + thickness;
+  int inner_y = oy + thickness;
+  int inner_w = outline_w - 2 * thickness;
+  int inner_h = outline_h - 2 * thickness;
 
   // Draw full-width row / full-height column highlights (spans padding).
   // Skip highlight when no input has been entered yet.
@@ -1227,28 +1768,20 @@ void DrawCodeMatrix(int monitor, int ox, int oy, int cell_w, int cell_h,
     }
   }
 
-  for (int row = 0; row < GRID_SIZE; ++row) {
-    for (int col = 0; col < GRID_SIZE; ++col) {
-      int cx = gx + col * cell_w;
-      int cy = gy + row * cell_h;
-
-      int is_current = (started &&
-                        gs->current_step < BUFFER_SIZE &&
-                        row == HACK_SEQUENCE[gs->current_step].row &&
-                        col == HACK_SEQUENCE[gs->current_step].col);
-      int used = IsCellUsed(gs, row, col);
-
-      enum DrawColor bg = is_current ? CFG_GRID_CELL_ACTIVE_BG : NO_COLOR;
-      enum DrawColor ol = used ? CFG_GRID_CELL_USED_OUTLINE : NO_COLOR;
-      enum DrawColor text_color = used ? CFG_GRID_CELL_USED_FG
-                                  : is_current ? CFG_GRID_CELL_ACTIVE_FG
-                                  : CFG_GRID_CELL_FG;
-
-      const char *hex = used ? "[  ]" : HEX_CODES[CODE_MATRIX[row][col]];
-      int hxlen = strlen(hex);
-      DrawBox(monitor, cx, cy, cell_w, cell_h, bg, ol, hex, hxlen,
-              text_color, 0);
-    }
+  switch (puzzle.grid_size) {
+    case 5:
+      DrawCodeMatrixCells(monitor, gx, gy, cell_w, cell_h, gs, started, 5);
+      break;
+    case 6:
+      DrawCodeMatrixCells(monitor, gx, gy, cell_w, cell_h, gs, started, 6);
+      break;
+    case 7:
+      DrawCodeMatrixCells(monitor, gx, gy, cell_w, cell_h, gs, started, 7);
+      break;
+    default:
+      DrawCodeMatrixCells(monitor, gx, gy, cell_w, cell_h, gs, started,
+                          puzzle.grid_size);
+      break;
   }
 
   // Decorations
@@ -1266,11 +1799,7 @@ void DrawCodeMatrix(int monitor, int ox, int oy, int cell_w, int cell_h,
       4.0f, 1.0f, 0.3f, 0.3f, 0.3f, 0.3f, 0.3f, 0.3f
     };
 
-    static XftFont *font_override = NULL;
-    if (!font_override)
-      font_override = FixedXftFontOpenName(display, DefaultScreen(display),
-                                           "monospace:size=6");
-    FontPush(font_override, NULL, 0);
+    FontPush(ScaledXftFont("monospace:size=6"), NULL, 0);
     DrawAnimatedText(monitor, ox, oy + cells_h + cell_h / 4,
                      COLOR_CYBER_YELLOW, ANIMATED_STRINGS, 8, ANIMATED_DURATIONS);
 
@@ -1294,23 +1823,27 @@ void DrawCodeMatrix(int monitor, int ox, int oy, int cell_w, int cell_h,
  */
 void DrawBufferSection(int monitor, int ox, int oy, int cell_w, int cell_h,
                        const GridState *gs) {
-  int buffer_w = BUFFER_SIZE * (cell_w + CFG_SLOT_GAP) - CFG_SLOT_GAP;
+  int gap = SCALED(CFG_SLOT_GAP);
+  int buffer_w = puzzle.buffer_size * (cell_w + gap) - gap;
 
   // Draw buffer outline.
   if (CFG_BUFFER_OUTLINE_THICKNESS > 0) {
-    int ol_x = ox - CFG_BUFFER_OUTLINE_PAD_LEFT - CFG_BUFFER_OUTLINE_THICKNESS;
-    int ol_y = oy - CFG_BUFFER_OUTLINE_PAD_TOP - CFG_BUFFER_OUTLINE_THICKNESS;
-    int ol_w = CFG_BUFFER_OUTLINE_PAD_LEFT + buffer_w + CFG_BUFFER_OUTLINE_PAD_RIGHT
-               + 2 * CFG_BUFFER_OUTLINE_THICKNESS;
-    int ol_h = CFG_BUFFER_OUTLINE_PAD_TOP + cell_h + CFG_BUFFER_OUTLINE_PAD_BOTTOM
-               + 2 * CFG_BUFFER_OUTLINE_THICKNESS;
+    int thickness = SCALED(CFG_BUFFER_OUTLINE_THICKNESS);
+    int pad_l = SCALED(CFG_BUFFER_OUTLINE_PAD_LEFT);
+    int pad_t = SCALED(CFG_BUFFER_OUTLINE_PAD_TOP);
+    int ol_x = ox - pad_l - thickness;
+    int ol_y = oy - pad_t - thickness;
+    int ol_w = pad_l + buffer_w + SCALED(CFG_BUFFER_OUTLINE_PAD_RIGHT)
+               + 2 * thickness;
+    int ol_h = pad_t + cell_h + SCALED(CFG_BUFFER_OUTLINE_PAD_BOTTOM)
+               + 2 * thickness;
     DrawRectGlow(monitor, ol_x, ol_y, ol_w, ol_h);
     DrawRect(monitor, ol_x, ol_y, ol_w, ol_h,
-             CFG_BUFFER_OUTLINE_COLOR, CFG_BUFFER_OUTLINE_THICKNESS);
+             CFG_BUFFER_OUTLINE_COLOR, thickness);
   }
 
-  for (int i = 0; i < BUFFER_SIZE; ++i) {
-    int sx = ox + i * (cell_w + CFG_SLOT_GAP);
+  for (int i = 0; i < puzzle.buffer_size; ++i) {
+    int sx = ox + i * (cell_w + gap);
     int sy = oy;
     int filled = (i < gs->buffer_count);
 
@@ -1326,8 +1859,8 @@ void DrawBufferSection(int monitor, int ox, int oy, int cell_w, int cell_h,
     if (!filled) {
       // Empty slot: dashed outline, text only (no solid outline via DrawBox).
       DrawRectDashed(monitor, sx, sy, cell_w, cell_h,
-                     CFG_BUFFER_SLOT_OUTLINE, CFG_OUTLINE_THICKNESS,
-                     CFG_BUFFER_DASH_LEN, CFG_BUFFER_DASH_GAP);
+                     CFG_BUFFER_SLOT_OUTLINE, SCALED(CFG_OUTLINE_THICKNESS),
+                     SCALED(CFG_BUFFER_DASH_LEN), SCALED(CFG_BUFFER_DASH_GAP));
       DrawBox(monitor, sx, sy, cell_w, cell_h, bg, NO_COLOR,
               txt, tlen, fg, 0);
     } else {
@@ -1357,7 +1890,7 @@ void DrawTimerText(int monitor, int ox, int oy, int box_w, int box_h,
       (csec_remaining < CFG_TIMER_RED_THRESHOLD) ? CFG_TIMER_LOW_FG : CFG_TIMER_FG;
   DrawRectGlow(monitor, ox, oy, box_w, box_h);
   DrawBox(monitor, ox, oy, box_w, box_h, NO_COLOR, CFG_TIMER_OUTLINE,
-          timebuf, 5, timer_color, CFG_TIMER_PAD_H);
+          timebuf, 5, timer_color, SCALED(CFG_TIMER_PAD_H));
 }
 
 /*! \brief Draw the progress bar.
@@ -1394,23 +1927,23 @@ void DrawSequenceSection(int monitor, int ox, int oy, int cell_w, int cell_h,
                          int panel_w, const GridState *gs) {
   // Find the longest sequence to align all DATAMINE labels at the same x.
   int max_len = 0;
-  for (int t = 0; t < NUM_TARGETS; ++t) {
-    if (TARGETS[t].length > max_len) max_len = TARGETS[t].length;
+  for (int t = 0; t < puzzle.num_targets; ++t) {
+    if (puzzle.targets[t].length > max_len) max_len = puzzle.targets[t].length;
   }
-  int name_x = ox + max_len * (cell_w + CFG_SEQ_HEX_GAP)
-               - CFG_SEQ_HEX_GAP + CFG_SEQ_NAME_MARGIN;
+  int name_x = ox + max_len * (cell_w + SCALED(CFG_SEQ_HEX_GAP))
+               - SCALED(CFG_SEQ_HEX_GAP) + SCALED(CFG_SEQ_NAME_MARGIN);
   // Row width for completed box spans the full panel content area.
   int row_w = panel_w;
 
   // Parse comma-separated completion texts (one per target).
-  const char *complete_texts[NUM_TARGETS];
-  int complete_text_lens[NUM_TARGETS];
+  const char *complete_texts[MAX_TARGETS];
+  int complete_text_lens[MAX_TARGETS];
   {
     const char *p = CFG_SEQ_COMPLETE_TEXTS;
-    for (int t = 0; t < NUM_TARGETS; ++t) {
+    for (int t = 0; t < puzzle.num_targets; ++t) {
       complete_texts[t] = p;
       const char *comma = strchr(p, ',');
-      if (comma && t < NUM_TARGETS - 1) {
+      if (comma && t < puzzle.num_targets - 1) {
         complete_text_lens[t] = (int)(comma - p);
         p = comma + 1;
       } else {
@@ -1419,8 +1952,8 @@ void DrawSequenceSection(int monitor, int ox, int oy, int cell_w, int cell_h,
     }
   }
 
-  for (int t = 0; t < NUM_TARGETS; ++t) {
-    int complete = gs->sequence_complete[t];
+  for (int t = 0; t < puzzle.num_targets; ++t) {
+    int complete = IsSequenceComplete(gs, t);
 
     if (complete) {
       // Replace entire row (hex boxes + name) with a single filled box.
@@ -1429,25 +1962,12 @@ void DrawSequenceSection(int monitor, int ox, int oy, int cell_w, int cell_h,
               complete_texts[t], complete_text_lens[t],
               CFG_SEQ_COMPLETE_FG, 0);
     } else {
-      // Find longest prefix of this target matching a buffer suffix.
-      int match_count = 0;
-      for (int start = 0; start < gs->buffer_count; ++start) {
-        int len = 0;
-        for (int j = 0; j < TARGETS[t].length
-                         && (start + j) < gs->buffer_count; ++j) {
-          if (gs->buffer_codes[start + j] == TARGETS[t].codes[j])
-            len++;
-          else
-            break;
-        }
-        if (start + len == gs->buffer_count && len > match_count)
-          match_count = len;
-      }
+      int match_count = SequenceMatchLength(gs, t);
 
       // Draw outlined hex code boxes (left-aligned).
-      for (int j = 0; j < TARGETS[t].length; ++j) {
-        int sx = ox + j * (cell_w + CFG_SEQ_HEX_GAP);
-        const char *hex = HEX_CODES[TARGETS[t].codes[j]];
+      for (int j = 0; j < puzzle.targets[t].length; ++j) {
+        int sx = ox + j * (cell_w + SCALED(CFG_SEQ_HEX_GAP));
+        const char *hex = HEX_CODES[puzzle.targets[t].codes[j]];
         int hxlen = strlen(hex);
 
         int matched = j < match_count;
@@ -1466,18 +1986,14 @@ void DrawSequenceSection(int monitor, int ox, int oy, int cell_w, int cell_h,
     if (!complete) {
       int name_y = oy + (cell_h + TextAscent() - TextDescent()) / 2;
       DrawString(monitor, name_x, name_y, CFG_SEQ_NAME_FG,
-                 TARGETS[t].name, strlen(TARGETS[t].name));
+                 puzzle.targets[t].name, strlen(puzzle.targets[t].name));
     }
 
-    oy += cell_h + CFG_LINE_SPACING;
+    oy += cell_h + SCALED(CFG_LINE_SPACING);
   }
 
   // Decorations
-  static XftFont *font_override = NULL;
-  if (!font_override)
-    font_override = FixedXftFontOpenName(display, DefaultScreen(display),
-                                    "monospace:size=6");
-  FontPush(font_override, NULL, -1);
+  FontPush(ScaledXftFont("monospace:size=6"), NULL, -1);
   DrawText(monitor, ox, oy + cell_h / 3, COLOR_CYBER_YELLOW,
            "CUSTOM GLITCHES ON UI MAY APPEAR BASED ON THIS ANALYSIS,\n"
            "DOCUMENT/D/1II9YQJZ5XQLH8N2LV9N7EUJVXO5YVZP2KXUOQ6A\n"
@@ -1597,7 +2113,7 @@ void DecoMatrixDraw(DecoMatrix *dm, int monitor, int x, int y,
   for (int i = 0; i < dm->num_frames; ++i) total += dm->durations[i];
   if (total > 0) {
     struct timeval now;
-    gettimeofday(&now, NULL);
+    GetAnimationTime(&now);
     double t = (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
     long long cycle = (long long)(t / total);
     if (dm->last_cycle >= 0 && cycle != dm->last_cycle)
@@ -1623,9 +2139,7 @@ typedef struct {
   int fill_col;         /* Next column to fill in bottom row */
   double last_tick;     /* Timestamp of last cell placement */
   float speed;          /* Cells per second */
-#ifdef HAVE_XFT_EXT
-  XftFont *font;        /* Dedicated rain font (owned) */
-#endif
+  const char *font_pattern;  /* Rain font, opened via ScaledXftFont() */
 } RainMatrix;
 
 /*! \brief Initialize the rain matrix.
@@ -1644,12 +2158,9 @@ void RainMatrixInit(RainMatrix *rm, int rows, int cols, float speed,
       snprintf(rm->cells[r][c], 3, "%02X", rand() % 256);
   /* Last row starts empty (will be filled cell by cell). */
   memset(rm->cells[rows - 1], 0, sizeof(rm->cells[0]));
-#ifdef HAVE_XFT_EXT
-  rm->font = FixedXftFontOpenName(display, DefaultScreen(display),
-                                   font_pattern);
-#endif
+  rm->font_pattern = font_pattern;
   struct timeval tv;
-  gettimeofday(&tv, NULL);
+  GetAnimationTime(&tv);
   rm->last_tick = (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
   rm->initialized = 1;
 }
@@ -1658,7 +2169,7 @@ void RainMatrixInit(RainMatrix *rm, int rows, int cols, float speed,
  */
 static void RainMatrixUpdate(RainMatrix *rm) {
   struct timeval tv;
-  gettimeofday(&tv, NULL);
+  GetAnimationTime(&tv);
   double now = (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
   int cells_to_add = (int)((now - rm->last_tick) * rm->speed);
   if (cells_to_add <= 0) return;
@@ -1686,11 +2197,11 @@ void RainMatrixDraw(RainMatrix *rm, int monitor, int x, int y) {
 
   /* Push rain font. */
 #ifdef HAVE_XFT_EXT
-  FontPush(rm->font, NULL, -1);
+  FontPush(ScaledXftFont(rm->font_pattern), NULL, -1);
 #else
   FontPush(NULL, NULL, -1);
 #endif
-  int line_h = ActiveTextAscent() + ActiveTextDescent() + 2;
+  int line_h = ActiveTextAscent() + ActiveTextDescent() + SCALED(2);
 
   int num_groups = rm->rows / CFG_RAIN_GROUP_SIZE;
   if (num_groups < 1) num_groups = 1;
@@ -1726,197 +2237,519 @@ void RainMatrixDraw(RainMatrix *rm, int monitor, int x, int y) {
   FontPop();
 }
 
-/*! \brief Display the full Breach Protocol UI (all sections).
+/*! \brief Draw the active queued message, if any, on top of the backbuffer.
+ */
+void DrawMessageOverlay(int monitor, const QueuedMessage *msg) {
+  if (msg == NULL) {
+    return;
+  }
+  int th = TextAscent() + TextDescent() + SCALED(CFG_LINE_SPACING);
+  int len_title = strlen(msg->title);
+  int len_text = strlen(msg->text);
+  int tw_title = TextWidth(msg->title, len_title);
+  int tw_text = TextWidth(msg->text, len_text);
+  int box_w = (tw_title > tw_text ? tw_title : tw_text) + 4 * th;
+  int box_h = 4 * th;
+  int x = (backbuf_w[monitor] - box_w) / 2;
+  int y = backbuf_h[monitor] * CFG_MESSAGE_Y_PERCENT / 100 - box_h / 2;
+  enum DrawColor fg = msg->is_warning ? COLOR_WARNING : COLOR_CYBER_YELLOW;
+
+  DrawRectGlow(monitor, x, y, box_w, box_h);
+  DrawBox(monitor, x, y, box_w, box_h, COLOR_BACKGROUND, fg, NULL, 0,
+          NO_COLOR, 0);
+  DrawBox(monitor, x, y + th / 2, box_w, th, NO_COLOR, NO_COLOR, msg->title,
+          len_title, fg, 0);
+  DrawBox(monitor, x, y + th * 5 / 2, box_w, th, NO_COLOR, NO_COLOR,
+          msg->text, len_text, fg, 0);
+}
+
+/*! \brief Draw the Breach Protocol UI into the backbuffer of one window.
  *
- * Draws everything to offscreen backbuffers, then blits atomically.
- * Called on first render, after input, and after monitor changes.
+ * The caller selects the window's scale via BeginWindowScale() first.
  */
-void DisplayBreachProtocolFull(const GridState *gs, int csec_remaining,
-                               int csec_total) {
+void DrawBreachProtocol(size_t i, const GridState *gs, int csec_remaining,
+                        int csec_total, int content_x_offset,
+                        int content_y_offset) {
   LayoutInfo L;
   ComputeLayout(&L);
 
-  // Compute burn-in mitigation offset for content (not window position).
-  int content_x_offset = 0;
-  int content_y_offset = 0;
-  if (burnin_mitigation_max_offset_change > 0) {
-    x_offset += rand() % (2 * burnin_mitigation_max_offset_change + 1) -
-                burnin_mitigation_max_offset_change;
-    if (x_offset < -burnin_mitigation_max_offset) {
-      x_offset = -burnin_mitigation_max_offset;
-    }
-    if (x_offset > burnin_mitigation_max_offset) {
-      x_offset = burnin_mitigation_max_offset;
-    }
-    y_offset += rand() % (2 * burnin_mitigation_max_offset_change + 1) -
-                burnin_mitigation_max_offset_change;
-    if (y_offset < -burnin_mitigation_max_offset) {
-      y_offset = -burnin_mitigation_max_offset;
-    }
-    if (y_offset > burnin_mitigation_max_offset) {
-      y_offset = burnin_mitigation_max_offset;
-    }
-    content_x_offset = x_offset;
-    content_y_offset = y_offset;
-  }
-
-  // Use negative values to signal full-monitor mode.
-  UpdatePerMonitorWindows(per_monitor_windows_dirty, -1, -1, 0, 0);
-  per_monitor_windows_dirty = 0;
-
-  for (size_t i = 0; i < num_windows; ++i) {
-    // Clear backbuffer.
-    FillRect(i, 0, 0, backbuf_w[i], backbuf_h[i], COLOR_CONTENT_BG);
+  // Clear backbuffer.
+  FillRect(i, 0, 0, backbuf_w[i], backbuf_h[i], COLOR_CONTENT_BG);
 
-    // Background rain matrix.
+  // Background rain matrix.
 #if CFG_RAIN_SHOW
-    {
-      static RainMatrix rain;
-      if (!rain.initialized)
-        RainMatrixInit(&rain, CFG_RAIN_ROWS, CFG_RAIN_COLS,
-                       CFG_RAIN_SPEED, CFG_RAIN_FONT);
-      RainMatrixDraw(&rain, i, 4, ActiveTextAscent() + 4);
-    }
+  PROFILE_BEGIN();
+  {
+    static RainMatrix rain;
+    if (!rain.initialized)
+      RainMatrixInit(&rain, CFG_RAIN_ROWS, CFG_RAIN_COLS,
+                     CFG_RAIN_SPEED, CFG_RAIN_FONT);
+    RainMatrixDraw(&rain, i, SCALED(4), ActiveTextAscent() + SCALED(4));
+  }
+  PROFILE_END(PROF_RAIN);
 #endif
 
-    // Center content on the monitor with burn-in offset.
-    int cx = (backbuf_w[i] - L.region_w) / 2 + content_x_offset;
-    int cy = (backbuf_h[i] - L.region_h) / 2 + content_y_offset;
-
-    // Panel origin (all sections are relative to this).
-    int px = cx + CFG_PANEL_X;
-    int py = cy + CFG_PANEL_Y;
-
-    // Draw decorations
-    static const char *const ANIMATED_STRINGS[] = {
-      "              \n   NET≡≡≡TECH   \n              ",
-      "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
-      "              \n   NET≡≡≡TECH   \n              ",
-      "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
-      "              \n   NET≡≡≡TECH   \n              ",
-      "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
-      "              \n   NET≡≡≡TECH   \n              ",
-      "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
-    };
-    static const float ANIMATED_DURATIONS[] = {
-      3.0f, 0.3f, 0.3f, 0.3f, 0.3f, 0.3f, 0.3f, 3.0f
-    };
+  // Center content on the monitor with burn-in offset.
+  int cx = (backbuf_w[i] - L.region_w) / 2 + content_x_offset;
+  int cy = (backbuf_h[i] - L.region_h) / 2 + content_y_offset;
 
-    static XftFont *font_override = NULL;
-    if (!font_override)
-      font_override = FixedXftFontOpenName(display, DefaultScreen(display),
-                                           "monospace:size=10");
-    FontPush(font_override, NULL, -1);
-    DrawAnimatedText(i, 20, 20, COLOR_CYBER_YELLOW, ANIMATED_STRINGS, 8, ANIMATED_DURATIONS);
-    FontPop();
+  // Panel origin (all sections are relative to this).
+  int px = cx + SCALED(CFG_PANEL_X);
+  int py = cy + SCALED(CFG_PANEL_Y);
+
+  // Draw decorations
+  PROFILE_BEGIN();
+  static const char *const ANIMATED_STRINGS[] = {
+    "              \n   NET≡≡≡TECH   \n              ",
+    "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
+    "              \n   NET≡≡≡TECH   \n              ",
+    "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
+    "              \n   NET≡≡≡TECH   \n              ",
+    "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
+    "              \n   NET≡≡≡TECH   \n              ",
+    "≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡NET≡≡≡TECH≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡\n≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡≡",
+  };
+  static const float ANIMATED_DURATIONS[] = {
+    3.0f, 0.3f, 0.3f, 0.3f, 0.3f, 0.3f, 0.3f, 3.0f
+  };
 
-    // Decorations
+  FontPush(ScaledXftFont("monospace:size=10"), NULL, -1);
+  DrawAnimatedText(i, SCALED(20), SCALED(20), COLOR_CYBER_YELLOW,
+                   ANIMATED_STRINGS, 8, ANIMATED_DURATIONS);
+  FontPop();
+
+  // Decorations
 #if CFG_SHOW_RIGHT_PANEL
-    {
-      static DecoMatrix deco_matrix;
-      if (!deco_matrix.initialized) DecoMatrixInit(&deco_matrix, 10, 10, 0.3f, 0.1f);
-      int rpx = cx + L.rpanel_x;
-      int rpy = cy + L.rpanel_y;
-      DecoMatrixDraw(&deco_matrix, i, rpx + 100, rpy + L.rpanel_h + 80 + TextAscent(),
-                     COLOR_CYBER_DIM);
-    }
+  {
+    static DecoMatrix deco_matrix;
+    if (!deco_matrix.initialized) DecoMatrixInit(&deco_matrix, 10, 10, 0.3f, 0.1f);
+    int rpx = cx + L.rpanel_x;
+    int rpy = cy + L.rpanel_y;
+    DecoMatrixDraw(&deco_matrix, i, rpx + SCALED(100),
+                   rpy + L.rpanel_h + SCALED(80) + TextAscent(),
+                   COLOR_CYBER_DIM);
+  }
 #endif
 
   {
-    static XftFont *font_override = NULL;
-    if (!font_override)
-      font_override = FixedXftFontOpenName(display, DefaultScreen(display),
-                                           "monospace:size=7");
-    FontPush(font_override, NULL, -1);
-    DrawText(i, CFG_PANEL_X, CFG_PANEL_Y + CFG_PANEL_H + 10, COLOR_CYBER_YELLOW,
+    FontPush(ScaledXftFont("monospace:size=7"), NULL, -1);
+    DrawText(i, SCALED(CFG_PANEL_X),
+             SCALED(CFG_PANEL_Y) + SCALED(CFG_PANEL_H) + SCALED(10),
+             COLOR_CYBER_YELLOW,
              "CUSTOM GLITCHES ON UI MAY APPEAR BASED ON THIS ANALYSIS,\n"
              "DOCUMENT/D/1II9YQJZ5XQLH8N2LV9N7EUJVXO5YVZP2KXUOQ6A\n"
              "TYPE: CYBERSPACE");
     FontPop();
   }
+  PROFILE_END(PROF_DECORATIONS);
 
-    // Draw panel outline.
+  // Draw panel outline.
+  PROFILE_BEGIN();
 #if CFG_SHOW_PANEL
-    DrawRectGlow(i, px, py, CFG_PANEL_W, CFG_PANEL_H);
-    DrawRect(i, px, py,
-             CFG_PANEL_W, CFG_PANEL_H, COLOR_PANEL_BG, CFG_OUTLINE_THICKNESS);
+  DrawRectGlow(i, px, py, SCALED(CFG_PANEL_W), SCALED(CFG_PANEL_H));
+  DrawRect(i, px, py, SCALED(CFG_PANEL_W), SCALED(CFG_PANEL_H),
+           COLOR_PANEL_BG, SCALED(CFG_OUTLINE_THICKNESS));
 #endif
 
-    // Draw right panel outline.
+  // Draw right panel outline.
 #if CFG_SHOW_RIGHT_PANEL
-    if (CFG_RIGHT_PANEL_OUTLINE_THICKNESS > 0) {
-      int rpx = cx + L.rpanel_x;
-      int rpy = cy + L.rpanel_y;
-      DrawRectGlow(i, rpx, rpy, L.rpanel_w, L.rpanel_h);
-      DrawRect(i, rpx, rpy,
-               L.rpanel_w, L.rpanel_h,
-               CFG_RIGHT_PANEL_OUTLINE_COLOR, CFG_RIGHT_PANEL_OUTLINE_THICKNESS);
-      // Pentagon outline sitting on top of right panel outline.
-      XPoint rp_pent[6] = {
-        { rpx + L.rpanel_w / 50,  rpy - L.rpanel_h / 4 },
-        { rpx + L.rpanel_w,       rpy - L.rpanel_h / 4 },
-        { rpx + L.rpanel_w,       rpy                   },
-        { rpx,                    rpy                   },
-        { rpx,                    rpy - L.rpanel_h / 8 },
-        { rpx + L.rpanel_w / 50,  rpy - L.rpanel_h / 4 },
-      };
-      DrawPolygonGlow(i, rp_pent, 6, 0);
-      XDrawLines(display, backbuf[i],
-                 gcs_all[COLOR_CYBER_YELLOW][i],
-                 rp_pent, 6, CoordModeOrigin);
-    }
+  if (CFG_RIGHT_PANEL_OUTLINE_THICKNESS > 0) {
+    int rpx = cx + L.rpanel_x;
+    int rpy = cy + L.rpanel_y;
+    DrawRectGlow(i, rpx, rpy, L.rpanel_w, L.rpanel_h);
+    DrawRect(i, rpx, rpy,
+             L.rpanel_w, L.rpanel_h,
+             CFG_RIGHT_PANEL_OUTLINE_COLOR,
+             SCALED(CFG_RIGHT_PANEL_OUTLINE_THICKNESS));
+    // Pentagon outline sitting on top of right panel outline.
+    XPoint rp_pent[6] = {
+      { rpx + L.rpanel_w / 50,  rpy - L.rpanel_h / 4 },
+      { rpx + L.rpanel_w,       rpy - L.rpanel_h / 4 },
+      { rpx + L.rpanel_w,       rpy                   },
+      { rpx,                    rpy                   },
+      { rpx,                    rpy - L.rpanel_h / 8 },
+      { rpx + L.rpanel_w / 50,  rpy - L.rpanel_h / 4 },
+    };
+    DrawPolygonGlow(i, rp_pent, 6, 0);
+    XDrawLines(display, backbuf[i],
+               gcs_all[COLOR_CYBER_YELLOW][i],
+               rp_pent, 6, CoordModeOrigin);
+  }
 #endif
 
-    // Timer section.
+  // Timer section.
 #if CFG_SHOW_TIMER
-    {
-      int tx = px + CFG_TIMER_X;
-      int ty = py + CFG_TIMER_Y;
-      int hdr_w = TextWidth(CFG_TEXT_TIMER_HEADER, strlen(CFG_TEXT_TIMER_HEADER));
-      DrawText(i, tx, ty + L.to, COLOR_CYBER_GREEN, CFG_TEXT_TIMER_HEADER);
-      DrawTimerText(i, tx + hdr_w + CFG_TIMER_BOX_GAP, ty,
-                    L.timer_w, L.timer_h, csec_remaining);
+  {
+    int tx = px + SCALED(CFG_TIMER_X);
+    int ty = py + SCALED(CFG_TIMER_Y);
+    int hdr_w = TextWidth(CFG_TEXT_TIMER_HEADER, strlen(CFG_TEXT_TIMER_HEADER));
+    DrawText(i, tx, ty + L.to, COLOR_CYBER_GREEN, CFG_TEXT_TIMER_HEADER);
+    DrawTimerText(i, tx + hdr_w + SCALED(CFG_TIMER_BOX_GAP), ty,
+                  L.timer_w, L.timer_h, csec_remaining);
 #if CFG_SHOW_BAR
-      DrawProgressBar(i, tx, ty + L.th + CFG_TIMER_BAR_GAP, L.bar_w, L.bar_h,
-                      csec_remaining, csec_total);
+    DrawProgressBar(i, tx, ty + L.th + SCALED(CFG_TIMER_BAR_GAP),
+                    L.bar_w, L.bar_h, csec_remaining, csec_total);
 #endif
-    }
+  }
 #endif
+  PROFILE_END(PROF_PANELS);
 
-    // Matrix section.
+  // Matrix section.
 #if CFG_SHOW_MATRIX
-    {
-      int mx = px + CFG_MATRIX_X;
-      int my = py + CFG_MATRIX_Y;
-      DrawCodeMatrix(i, mx, my + L.th, L.grid_cw, L.grid_ch, gs);
-    }
+  PROFILE_BEGIN();
+  {
+    int mx = px + SCALED(CFG_MATRIX_X);
+    int my = py + SCALED(CFG_MATRIX_Y);
+    DrawCodeMatrix(i, mx, my + L.th, L.grid_cw, L.grid_ch, gs);
+  }
+  PROFILE_END(PROF_MATRIX);
 #endif
 
-    // Buffer section.
-    {
-      int bx = px + CFG_BUFFER_X;
-      int by_ = py + CFG_BUFFER_Y;
-      DrawText(i, bx, by_ + L.to, CFG_BUFFER_HEADER_FG, CFG_TEXT_BUFFER);
-      DrawBufferSection(i, bx, by_ + L.th, L.buf_cw, L.buf_ch, gs);
-    }
+  // Buffer section.
+  PROFILE_BEGIN();
+  {
+    int bx = px + SCALED(CFG_BUFFER_X);
+    int by_ = py + SCALED(CFG_BUFFER_Y);
+    DrawText(i, bx, by_ + L.to, CFG_BUFFER_HEADER_FG, CFG_TEXT_BUFFER);
+    DrawBufferSection(i, bx, by_ + L.th, L.buf_cw, L.buf_ch, gs);
+  }
+  PROFILE_END(PROF_BUFFER);
 
-    // Sequence section.
+  // Sequence section.
 #if CFG_SHOW_SEQUENCES
-    {
-      int sx = px + CFG_SEQ_X;
-      int sy = py + CFG_SEQ_Y;
-      DrawText(i, sx, sy + L.seq_ch / 10, CFG_SEQ_HEADER_FG, CFG_TEXT_SEQ_HEADER);
-      DrawSequenceSection(i, sx, sy + L.th, L.seq_cw, L.seq_ch,
-                          L.rpanel_w - 2 * CFG_RIGHT_PANEL_OUTLINE_PAD, gs);
-    }
+  PROFILE_BEGIN();
+  {
+    int sx = px + SCALED(CFG_SEQ_X);
+    int sy = py + SCALED(CFG_SEQ_Y);
+    DrawText(i, sx, sy + L.seq_ch / 10, CFG_SEQ_HEADER_FG, CFG_TEXT_SEQ_HEADER);
+    DrawSequenceSection(i, sx, sy + L.th, L.seq_cw, L.seq_ch,
+                        L.rpanel_w - 2 * SCALED(CFG_RIGHT_PANEL_OUTLINE_PAD), gs);
+  }
+  PROFILE_END(PROF_SEQUENCES);
 #endif
+}
+
+/*! \brief Display the full Breach Protocol UI (all sections).
+ *
+ * Draws everything to offscreen backbuffers, then blits atomically.
+ * Called on first render, after input, and after monitor changes.
+ */
+void DisplayBreachProtocolFull(const GridState *gs, int csec_remaining,
+                               int csec_total) {
+  if (profile_level) {
+    ProfileFrameBegin();
+  }
+
+  // Compute burn-in mitigation offset for content (not window position).
+  int content_x_offset = 0;
+  int content_y_offset = 0;
+  if (burnin_mitigation_max_offset_change > 0) {
+    x_offset += rand() % (2 * burnin_mitigation_max_offset_change + 1) -
+                burnin_mitigation_max_offset_change;
+    if (x_offset < -burnin_mitigation_max_offset) {
+      x_offset = -burnin_mitigation_max_offset;
+    }
+    if (x_offset > burnin_mitigation_max_offset) {
+      x_offset = burnin_mitigation_max_offset;
+    }
+    y_offset += rand() % (2 * burnin_mitigation_max_offset_change + 1) -
+                burnin_mitigation_max_offset_change;
+    if (y_offset < -burnin_mitigation_max_offset) {
+      y_offset = -burnin_mitigation_max_offset;
+    }
+    if (y_offset > burnin_mitigation_max_offset) {
+      y_offset = burnin_mitigation_max_offset;
+    }
+    content_x_offset = x_offset;
+    content_y_offset = y_offset;
+  }
+
+  // Use negative values to signal full-monitor mode.
+  UpdatePerMonitorWindows(per_monitor_windows_dirty, -1, -1, 0, 0);
+  per_monitor_windows_dirty = 0;
+
+  const QueuedMessage *msg = ActiveMessage();
+
+  for (size_t i = 0; i < num_windows; ++i) {
+    BeginWindowScale(i);
+    DrawBreachProtocol(i, gs, csec_remaining, csec_total, content_x_offset,
+                       content_y_offset);
+
+    DrawMessageOverlay(i, msg);
+    DrawProfileHud(i);
+
     // Blit backbuffer to window atomically.
+    PROFILE_BEGIN();
     XCopyArea(display, backbuf[i], windows[i],
               gcs_all[COLOR_FOREGROUND][i],
               0, 0, backbuf_w[i], backbuf_h[i], 0, 0);
+    PROFILE_END(PROF_BLIT);
   }
+  EndWindowScale();
+  displayed_message_generation = message_generation;
 
+  PROFILE_BEGIN();
   XFlush(display);
+  PROFILE_END(PROF_BLIT);
+  if (profile_level) {
+    ProfileFrameEnd();
+  }
+}
+
+/*! ===========================================================
+ *  RESULT ANIMATIONS
+ *  =========================================================== */
+
+// The success and failure sequences are rendered into pixmaps while
+// authproto is busy, one frame per idle slice of WaitForReadable(), so that
+// playing them back only takes blits. Per window, this holds one full-monitor
+// base frame plus RESULT_FRAMES copies of the panel area.
+
+#define RESULT_SUCCESS_FRAMES 4
+#define RESULT_FAILURE_FRAMES 2
+#define RESULT_FRAMES (RESULT_SUCCESS_FRAMES + RESULT_FAILURE_FRAMES)
+
+typedef struct {
+  Monitor monitor;                  /* Geometry the frames were baked for */
+  Pixmap scratch;                   /* Full-monitor drawing target */
+  Pixmap base;                      /* Full-monitor first frame */
+  int clip_x, clip_y, clip_w, clip_h;  /* Area covered by frames[] */
+  Pixmap frames[RESULT_FRAMES];
+} BakedResult;
+
+static BakedResult baked_results[MAX_WINDOWS];
+static size_t num_baked_results = 0;
+
+//! The final prompt state the animations start from.
+static GridState result_grid;
+static int result_csec_remaining, result_csec_total;
+
+//! The next frame to bake (window-major, -1 = base), or -1 if not baking.
+static int next_bake_item = -1;
+
+//! Whether all frames of all windows have been baked.
+static int results_baked = 0;
+
+/*! \brief Free all baked result frames and stop baking.
+ */
+void FreeResultAnimations(void) {
+  for (size_t i = 0; i < num_baked_results; ++i) {
+    BakedResult *r = &baked_results[i];
+    if (r->scratch != None) XFreePixmap(display, r->scratch);
+    if (r->base != None) XFreePixmap(display, r->base);
+    for (int f = 0; f < RESULT_FRAMES; ++f) {
+      if (r->frames[f] != None) XFreePixmap(display, r->frames[f]);
+    }
+  }
+  memset(baked_results, 0, sizeof(baked_results));
+  num_baked_results = 0;
+  next_bake_item = -1;
+  results_baked = 0;
+}
+
+/*! \brief Start baking result animations for the prompt that just ended.
+ */
+void ScheduleResultAnimations(const GridState *gs, int csec_remaining,
+                              int csec_total) {
+  FreeResultAnimations();
+  if (!result_animation || num_windows == 0) {
+    return;
+  }
+  result_grid = *gs;
+  result_csec_remaining = csec_remaining;
+  result_csec_total = csec_total;
+  num_baked_results = num_windows;
+  for (size_t i = 0; i < num_baked_results; ++i) {
+    baked_results[i].monitor = window_monitor[i];
+  }
+  next_bake_item = 0;
+}
+
+/*! \brief Draw a centered result banner into a window's backbuffer.
+ */
+static void DrawResultBanner(size_t i, const char *text, enum DrawColor color) {
+  int th = TextAscent() + TextDescent() + SCALED(CFG_LINE_SPACING);
+  int len = strlen(text);
+  int box_w = TextWidth(text, len) + 4 * th;
+  int box_h = 3 * th;
+  int x = (backbuf_w[i] - box_w) / 2;
+  int y = (backbuf_h[i] - box_h) / 2;
+  DrawRectGlow(i, x, y, box_w, box_h);
+  DrawBox(i, x, y, box_w, box_h, COLOR_BACKGROUND, color, text, len, color,
+          0);
+}
+
+/*! \brief Draw result frame f (-1 = base frame) into a window's backbuffer.
+ */
+static void DrawResultFrame(size_t i, int f) {
+  GridState gs = result_grid;
+  int csec_remaining = result_csec_remaining;
+  const char *banner = NULL;
+  enum DrawColor banner_color = COLOR_CYBER_COMPLETE;
+
+  if (f >= 0 && f < RESULT_SUCCESS_FRAMES) {
+    // Cell cascade: the buffer fills up, then the sequences install row by
+    // row, and finally the banner shows.
+    while (gs.current_step < puzzle.buffer_size) {
+      GridAdvanceStep(&gs);
+    }
+    int rows = f * puzzle.num_targets / (RESULT_SUCCESS_FRAMES - 2);
+    for (int t = 0; t < puzzle.num_targets && t < rows; ++t) {
+      gs.complete_mask[gs.current_step] |= 1u << t;
+    }
+    if (f == RESULT_SUCCESS_FRAMES - 1) {
+      banner = CFG_TEXT_RESULT_SUCCESS;
+    }
+  } else if (f >= RESULT_SUCCESS_FRAMES) {
+    // The timer runs out, then the banner shows.
+    csec_remaining = 0;
+    if (f == RESULT_FRAMES - 1) {
+      banner = CFG_TEXT_RESULT_FAILURE;
+      banner_color = COLOR_WARNING;
+    }
+  }
+
+  DrawBreachProtocol(i, &gs, csec_remaining, result_csec_total, 0, 0);
+  if (banner != NULL) {
+    DrawResultBanner(i, banner, banner_color);
+  }
+}
+
+/*! \brief Whether there are result frames left to bake.
+ */
+int HaveBackgroundWork(void) { return next_bake_item >= 0; }
+
+/*! \brief Bake one result frame.
+ *
+ * Called by WaitForReadable() whenever it would otherwise be idle.
+ */
+void DoBackgroundWork(void) {
+  if (next_bake_item < 0) {
+    return;
+  }
+  size_t i = next_bake_item / (RESULT_FRAMES + 1);
+  int f = next_bake_item % (RESULT_FRAMES + 1) - 1;
+  BakedResult *r = &baked_results[i];
+  int w = r->monitor.width, h = r->monitor.height;
+  int depth = DefaultDepth(display, DefaultScreen(display));
+
+  // The window may have been closed, or moved to a different monitor.
+  if (i >= num_windows ||
+      memcmp(&window_monitor[i], &r->monitor, sizeof(Monitor))) {
+    FreeResultAnimations();
+    return;
+  }
+
+  if (r->scratch == None) {
+    r->scratch = XCreatePixmap(display, windows[i], w, h, depth);
+  }
+
+  // Draw into the scratch pixmap instead of the window's backbuffer.
+  Pixmap saved_backbuf = backbuf[i];
+  int saved_w = backbuf_w[i], saved_h = backbuf_h[i];
+  backbuf[i] = (f < 0) ? (r->base = XCreatePixmap(display, windows[i], w, h,
+                                                  depth))
+                       : r->scratch;
+  backbuf_w[i] = w;
+  backbuf_h[i] = h;
+#ifdef HAVE_XFT_EXT
+  XftDrawChange(xft_draws[i], backbuf[i]);
+#endif
+  BeginWindowScale(i);
+
+  if (f < 0) {
+    DrawResultFrame(i, f);
+    // All frames cover the panel, its glow and the centered banner.
+    int margin = SCALED(CFG_GLOW_LAYERS * CFG_GLOW_SPREAD) + 1;
+    r->clip_x = (w - SCALED(CFG_REGION_W)) / 2 + SCALED(CFG_PANEL_X) - margin;
+    r->clip_y = (h - SCALED(CFG_REGION_H)) / 2 + SCALED(CFG_PANEL_Y) - margin;
+    r->clip_w = SCALED(CFG_PANEL_W) + 2 * margin;
+    r->clip_h = SCALED(CFG_PANEL_H) + 2 * margin;
+    if (r->clip_x < 0) r->clip_x = 0;
+    if (r->clip_y < 0) r->clip_y = 0;
+    if (r->clip_x + r->clip_w > w) r->clip_w = w - r->clip_x;
+    if (r->clip_y + r->clip_h > h) r->clip_h = h - r->clip_y;
+  } else {
+    DrawResultFrame(i, f);
+    r->frames[f] = XCreatePixmap(display, windows[i], r->clip_w, r->clip_h,
+                                 depth);
+    XCopyArea(display, r->scratch, r->frames[f], gcs_all[COLOR_FOREGROUND][i],
+              r->clip_x, r->clip_y, r->clip_w, r->clip_h, 0, 0);
+  }
+
+  EndWindowScale();
+  backbuf[i] = saved_backbuf;
+  backbuf_w[i] = saved_w;
+  backbuf_h[i] = saved_h;
+#ifdef HAVE_XFT_EXT
+  XftDrawChange(xft_draws[i], backbuf[i]);
+#endif
+  XFlush(display);
+
+  ++next_bake_item;
+  if (f == RESULT_FRAMES - 1) {
+    XFreePixmap(display, r->scratch);
+    r->scratch = None;
+    if (i + 1 == num_baked_results) {
+      next_bake_item = -1;
+      results_baked = 1;
+    }
+  }
+}
+
+/*! \brief Play the success or failure animation, if it is fully baked.
+ *
+ * Playback only blits the baked frames and takes at most
+ * CFG_RESULT_SUCCESS_MS (CFG_RESULT_FAILURE_MS on failure).
+ */
+void PlayResultAnimation(int success) {
+  if (!results_baked) {
+    FreeResultAnimations();
+    return;
+  }
+
+  // Messages may have shrunk the windows; go back to full-monitor mode.
+  UpdatePerMonitorWindows(per_monitor_windows_dirty, -1, -1, 0, 0);
+  per_monitor_windows_dirty = 0;
+
+  int first = success ? 0 : RESULT_SUCCESS_FRAMES;
+  int count = success ? RESULT_SUCCESS_FRAMES : RESULT_FAILURE_FRAMES;
+  int total_ms = success ? CFG_RESULT_SUCCESS_MS : CFG_RESULT_FAILURE_MS;
+
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  for (int f = 0; f < count; ++f) {
+    for (size_t i = 0; i < num_windows && i < num_baked_results; ++i) {
+      BakedResult *r = &baked_results[i];
+      if (memcmp(&window_monitor[i], &r->monitor, sizeof(Monitor))) {
+        continue;
+      }
+      if (f == 0) {
+        XCopyArea(display, r->base, windows[i], gcs_all[COLOR_FOREGROUND][i],
+                  0, 0, r->monitor.width, r->monitor.height, 0, 0);
+      }
+      XCopyArea(display, r->frames[first + f], windows[i],
+                gcs_all[COLOR_FOREGROUND][i], 0, 0, r->clip_w, r->clip_h,
+                r->clip_x, r->clip_y);
+    }
+    XFlush(display);
+
+    // Hold each frame for its share of the total; never exceed the total.
+    struct timeval now, frame_end = start;
+    TimevalAddMs(&frame_end, total_ms * (f + 1) / count);
+    for (;;) {
+      ServiceSounds();
+      gettimeofday(&now, NULL);
+      if (!TimevalBefore(&now, &frame_end)) {
+        break;
+      }
+      struct timeval wait = TimevalDiff(&frame_end, &now);
+      NextSoundTimeout(&wait);
+      select(0, NULL, NULL, NULL, &wait);
+    }
+  }
+
+  FreeResultAnimations();
 }
 
 /*! \brief Redraw only the timer section (called every 10ms tick).
@@ -1925,24 +2758,27 @@ void DisplayBreachProtocolFull(const GridState *gs, int csec_remaining,
  */
 void RedrawTimerOnly(int csec_remaining, int csec_total) {
   LayoutInfo L;
-  ComputeLayout(&L);
+  PROFILE_BEGIN();
 
   for (size_t i = 0; i < num_windows; ++i) {
+    BeginWindowScale(i);
+    ComputeLayout(&L);
+
     // Center content on the monitor (same as DisplayBreachProtocolFull).
     int cx = (backbuf_w[i] - L.region_w) / 2;
     int cy = (backbuf_h[i] - L.region_h) / 2;
 
     // Derive timer section from panel origin.
-    int px = cx + CFG_PANEL_X;
-    int py = cy + CFG_PANEL_Y;
-    int tx = px + CFG_TIMER_X;
-    int ty = py + CFG_TIMER_Y;
+    int px = cx + SCALED(CFG_PANEL_X);
+    int py = cy + SCALED(CFG_PANEL_Y);
+    int tx = px + SCALED(CFG_TIMER_X);
+    int ty = py + SCALED(CFG_TIMER_Y);
 
 #if CFG_SHOW_TIMER
     {
       // Timer box position.
       int hdr_w = TextWidth(CFG_TEXT_TIMER_HEADER, strlen(CFG_TEXT_TIMER_HEADER));
-      int timer_x = tx + hdr_w + CFG_TIMER_BOX_GAP;
+      int timer_x = tx + hdr_w + SCALED(CFG_TIMER_BOX_GAP);
       int timer_y = ty;
       // Clear and redraw timer text.
       FillRect(i, timer_x, timer_y, L.timer_w, L.timer_h, COLOR_CONTENT_BG);
@@ -1958,7 +2794,7 @@ void RedrawTimerOnly(int csec_remaining, int csec_total) {
     {
       // Progress bar position.
       int bar_x = tx;
-      int bar_y = ty + L.th + CFG_TIMER_BAR_GAP;
+      int bar_y = ty + L.th + SCALED(CFG_TIMER_BAR_GAP);
       // Clear and redraw progress bar.
       FillRect(i, bar_x, bar_y, L.bar_w, L.bar_h, COLOR_CONTENT_BG);
       DrawProgressBar(i, bar_x, bar_y, L.bar_w, L.bar_h,
@@ -1970,8 +2806,10 @@ void RedrawTimerOnly(int csec_remaining, int csec_total) {
     }
 #endif
   }
+  EndWindowScale();
 
   XFlush(display);
+  PROFILE_END(PROF_TICK);
 }
 
 /*! \brief Display a simple text message (fallback for non-grid states).
@@ -1980,32 +2818,35 @@ void DisplayMessage(const char *title, const char *str, int is_warning) {
   char full_title[256];
   BuildTitle(full_title, sizeof(full_title), title);
 
-  int th = TextAscent() + TextDescent() + CFG_LINE_SPACING;
-  int to = TextAscent() + CFG_LINE_SPACING / 2;
-
   int len_full_title = strlen(full_title);
-  int tw_full_title = TextWidth(full_title, len_full_title);
-
   int len_str = strlen(str);
-  int tw_str = TextWidth(str, len_str);
 
-  int box_w = tw_full_title;
+  // Size the windows at unit scale; they get scaled per monitor.
+  int th = TextAscent() + TextDescent() + CFG_LINE_SPACING;
+  int box_w = TextWidth(full_title, len_full_title);
+  int tw_str = TextWidth(str, len_str);
   if (box_w < tw_str) {
     box_w = tw_str;
   }
-  int box_h = 4 * th;
   int region_w = box_w;
-  int region_h = box_h;
+  int region_h = 4 * th;
 
   UpdatePerMonitorWindows(per_monitor_windows_dirty, region_w, region_h,
                           x_offset, y_offset);
   per_monitor_windows_dirty = 0;
 
   enum DrawColor color = is_warning ? COLOR_WARNING : COLOR_FOREGROUND;
+  const QueuedMessage *msg = ActiveMessage();
 
   for (size_t i = 0; i < num_windows; ++i) {
-    int cx = region_w / 2;
-    int cy = region_h / 2;
+    BeginWindowScale(i);
+    th = TextAscent() + TextDescent() + SCALED(CFG_LINE_SPACING);
+    int to = TextAscent() + SCALED(CFG_LINE_SPACING) / 2;
+    int tw_full_title = TextWidth(full_title, len_full_title);
+    tw_str = TextWidth(str, len_str);
+    int box_h = 4 * th;
+    int cx = backbuf_w[i] / 2;
+    int cy = backbuf_h[i] / 2;
     int y = cy + to - box_h / 2;
 
     // Clear backbuffer.
@@ -2017,11 +2858,15 @@ void DisplayMessage(const char *title, const char *str, int is_warning) {
 
     DrawString(i, cx - tw_str / 2, y, color, str, len_str);
 
+    DrawMessageOverlay(i, msg);
+
     // Blit backbuffer to window.
     XCopyArea(display, backbuf[i], windows[i],
               gcs_all[COLOR_FOREGROUND][i],
               0, 0, backbuf_w[i], backbuf_h[i], 0, 0);
   }
+  EndWindowScale();
+  displayed_message_generation = message_generation;
 
   XFlush(display);
 }
@@ -2032,7 +2877,177 @@ void DisplayMessage(const char *title, const char *str, int is_warning) {
 //! The size of the buffer to use for display, with space for cursor and NUL.
 #define DISPLAYBUF_SIZE (PWBUF_SIZE + 2)
 
+//! Stack size of the Prompt() input thread.
+#define INPUT_THREAD_STACK_SIZE (64 * 1024)
+
+/*! \brief Prompt state shared between the render loop and the input thread.
+ *
+ * Everything in here is protected by lock. It contains password data, so it
+ * lives in Prompt()'s mlocked priv struct and is wiped with it.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+
+  // Input buffer. Not NUL-terminated.
+  char pwbuf[PWBUF_SIZE];
+  // Current input length.
+  size_t pwlen;
+
+  // Grid state for breach protocol visualization.
+  GridState grid;
+
+  // Incremented on every state change.
+  unsigned long seq;
+
+  // Time of the last keypress (for the prompt timeout).
+  struct timeval last_input;
+
+  // Requests from the input thread that need X11, i.e. the render loop.
+  int switch_layout;
+  int dismiss_messages;
+
+  // Set when the prompt is finished; status then is the result of Prompt().
+  int done;
+  int status;
+
+  // Whether the input is echoed.
+  int echo;
+
+  // Wakes up the render loop; written by the input thread.
+  int wake_fd[2];
+  // Tells the input thread to quit; written by the render loop.
+  int stop_fd[2];
+} PromptShared;
+
+/*! \brief Apply one byte of input to the shared prompt state.
+ *
+ * Must be called with shared->lock held.
+ */
+static void ApplyInput(PromptShared *shared, char inputbuf) {
+  switch (inputbuf) {
+    case '\b':      // Backspace.
+    case '\177': {  // Delete.
+      // Backwards skip with multibyte support.
+      mbstate_t mbstate;
+      memset(&mbstate, 0, sizeof(mbstate));
+      size_t pos = 0, prevpos = 0;
+      while (pos < shared->pwlen) {
+        prevpos = pos;
+        size_t len =
+            mbrlen(shared->pwbuf + pos, shared->pwlen - pos, &mbstate);
+        if (len == 0 || len > shared->pwlen - pos) {
+          break;
+        }
+        pos += len;
+      }
+      shared->pwlen = prevpos;
+      if (!shared->echo) {
+        GridRewindStep(&shared->grid);
+      }
+      break;
+    }
+    case '\001':  // Ctrl-A.
+      shared->pwlen = 0;
+      if (!shared->echo) {
+        InitGridState(&shared->grid);
+      }
+      break;
+    case '\023':  // Ctrl-S.
+      shared->switch_layout = 1;
+      break;
+    case '\025':  // Ctrl-U.
+      shared->pwlen = 0;
+      if (!shared->echo) {
+        InitGridState(&shared->grid);
+      }
+      break;
+    case 0:       // Shouldn't happen.
+    case '\033':  // Escape.
+      shared->done = 1;
+      break;
+    case '\r':  // Return.
+    case '\n':  // Return.
+      shared->status = 1;
+      shared->done = 1;
+      break;
+    default:
+      if (inputbuf >= '\000' && inputbuf <= '\037') {
+        break;
+      }
+      if (shared->pwlen < sizeof(shared->pwbuf)) {
+        shared->pwbuf[shared->pwlen] = inputbuf;
+        ++shared->pwlen;
+        if (!shared->echo) {
+          GridAdvanceStep(&shared->grid);
+        }
+      } else {
+        Log("Password entered is too long - bailing out");
+        shared->done = 1;
+      }
+      break;
+  }
+}
+
+/*! \brief Input thread of Prompt(): reads stdin and updates the shared state.
+ *
+ * Runs on an mlocked stack until the prompt is done or stop_fd is written to.
+ */
+static void *PromptInputThread(void *arg) {
+  PromptShared *shared = arg;
+  char inputbuf = 0;
+  for (;;) {
+    fd_set set;
+    memset(&set, 0, sizeof(set));
+    FD_ZERO(&set);
+    FD_SET(0, &set);
+    FD_SET(shared->stop_fd[0], &set);
+    int nfds = select(shared->stop_fd[0] + 1, &set, NULL, NULL, NULL);
+    if (nfds < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nfds > 0 && FD_ISSET(shared->stop_fd[0], &set)) {
+      break;
+    }
+    ssize_t nread = nfds < 0 ? -1 : read(0, &inputbuf, 1);
+
+    pthread_mutex_lock(&shared->lock);
+    int done = shared->done;
+    if (!done) {
+      if (nfds < 0) {
+        LogErrno("select");
+        shared->done = 1;
+      } else if (nread <= 0) {
+        Log("EOF on password input - bailing out");
+        shared->done = 1;
+      } else {
+        TRACE_BEGIN("ApplyInput");
+        TRACE_FLOW('t', TraceInputFlowId(trace_flow_base, stdin_bytes_read));
+        ++stdin_bytes_read;
+        gettimeofday(&shared->last_input, NULL);
+        shared->dismiss_messages = 1;
+        ApplyInput(shared, inputbuf);
+        TRACE_END();
+      }
+      ++shared->seq;
+      done = shared->done;
+    }
+    pthread_mutex_unlock(&shared->lock);
+    inputbuf = 0;
+
+    if (write(shared->wake_fd[1], "", 1) < 0 && errno != EAGAIN) {
+      LogErrno("write");
+    }
+    if (done) {
+      break;
+    }
+  }
+  return NULL;
+}
+
 /*! \brief Ask a question to the user.
+ *
+ * Keys are read and applied by a separate input thread, so keypresses never
+ * wait for a frame to finish; this thread only draws the latest state.
  *
  * \param msg The message.
  * \param response The response will be stored in a newly allocated buffer here.
@@ -2044,65 +3059,140 @@ int Prompt(const char *msg, char **response, int echo) {
     // The received X11 event.
     XEvent ev;
 
-    // Input buffer. Not NUL-terminated.
-    char pwbuf[PWBUF_SIZE];
-    // Current input length.
+    // State shared with the input thread.
+    PromptShared shared;
+
+    // The render loop's snapshot of the shared state.
+    GridState grid;
     size_t pwlen;
 
     // Display buffer (used for echo mode).
     char displaybuf[DISPLAYBUF_SIZE];
     // Display buffer length.
     size_t displaylen;
-
-    // Character read buffer.
-    char inputbuf;
-
-    // Grid state for breach protocol visualization.
-    GridState grid;
-
-    // Temporary position variables.
-    size_t prevpos;
-    size_t pos;
-    int len;
   } priv;
 
   if (!echo && MLOCK_PAGE(&priv, sizeof(priv)) < 0) {
     LogErrno("mlock");
-    DisplayMessage(CFG_TEXT_ERROR, CFG_TEXT_MLOCK_WARN, 1);
-    WaitForKeypress(1);
+    QueueMessage(CFG_TEXT_ERROR, CFG_TEXT_MLOCK_WARN, 1, CFG_MESSAGE_ERROR_MS);
   }
 
-  priv.pwlen = 0;
-  InitGridState(&priv.grid);
-
-  struct timeval deadline_tv;
-  gettimeofday(&deadline_tv, NULL);
-  deadline_tv.tv_sec += prompt_timeout;
+  memset(&priv, 0, sizeof(priv));
+  priv.shared.echo = echo;
+  if (!echo && random_puzzle) {
+    NewRandomPuzzle();
+  }
+  InitGridState(&priv.shared.grid);
+  gettimeofday(&priv.shared.last_input, NULL);
+  if (pipe(priv.shared.wake_fd)) {
+    LogErrno("pipe");
+    return 0;
+  }
+  if (pipe(priv.shared.stop_fd)) {
+    LogErrno("pipe");
+    close(priv.shared.wake_fd[0]);
+    close(priv.shared.wake_fd[1]);
+    return 0;
+  }
+  fcntl(priv.shared.wake_fd[0], F_SETFL, O_NONBLOCK);
+  fcntl(priv.shared.wake_fd[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init(&priv.shared.lock, NULL);
+
+  // The input thread handles keystrokes, so its stack must not be swapped out
+  // either.
+  size_t stack_size = INPUT_THREAD_STACK_SIZE;
+  if (stack_size < (size_t)PTHREAD_STACK_MIN) {
+    stack_size = PTHREAD_STACK_MIN;
+  }
+  void *stack = NULL;
+  pthread_t input_thread;
+  int err = posix_memalign(&stack, PAGESIZE, stack_size);
+  if (err == 0) {
+    if (!echo && MLOCK_PAGE(stack, stack_size) < 0) {
+      LogErrno("mlock");
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, stack_size);
+    err = pthread_create(&input_thread, &attr, PromptInputThread,
+                         &priv.shared);
+    pthread_attr_destroy(&attr);
+  }
+  if (err != 0) {
+    errno = err;
+    LogErrno("pthread_create");
+    priv.shared.done = 1;
+  }
 
   int csec_total = prompt_timeout * 100;
   if (csec_total > CFG_TIMER_MAX_CSEC) csec_total = CFG_TIMER_MAX_CSEC;
 
-  int status = 0;
-  int done = 0;
   int played_sound = 0;
   int need_full_redraw = 1;
+  unsigned long drawn_seq = 0;
+  unsigned long drawn_input = stdin_bytes_read;
+  int csec_remaining = csec_total;
+
+  // The previous attempt's result frames are stale now.
+  FreeResultAnimations();
+
+  for (;;) {
+    // Take a snapshot of the input state; the lock is held only for copying.
+    pthread_mutex_lock(&priv.shared.lock);
+    int done = priv.shared.done;
+    priv.grid = priv.shared.grid;
+    priv.pwlen = priv.shared.pwlen;
+    if (echo && priv.shared.seq != drawn_seq) {
+      if (priv.pwlen != 0) {
+        memcpy(priv.displaybuf, priv.shared.pwbuf, priv.pwlen);
+      }
+      drawn_seq = priv.shared.seq;
+      need_full_redraw = 1;
+    }
+    struct timeval last_input = priv.shared.last_input;
+    unsigned long input_bytes = stdin_bytes_read;
+    int switch_layout = priv.shared.switch_layout;
+    int dismiss_messages = priv.shared.dismiss_messages;
+    priv.shared.switch_layout = 0;
+    priv.shared.dismiss_messages = 0;
+    pthread_mutex_unlock(&priv.shared.lock);
+
+    if (done) {
+      break;
+    }
+    if (switch_layout) {
+      SwitchKeyboardLayout();
+    }
+    if (dismiss_messages && num_queued_messages > 0) {
+      DismissMessages();
+      need_full_redraw = 1;
+    }
 
-  while (!done) {
+    // Hold the deadline until the user starts entering input; from then on,
+    // each keypress resets it.
     struct timeval now_tv;
     gettimeofday(&now_tv, NULL);
-    // Hold deadline until the user starts entering input.
+    struct timeval deadline_tv = last_input;
     if (priv.grid.buffer_count == 0 && priv.grid.current_step == 0) {
       deadline_tv = now_tv;
-      deadline_tv.tv_sec += prompt_timeout;
     }
-    int csec_remaining = ComputeCentisecondsRemaining(&deadline_tv, &now_tv);
+    deadline_tv.tv_sec += prompt_timeout;
+    if (!TimevalBefore(&now_tv, &deadline_tv)) {
+      Log("AUTH_TIMEOUT hit");
+      break;
+    }
+    csec_remaining = ComputeCentisecondsRemaining(&deadline_tv, &now_tv);
 
+    TRACE_BEGIN("Frame");
+    // Every byte applied since the last frame becomes visible with this one.
+    for (; drawn_input != input_bytes; ++drawn_input) {
+      TRACE_FLOW('f', TraceInputFlowId(trace_flow_base, drawn_input));
+    }
     if (echo) {
-      // Echo mode: only redraw on input (no timer to update).
-      if (need_full_redraw) {
-        if (priv.pwlen != 0) {
-          memcpy(priv.displaybuf, priv.pwbuf, priv.pwlen);
-        }
+      // Echo mode: only redraw on input or message changes (no timer).
+      ActiveMessage();
+      if (need_full_redraw ||
+          displayed_message_generation != message_generation) {
         priv.displaylen = priv.pwlen;
         priv.displaybuf[priv.displaylen] = '_';
         priv.displaybuf[priv.displaylen + 1] = '\0';
@@ -2114,146 +3204,271 @@ int Prompt(const char *msg, char **response, int echo) {
       DisplayBreachProtocolFull(&priv.grid, csec_remaining, csec_total);
       need_full_redraw = 0;
     }
+    TRACE_END();
 
     if (!played_sound) {
       PlaySound(SOUND_PROMPT);
       played_sound = 1;
     }
+    ServiceSounds();
 
+    // Wait for the next tick, a state change or an X11 event.
     struct timeval timeout;
     timeout.tv_sec = 0;
     timeout.tv_usec = CFG_TIMER_INTERVAL_US;
-
-    while (!done) {
-      fd_set set;
-      memset(&set, 0, sizeof(set));
-      FD_ZERO(&set);
-      FD_SET(0, &set);
-      int nfds = select(1, &set, NULL, NULL, &timeout);
-      if (nfds < 0) {
+    fd_set set;
+    memset(&set, 0, sizeof(set));
+    FD_ZERO(&set);
+    FD_SET(priv.shared.wake_fd[0], &set);
+    int maxfd = priv.shared.wake_fd[0];
+    if (!XPending(display)) {
+      FD_SET(ConnectionNumber(display), &set);
+      if (ConnectionNumber(display) > maxfd) {
+        maxfd = ConnectionNumber(display);
+      }
+      if (select(maxfd + 1, &set, NULL, NULL, &timeout) < 0 &&
+          errno != EINTR) {
         LogErrno("select");
-        done = 1;
         break;
       }
+    }
+    char wakebuf[16];
+    while (read(priv.shared.wake_fd[0], wakebuf, sizeof(wakebuf)) > 0) {
+    }
 
-      gettimeofday(&now_tv, NULL);
-      if (now_tv.tv_sec > deadline_tv.tv_sec ||
-          (now_tv.tv_sec == deadline_tv.tv_sec &&
-           now_tv.tv_usec >= deadline_tv.tv_usec)) {
-        Log("AUTH_TIMEOUT hit");
-        done = 1;
-        break;
+    // Handle X11 events that queued up.
+    while (XPending(display) && (XNextEvent(display, &priv.ev), 1)) {
+      if (IsMonitorChangeEvent(display, priv.ev.type)) {
+        per_monitor_windows_dirty = 1;
+        need_full_redraw = 1;
       }
-      if (nfds == 0) {
-        // Timer tick — break to outer loop for timer redraw.
-        break;
+      if (HandleXkbStateEvent(display, &priv.ev)) {
+        need_full_redraw = 1;
       }
+    }
+  }
 
-      // Input available — nonblocking drain from now on.
-      timeout.tv_usec = 0;
+  // Stop the input thread; from here on it no longer touches the state.
+  pthread_mutex_lock(&priv.shared.lock);
+  priv.shared.done = 1;
+  pthread_mutex_unlock(&priv.shared.lock);
+  if (stack != NULL) {
+    if (err == 0) {
+      if (write(priv.shared.stop_fd[1], "", 1) < 0) {
+        LogErrno("write");
+      }
+      pthread_join(input_thread, NULL);
+    }
+    // The input thread's stack may contain password bytes.
+    explicit_bzero(stack, stack_size);
+    free(stack);
+  }
+
+  int status = priv.shared.status;
+  if (status == 1) {
+    *response = malloc(priv.shared.pwlen + 1);
+    if (!echo && MLOCK_PAGE(*response, priv.shared.pwlen + 1) < 0) {
+      LogErrno("mlock");
+      QueueMessage(CFG_TEXT_ERROR, CFG_TEXT_MLOCK_ERR, 1,
+                   CFG_MESSAGE_ERROR_MS);
+    }
+    if (priv.shared.pwlen != 0) {
+      memcpy(*response, priv.shared.pwbuf, priv.shared.pwlen);
+    }
+    (*response)[priv.shared.pwlen] = 0;
+    if (!echo) {
+      ScheduleResultAnimations(&priv.grid, csec_remaining, csec_total);
+    }
+  }
 
-      // Reset the prompt timeout on input.
-      gettimeofday(&deadline_tv, NULL);
-      deadline_tv.tv_sec += prompt_timeout;
+  pthread_mutex_destroy(&priv.shared.lock);
+  close(priv.shared.wake_fd[0]);
+  close(priv.shared.wake_fd[1]);
+  close(priv.shared.stop_fd[0]);
+  close(priv.shared.stop_fd[1]);
 
-      ssize_t nread = read(0, &priv.inputbuf, 1);
-      if (nread <= 0) {
-        Log("EOF on password input - bailing out");
-        done = 1;
-        break;
+  // priv contains password related data, so better clear it.
+  explicit_bzero(&priv, sizeof(priv));
+
+  return status;
+}
+
+/*! ===========================================================
+ *  HEADLESS RENDERING (--render)
+ *  =========================================================== */
+
+/*! \brief Find the shift and width of a contiguous color mask.
+ */
+static void MaskShiftAndBits(unsigned long mask, int *shift, int *bits) {
+  *shift = 0;
+  *bits = 0;
+  if (mask == 0) {
+    return;
+  }
+  while (!(mask & 1)) {
+    mask >>= 1;
+    ++*shift;
+  }
+  while (mask & 1) {
+    mask >>= 1;
+    ++*bits;
+  }
+}
+
+/*! \brief Write the backbuffer of a window to a binary PPM file.
+ *
+ * \return 1 if the image was written, 0 otherwise.
+ */
+static int WriteBackbufferPPM(size_t i, const char *filename) {
+  Visual *visual = DefaultVisual(display, DefaultScreen(display));
+  if (visual->class != TrueColor && visual->class != DirectColor) {
+    Log("Can only write images from TrueColor/DirectColor visuals");
+    return 0;
+  }
+  int shift[3], bits[3];
+  MaskShiftAndBits(visual->red_mask, &shift[0], &bits[0]);
+  MaskShiftAndBits(visual->green_mask, &shift[1], &bits[1]);
+  MaskShiftAndBits(visual->blue_mask, &shift[2], &bits[2]);
+
+  XImage *image = XGetImage(display, backbuf[i], 0, 0, backbuf_w[i],
+                            backbuf_h[i], AllPlanes, ZPixmap);
+  if (image == NULL) {
+    Log("XGetImage of the backbuffer failed");
+    return 0;
+  }
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL) {
+    LogErrno("fopen %s", filename);
+    XDestroyImage(image);
+    return 0;
+  }
+  unsigned char *row = malloc(3 * (size_t)backbuf_w[i]);
+  if (row == NULL) {
+    LogErrno("malloc");
+    fclose(f);
+    XDestroyImage(image);
+    return 0;
+  }
+  fprintf(f, "P6\n%d %d\n255\n", backbuf_w[i], backbuf_h[i]);
+  for (int y = 0; y < backbuf_h[i]; ++y) {
+    for (int x = 0; x < backbuf_w[i]; ++x) {
+      unsigned long pixel = XGetPixel(image, x, y);
+      for (int c = 0; c < 3; ++c) {
+        unsigned long max = (1UL << bits[c]) - 1;
+        unsigned long v = (pixel >> shift[c]) & max;
+        row[3 * x + c] = max ? (unsigned char)(v * 255 / max) : 0;
       }
-      switch (priv.inputbuf) {
-        case '\b':      // Backspace.
-        case '\177': {  // Delete.
-          // Backwards skip with multibyte support.
-          mblen(NULL, 0);
-          priv.pos = priv.prevpos = 0;
-          while (priv.pos < priv.pwlen) {
-            priv.prevpos = priv.pos;
-            priv.len = mblen(priv.pwbuf + priv.pos, priv.pwlen - priv.pos);
-            if (priv.len <= 0) {
-              break;
-            }
-            priv.pos += priv.len;
-          }
-          priv.pwlen = priv.prevpos;
-          if (!echo) {
-            GridRewindStep(&priv.grid);
-          }
-          need_full_redraw = 1;
-          break;
+    }
+    fwrite(row, 3, backbuf_w[i], f);
+  }
+  free(row);
+  XDestroyImage(image);
+  if (fclose(f)) {
+    LogErrno("fclose %s", filename);
+    return 0;
+  }
+  return 1;
+}
+
+/*! \brief Milliseconds elapsed between two CLOCK_MONOTONIC readings.
+ */
+static double ElapsedMs(const struct timespec *a, const struct timespec *b) {
+  return (b->tv_sec - a->tv_sec) * 1000.0 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+/*! \brief Render the frames of a script without a lock or an auth process.
+ *
+ * Each non-empty line of the script is a command; # starts a comment.
+ *   size W H           Render to a W x H monitor (default: CFG_REGION_*).
+ *   seed N             Reseed the random number generator.
+ *   repeat N           Render each following frame N times for timing.
+ *   frame STEPS CSEC TOTAL MS
+ *                      Render the grid after STEPS inputs, with CSEC of TOTAL
+ *                      centiseconds left, at animation time MS milliseconds.
+ *
+ * Frame n is written to <prefix>NNNN.ppm unless prefix is "-", and its render
+ * time (including the X server's share, via XSync) is printed to stdout.
+ *
+ * \return 0 if all frames were rendered, 1 otherwise.
+ */
+static int RunRenderScript(const char *script, const char *prefix) {
+  FILE *f = strcmp(script, "-") ? fopen(script, "r") : stdin;
+  if (f == NULL) {
+    LogErrno("fopen %s", script);
+    return 1;
+  }
+
+  int status = 0;
+  int repeat = 1;
+  int frame = 0;
+  int lineno = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    ++lineno;
+    line[strcspn(line, "#\n")] = 0;
+    char cmd[16];
+    if (sscanf(line, "%15s", cmd) != 1) {
+      continue;
+    }
+    int a, b, c;
+    long long ms;
+    if (!strcmp(cmd, "size") && sscanf(line, "%*s %d %d", &a, &b) == 2 &&
+        a > 0 && b > 0) {
+      render_monitor.width = a;
+      render_monitor.height = b;
+      per_monitor_windows_dirty = 1;
+    } else if (!strcmp(cmd, "seed") && sscanf(line, "%*s %d", &a) == 1) {
+      srand(a);
+    } else if (!strcmp(cmd, "repeat") && sscanf(line, "%*s %d", &a) == 1 &&
+               a > 0) {
+      repeat = a;
+    } else if (!strcmp(cmd, "frame") &&
+               sscanf(line, "%*s %d %d %d %lld", &a, &b, &c, &ms) == 4 &&
+               ms >= 0) {
+      GridState gs;
+      InitGridState(&gs);
+      for (int step = 0; step < a; ++step) {
+        GridAdvanceStep(&gs);
+      }
+      render_clock.tv_sec = ms / 1000;
+      render_clock.tv_usec = (ms % 1000) * 1000;
+
+      double min_ms = 0, total_ms = 0;
+      for (int r = 0; r < repeat; ++r) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        DisplayBreachProtocolFull(&gs, b, c);
+        XSync(display, False);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double d = ElapsedMs(&t0, &t1);
+        if (r == 0 || d < min_ms) {
+          min_ms = d;
         }
-        case '\001':  // Ctrl-A.
-          priv.pwlen = 0;
-          if (!echo) {
-            InitGridState(&priv.grid);
-          }
-          need_full_redraw = 1;
-          break;
-        case '\023':  // Ctrl-S.
-          SwitchKeyboardLayout();
-          need_full_redraw = 1;
-          break;
-        case '\025':  // Ctrl-U.
-          priv.pwlen = 0;
-          if (!echo) {
-            InitGridState(&priv.grid);
-          }
-          need_full_redraw = 1;
-          break;
-        case 0:       // Shouldn't happen.
-        case '\033':  // Escape.
-          done = 1;
-          break;
-        case '\r':  // Return.
-        case '\n':  // Return.
-          *response = malloc(priv.pwlen + 1);
-          if (!echo && MLOCK_PAGE(*response, priv.pwlen + 1) < 0) {
-            LogErrno("mlock");
-            DisplayMessage(CFG_TEXT_ERROR, CFG_TEXT_MLOCK_ERR, 1);
-            WaitForKeypress(1);
-          }
-          if (priv.pwlen != 0) {
-            memcpy(*response, priv.pwbuf, priv.pwlen);
-          }
-          (*response)[priv.pwlen] = 0;
+        total_ms += d;
+      }
+      printf("frame %d: steps=%d csec=%d/%d time=%lld render_ms min=%.3f "
+             "avg=%.3f\n",
+             frame, a, b, c, ms, min_ms, total_ms / repeat);
+
+      if (strcmp(prefix, "-")) {
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%s%04d.ppm", prefix, frame);
+        if (!WriteBackbufferPPM(MAIN_WINDOW, filename)) {
           status = 1;
-          done = 1;
-          break;
-        default:
-          if (priv.inputbuf >= '\000' && priv.inputbuf <= '\037') {
-            break;
-          }
-          if (priv.pwlen < sizeof(priv.pwbuf)) {
-            priv.pwbuf[priv.pwlen] = priv.inputbuf;
-            ++priv.pwlen;
-            if (!echo) {
-              GridAdvanceStep(&priv.grid);
-            }
-            need_full_redraw = 1;
-          } else {
-            Log("Password entered is too long - bailing out");
-            done = 1;
-            break;
-          }
           break;
+        }
       }
-    }
-
-    // Handle X11 events that queued up.
-    while (!done && XPending(display) && (XNextEvent(display, &priv.ev), 1)) {
-      if (IsMonitorChangeEvent(display, priv.ev.type)) {
-        per_monitor_windows_dirty = 1;
-        need_full_redraw = 1;
-      }
+      ++frame;
+    } else {
+      Log("%s:%d: invalid render command", script, lineno);
+      status = 1;
+      break;
     }
   }
+  fflush(stdout);
 
-  // priv contains password related data, so better clear it.
-  memset(&priv, 0, sizeof(priv));
-
-  if (!done) {
-    Log("Unreachable code - the loop above must set done");
+  if (f != stdin) {
+    fclose(f);
   }
   return status;
 }
@@ -2262,15 +3477,30 @@ int Prompt(const char *msg, char **response, int echo) {
  *
  * Usage: XSCREENSAVER_WINDOW=window_id ./auth_x11_grid; status=$?
  *
+ * Or, to render scripted frames headlessly:
+ * ./auth_x11_grid --render <script|-> <output-prefix|->
+ *
  * \return 0 if authentication successful, anything else otherwise.
  */
 int main(int argc_local, char **argv_local) {
   argc = argc_local;
   argv = argv_local;
 
+  if (argc >= 2 && !strcmp(argv[1], "--render")) {
+    if (argc != 4) {
+      Log("Usage: %s --render <script|-> <output-prefix|->", argv[0]);
+      return 1;
+    }
+    render_script = argv[2];
+    render_prefix = argv[3];
+  }
+
   setlocale(LC_CTYPE, "");
   setlocale(LC_TIME, "");
 
+  TraceInit("auth_x11_grid");
+  trace_flow_base = TraceFlowBase();
+
   struct timeval tv;
   gettimeofday(&tv, NULL);
   srand(tv.tv_sec ^ tv.tv_usec ^ getpid());
@@ -2297,6 +3527,30 @@ int main(int argc_local, char **argv_local) {
       !!*GetStringSetting("XSECURELOCK_SWITCH_USER_COMMAND", "");
   auth_sounds = GetIntSetting("XSECURELOCK_AUTH_SOUNDS", 0);
   single_auth_window = GetIntSetting("XSECURELOCK_SINGLE_AUTH_WINDOW", 0);
+  result_animation = GetIntSetting("XSECURELOCK_GRID_RESULT_ANIMATION", 1);
+  profile_level = GetIntSetting("XSECURELOCK_GRID_PROFILE", 0);
+
+  int grid_size = GetIntSetting("XSECURELOCK_GRID_SIZE", DEFAULT_GRID_SIZE);
+  if (grid_size < MIN_GRID_SIZE) grid_size = MIN_GRID_SIZE;
+  if (grid_size > MAX_GRID_SIZE) grid_size = MAX_GRID_SIZE;
+  int buffer_size =
+      GetIntSetting("XSECURELOCK_GRID_BUFFER_SIZE", DEFAULT_BUFFER_SIZE);
+  if (buffer_size > 2 * grid_size - 1) buffer_size = 2 * grid_size - 1;
+  if (buffer_size > MAX_BUFFER_SIZE) buffer_size = MAX_BUFFER_SIZE;
+  if (buffer_size < 2) buffer_size = 2;
+  int num_targets = GetIntSetting("XSECURELOCK_GRID_TARGETS",
+                                  DEFAULT_NUM_TARGETS);
+  if (num_targets < 1) num_targets = 1;
+  if (num_targets > MAX_TARGETS) num_targets = MAX_TARGETS;
+  int target_len = GetIntSetting("XSECURELOCK_GRID_TARGET_LENGTH",
+                                 DEFAULT_TARGET_LEN);
+  if (target_len > buffer_size) target_len = buffer_size;
+  if (target_len > MAX_TARGET_LEN) target_len = MAX_TARGET_LEN;
+  if (target_len < 2) target_len = 2;
+  puzzle_target_len = target_len;
+  random_puzzle = GetIntSetting("XSECURELOCK_GRID_RANDOM_PUZZLE", 1);
+  BuildFixedPuzzle(&puzzle, grid_size, buffer_size, num_targets, target_len);
+  BuildTargetMatcher(&target_matcher, &puzzle);
 #ifdef HAVE_XKB_EXT
   show_keyboard_layout =
       GetIntSetting("XSECURELOCK_SHOW_KEYBOARD_LAYOUT", 1);
@@ -2308,13 +3562,13 @@ int main(int argc_local, char **argv_local) {
     Log("Could not connect to $DISPLAY");
     return 1;
   }
+  InitXRequestStats(display);
 
 #ifdef HAVE_XKB_EXT
-  int xkb_opcode, xkb_event_base, xkb_error_base;
-  int xkb_major_version = XkbMajorVersion, xkb_minor_version = XkbMinorVersion;
-  have_xkb_ext =
-      XkbQueryExtension(display, &xkb_opcode, &xkb_event_base, &xkb_error_base,
-                        &xkb_major_version, &xkb_minor_version);
+  BeginXRequestPhase(display, "InitXkbState");
+  have_xkb_ext = InitXkbState(display, show_keyboard_layout,
+                              show_locks_and_latches);
+  EndXRequestPhase(display);
 #endif
 
   if (!GetHostName(hostname, sizeof(hostname))) {
@@ -2324,21 +3578,29 @@ int main(int argc_local, char **argv_local) {
     return 1;
   }
 
-  main_window = ReadWindowID();
-  if (main_window == None) {
-    Log("Invalid/no window ID in XSCREENSAVER_WINDOW");
-    return 1;
+  if (render_script != NULL) {
+    // Nothing gets mapped; this window just anchors the backbuffers.
+    parent_window = DefaultRootWindow(display);
+    main_window = XCreateSimpleWindow(display, parent_window, 0, 0, 1, 1, 0,
+                                      0, 0);
+  } else {
+    main_window = ReadWindowID();
+    if (main_window == None) {
+      Log("Invalid/no window ID in XSCREENSAVER_WINDOW");
+      return 1;
+    }
+    Window unused_root;
+    Window *unused_children = NULL;
+    unsigned int unused_nchildren;
+    XQueryTree(display, main_window, &unused_root, &parent_window,
+               &unused_children, &unused_nchildren);
+    XFree(unused_children);
   }
-  Window unused_root;
-  Window *unused_children = NULL;
-  unsigned int unused_nchildren;
-  XQueryTree(display, main_window, &unused_root, &parent_window,
-             &unused_children, &unused_nchildren);
-  XFree(unused_children);
 
   Colormap colormap = DefaultColormap(display, DefaultScreen(display));
 
   // Allocate colors.
+  BeginXRequestPhase(display, "AllocColors");
   XColor dummy;
 
   XAllocNamedColor(display, colormap,
@@ -2406,7 +3668,9 @@ int main(int argc_local, char **argv_local) {
                        &xcolors[COLOR_RAIN_BASE + g], &dummy);
     }
   }
+  EndXRequestPhase(display);
 
+  BeginXRequestPhase(display, "OpenFonts");
   core_font = NULL;
 #ifdef HAVE_XFT_EXT
   xft_font = NULL;
@@ -2423,6 +3687,7 @@ int main(int argc_local, char **argv_local) {
       xft_font =
           FixedXftFontOpenName(display, DefaultScreen(display), font_name);
       have_font = (xft_font != NULL);
+      default_xft_font_name = font_name;
     }
 #endif
   }
@@ -2435,6 +3700,7 @@ int main(int argc_local, char **argv_local) {
     xft_font =
         FixedXftFontOpenName(display, DefaultScreen(display), CFG_FONT_NAME);
     have_font = (xft_font != NULL);
+    default_xft_font_name = CFG_FONT_NAME;
 #endif
   }
   if (!have_font) {
@@ -2445,9 +3711,12 @@ int main(int argc_local, char **argv_local) {
     Log("Could not load a mind-bogglingly stupid font");
     return 1;
   }
+  EndXRequestPhase(display);
 
 #ifdef HAVE_XFT_EXT
+  default_xft_font = xft_font;
   if (xft_font != NULL) {
+    BeginXRequestPhase(display, "XftColorAllocValue");
     XRenderColor xrcolor;
     xrcolor.alpha = 65535;
 
@@ -2459,6 +3728,7 @@ int main(int argc_local, char **argv_local) {
                          DefaultVisual(display, DefaultScreen(display)),
                          colormap, &xrcolor, &xft_colors[c]);
     }
+    EndXRequestPhase(display);
   }
 #endif
 
@@ -2466,7 +3736,12 @@ int main(int argc_local, char **argv_local) {
 
   InitWaitPgrp();
 
-  int status = Authenticate();
+  int status = (render_script != NULL)
+                   ? RunRenderScript(render_script, render_prefix)
+                   : WaitForStandbyActivation() ? Authenticate() : 1;
+
+  // Don't leave the bell reconfigured if we exit mid-sound.
+  StopSounds();
 
   // Clear any possible processing message by closing our windows.
   DestroyPerMonitorWindows(0);
@@ -2479,6 +3754,7 @@ int main(int argc_local, char **argv_local) {
     }
     XftFontClose(display, xft_font);
   }
+  FreeScaledXftFonts();
 #endif
 
   for (int c = 0; c < COLOR_COUNT; ++c) {
@@ -16,32 +16,50 @@ limitations under the License.
 
 #include "authproto.h"
 
-#include <errno.h>   // for errno
-#include <stdio.h>   // for snprintf
-#include <stdlib.h>  // for malloc, size_t
-#include <string.h>  // for strlen
-#include <unistd.h>  // for read, write, ssize_t
+#include <errno.h>       // for errno, EINTR
+#include <fcntl.h>       // for fcntl, FD_CLOEXEC, F_SETFD
+#include <stdio.h>       // for snprintf
+#include <stdlib.h>      // for malloc, size_t
+#include <string.h>      // for strlen, memcpy, memset
+#include <sys/socket.h>  // for send, sendmsg, recvmsg, CMSG_DATA, SCM_RIGHTS
+#include <sys/uio.h>     // for iovec
+#include <unistd.h>      // for read, write, close, ssize_t
 
 #include "../logging.h"     // for LogErrno, Log
 #include "../mlock_page.h"  // for MLOCK_PAGE
 #include "../util.h"        // for explicit_bzero
 
-static size_t WriteChars(int fd, const char *buf, size_t n) {
+/*! \brief Writes all of the given buffers, in as few syscalls as possible.
+ *
+ * \return The number of bytes written, or 0 in case of error.
+ */
+static size_t WriteVec(int fd, struct iovec *iov, int iovcnt) {
   size_t total = 0;
-  while (total < n) {
-    ssize_t got = write(fd, buf + total, n - total);
+  while (iovcnt > 0) {
+    ssize_t got = writev(fd, iov, iovcnt);
     if (got < 0) {
-      LogErrno("write");
+      LogErrno("writev");
       return 0;
     }
     if (got == 0) {
-      Log("write: could not write anything, send buffer full");
+      Log("writev: could not write anything, send buffer full");
       return 0;
     }
-    if ((size_t)got > n - total) {
-      Log("write: overlong write (should never happen)");
-    }
     total += got;
+    // Skip what has been written; pipes may take a packet in several parts.
+    while (iovcnt > 0 && (size_t)got >= iov->iov_len) {
+      got -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt == 0) {
+      if (got != 0) {
+        Log("writev: overlong write (should never happen)");
+      }
+      break;
+    }
+    iov->iov_base = (char *)iov->iov_base + got;
+    iov->iov_len -= got;
   }
   return total;
 }
@@ -63,23 +81,111 @@ void WritePacket(int fd, char type, const char *message) {
     Log("overlong prefix, cannot write");
     return;
   }
-  // Yes, we're wasting syscalls here. This doesn't need to be fast though, and
-  // this way we can avoid an extra buffer.
-  if (!WriteChars(fd, prefix, prefixlen)) {
-    return;
+  // One syscall for the whole packet, without copying the message (which may
+  // be a password) into another buffer.
+  struct iovec iov[3];
+  iov[0].iov_base = prefix;
+  iov[0].iov_len = prefixlen;
+  iov[1].iov_base = (char *)message;
+  iov[1].iov_len = len;
+  iov[2].iov_base = "\n";
+  iov[2].iov_len = 1;
+  WriteVec(fd, iov, 3);
+}
+
+//! The size of the read-ahead buffer of an fd.
+#define READ_BUFFER_SIZE 256
+
+//! The number of fds that can have data read ahead at the same time.
+#define NUM_READ_BUFFERS 4
+
+//! Data read ahead from an fd.
+struct ReadBuffer {
+  //! The fd the data came from, or -1 if unused.
+  int fd;
+  //! The offset of the first byte not yet consumed.
+  size_t pos;
+  //! The number of bytes in data.
+  size_t len;
+  //! The data; may contain passwords.
+  char data[READ_BUFFER_SIZE];
+};
+
+//! The read-ahead buffers; mlock()d, as they may contain passwords.
+static struct ReadBuffer *read_buffers = NULL;
+
+/*! \brief Returns the read-ahead buffer to use for an fd.
+ *
+ * Buffers of other fds are only taken over when they are empty, so no data
+ * can ever get lost.
+ *
+ * \return The buffer, or NULL if none is available; then reads are unbuffered.
+ */
+static struct ReadBuffer *GetReadBuffer(int fd) {
+  if (read_buffers == NULL) {
+    read_buffers = malloc(NUM_READ_BUFFERS * sizeof(*read_buffers));
+    if (read_buffers == NULL) {
+      LogErrno("malloc");
+      return NULL;
+    }
+    if (MLOCK_PAGE(read_buffers, NUM_READ_BUFFERS * sizeof(*read_buffers)) <
+        0) {
+      // We continue anyway, as the user being unable to unlock the screen is
+      // worse.
+      LogErrno("mlock");
+    }
+    for (int i = 0; i < NUM_READ_BUFFERS; ++i) {
+      read_buffers[i].fd = -1;
+      read_buffers[i].pos = read_buffers[i].len = 0;
+    }
   }
-  if (len != 0 && !WriteChars(fd, message, len)) {
-    return;
+  struct ReadBuffer *empty = NULL;
+  for (int i = 0; i < NUM_READ_BUFFERS; ++i) {
+    if (read_buffers[i].fd == fd) {
+      return &read_buffers[i];
+    }
+    if (empty == NULL && read_buffers[i].pos == read_buffers[i].len) {
+      empty = &read_buffers[i];
+    }
   }
-  if (!WriteChars(fd, "\n", 1)) {
-    return;
+  if (empty != NULL) {
+    empty->fd = fd;
+    empty->pos = empty->len = 0;
+  }
+  return empty;
+}
+
+/*! \brief Consumes data from a read-ahead buffer.
+ *
+ * \return The number of bytes copied to buf.
+ */
+static size_t TakeBuffered(struct ReadBuffer *rb, char *buf, size_t n) {
+  size_t avail = rb->len - rb->pos;
+  if (n > avail) {
+    n = avail;
+  }
+  memcpy(buf, rb->data + rb->pos, n);
+  rb->pos += n;
+  if (rb->pos == rb->len) {
+    explicit_bzero(rb->data, rb->len);
+    rb->pos = rb->len = 0;
   }
+  return n;
 }
 
 static size_t ReadChars(int fd, char *buf, size_t n, int eof_permitted) {
+  struct ReadBuffer *rb = GetReadBuffer(fd);
   size_t total = 0;
   while (total < n) {
-    ssize_t got = read(fd, buf + total, n - total);
+    if (rb != NULL && rb->pos != rb->len) {
+      total += TakeBuffered(rb, buf + total, n - total);
+      continue;
+    }
+    // Large reads go directly to the caller's buffer; small ones read ahead as
+    // much as is available, so the rest of a packet costs no more syscalls.
+    int direct = rb == NULL || n - total >= READ_BUFFER_SIZE;
+    ssize_t got = direct ? read(fd, buf + total, n - total)
+                         : read(fd, rb->data, READ_BUFFER_SIZE);
     if (got < 0) {
       LogErrno("read");
       return 0;
@@ -91,15 +197,45 @@ static size_t ReadChars(int fd, char *buf, size_t n, int eof_permitted) {
       }
       break;
     }
-    if ((size_t)got > n - total) {
+    if ((size_t)got > (direct ? n - total : READ_BUFFER_SIZE)) {
       Log("read: overlong read (should never happen)");
     }
-    total += got;
+    if (direct) {
+      total += got;
+    } else {
+      rb->pos = 0;
+      rb->len = got;
+    }
   }
   return total;
 }
 
-char ReadPacket(int fd, char **message, int eof_permitted) {
+int HaveBufferedPacketData(int fd) {
+  if (read_buffers == NULL) {
+    return 0;
+  }
+  for (int i = 0; i < NUM_READ_BUFFERS; ++i) {
+    if (read_buffers[i].fd == fd) {
+      return read_buffers[i].pos != read_buffers[i].len;
+    }
+  }
+  return 0;
+}
+
+void DropBufferedPacketData(int fd) {
+  if (read_buffers == NULL) {
+    return;
+  }
+  for (int i = 0; i < NUM_READ_BUFFERS; ++i) {
+    if (read_buffers[i].fd == fd) {
+      explicit_bzero(read_buffers[i].data, read_buffers[i].len);
+      read_buffers[i].fd = -1;
+      read_buffers[i].pos = read_buffers[i].len = 0;
+    }
+  }
+}
+
+static char DoReadPacket(int fd, char **message, int eof_permitted) {
   char type;
   *message = NULL;
   if (!ReadChars(fd, &type, 1, eof_permitted)) {
@@ -192,3 +328,120 @@ have_len:
   }
   return type;
 }
+
+char ReadPacket(int fd, char **message, int eof_permitted) {
+  char type = DoReadPacket(fd, message, eof_permitted);
+  if (type == 0) {
+    // The stream is unusable now; don't leave anything behind.
+    DropBufferedPacketData(fd);
+  }
+  return type;
+}
+
+//! Control message buffer for passing the two fds of an attempt.
+union AttemptControl {
+  struct cmsghdr hdr;
+  char buf[CMSG_SPACE(2 * sizeof(int))];
+};
+
+int SendAuthprotoReady(int control_fd) {
+  char tag = AUTHPROTO_READY;
+  for (;;) {
+    ssize_t sent = send(control_fd, &tag, 1, MSG_NOSIGNAL);
+    if (sent == 1) {
+      return 1;
+    }
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    LogErrno("send");
+    return 0;
+  }
+}
+
+int SendAuthprotoAttempt(int control_fd, int request_fd, int response_fd) {
+  int fds[2] = {request_fd, response_fd};
+  union AttemptControl control;
+  memset(&control, 0, sizeof(control));
+  char tag = 'a';
+  struct iovec iov;
+  iov.iov_base = &tag;
+  iov.iov_len = 1;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  for (;;) {
+    // No SIGPIPE if the persistent authproto died; the caller falls back.
+    ssize_t sent = sendmsg(control_fd, &msg, MSG_NOSIGNAL);
+    if (sent == 1) {
+      return 1;
+    }
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    LogErrno("sendmsg");
+    return 0;
+  }
+}
+
+int ReceiveAuthprotoAttempt(int control_fd, int *request_fd,
+                            int *response_fd) {
+  for (;;) {
+    union AttemptControl control;
+    memset(&control, 0, sizeof(control));
+    char tag;
+    struct iovec iov;
+    iov.iov_base = &tag;
+    iov.iov_len = 1;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t got = recvmsg(control_fd, &msg, 0);
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LogErrno("recvmsg");
+      return 0;
+    }
+    if (got == 0) {
+      // All ends of the control socket have been closed.
+      return 0;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+      Log("Ignoring authproto attempt without fds");
+      continue;
+    }
+    int fds[2] = {-1, -1};
+    size_t nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), (nfds < 2 ? nfds : 2) * sizeof(int));
+    if (nfds != 2 || (msg.msg_flags & MSG_CTRUNC)) {
+      Log("Ignoring authproto attempt with %d fds", (int)nfds);
+      for (size_t i = 0; i < nfds && i < 2; ++i) {
+        close(fds[i]);
+      }
+      continue;
+    }
+    // Keep them away from anything PAM spawns.
+    if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) != 0 ||
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC) != 0) {
+      LogErrno("fcntl");
+    }
+    *request_fd = fds[0];
+    *response_fd = fds[1];
+    return 1;
+  }
+}
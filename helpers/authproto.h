@@ -35,14 +35,37 @@ limitations under the License.
 #define PTYPE_ERROR_MESSAGE 'e'
 #define PTYPE_PROMPT_LIKE_USERNAME 'U'
 #define PTYPE_PROMPT_LIKE_PASSWORD 'P'
+// Timing of the attempt as key=value pairs, only for logging; only sent with
+// XSECURELOCK_PAM_TIMING=2.
+#define PTYPE_TIMING 't'
 // Note: there's no specific message type for successful authentication or
-// similar; the caller shall use the exit status of the helper only.
+// similar; the caller shall use the exit status of the helper only, except
+// with a persistent authproto (see below).
 
 // User-to-PAM messages:
 #define PTYPE_RESPONSE_LIKE_USERNAME 'u'
 #define PTYPE_RESPONSE_LIKE_PASSWORD 'p'
 #define PTYPE_RESPONSE_CANCELLED 'x'
 
+// Persistent authproto:
+//
+// With XSECURELOCK_AUTHPROTO_PERSISTENT, xsecurelock keeps one authproto
+// running for the whole lock session, and passes a control socket to it and to
+// the auth modules. The authproto first confirms that it serves attempts (see
+// SendAuthprotoReady); only then xsecurelock passes the control socket on. For
+// each attempt, the auth module creates its two pipes as usual and sends the
+// authproto's ends over the control socket (see SendAuthprotoAttempt). The
+// authproto runs the usual conversation over them, ends it with a PTYPE_RESULT
+// packet and closes them.
+
+// The record a persistent authproto sends on the control socket when it is
+// ready to serve attempts.
+#define AUTHPROTO_READY 'r'
+
+// PAM-to-user message ending an attempt of a persistent authproto; the message
+// is "0" if authentication succeeded, and "1" otherwise.
+#define PTYPE_RESULT 'r'
+
 /**
  * \brief Writes a packet in above form.
  *
@@ -55,7 +78,10 @@ void WritePacket(int fd, char type, const char *message);
 /**
  * \brief Reads a packet in above form.
  *
- * \param fd The file descriptor to write to.
+ * Data after the packet may already have been read from fd, and is kept for
+ * the next call; see HaveBufferedPacketData and DropBufferedPacketData.
+ *
+ * \param fd The file descriptor to read from.
  * \param message A pointer to store the message (will be mlock()d).
  *   Will always be set if function returns nonzero; caller must free it.
  * \param eof_permitted If enabled, encountering EOF at the beginning will not
@@ -64,4 +90,55 @@ void WritePacket(int fd, char type, const char *message);
  */
 char ReadPacket(int fd, char **message, int eof_permitted);
 
+/**
+ * \brief Returns whether ReadPacket has data from fd that was read ahead.
+ *
+ * If so, the next packet may be available even if fd is not readable.
+ *
+ * \param fd The file descriptor.
+ */
+int HaveBufferedPacketData(int fd);
+
+/**
+ * \brief Discards data ReadPacket has read ahead from fd.
+ *
+ * Must be called before closing an fd that ReadPacket was used on, unless it
+ * returned 0 or the process exits, so that no data gets attributed to a later
+ * fd with the same number.
+ *
+ * \param fd The file descriptor.
+ */
+void DropBufferedPacketData(int fd);
+
+/**
+ * \brief Tells xsecurelock that this persistent authproto serves attempts.
+ *
+ * \param control_fd The control socket.
+ * \return 1 if the record was sent, 0 otherwise. Errors are logged.
+ */
+int SendAuthprotoReady(int control_fd);
+
+/**
+ * \brief Hands an attempt to a persistent authproto.
+ *
+ * \param control_fd The control socket (XSECURELOCK_AUTHPROTO_WORKER_FD).
+ * \param request_fd The write end of the pipe for PAM-to-user messages.
+ * \param response_fd The read end of the pipe for user-to-PAM messages.
+ * \return 1 if the attempt was handed over, 0 if the persistent authproto is
+ *   gone. Errors are logged.
+ */
+int SendAuthprotoAttempt(int control_fd, int request_fd, int response_fd);
+
+/**
+ * \brief Waits for the next attempt on a persistent authproto.
+ *
+ * \param control_fd The control socket.
+ * \param request_fd Receives the fd to write PAM-to-user messages to.
+ * \param response_fd Receives the fd to read user-to-PAM messages from.
+ * \return 1 if an attempt was received, or 0 if all auth modules and
+ *   xsecurelock went away. Errors are logged.
+ */
+int ReceiveAuthprotoAttempt(int control_fd, int *request_fd,
+                            int *response_fd);
+
 #endif
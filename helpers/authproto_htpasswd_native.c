@@ -0,0 +1,226 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief authproto module that verifies ~/.xsecurelock.pw in-process.
+ *
+ * Behaves like authproto_htpasswd, but instead of running htpasswd -v for
+ * each attempt, it looks up the user's hash before prompting and verifies the
+ * password itself: APR1 hashes via Apr1Crypt, everything else (bcrypt,
+ * SHA-crypt, MD5-crypt, DES) via crypt_r.
+ */
+
+// For crypt_r.
+#define _GNU_SOURCE
+
+#include <crypt.h>     // for crypt_r, crypt_data
+#include <fcntl.h>     // for open, O_RDONLY, O_CLOEXEC
+#include <stdio.h>     // for snprintf
+#include <stdlib.h>    // for calloc, free, getenv
+#include <string.h>    // for memchr, memcmp, memcpy, strlen, strncmp
+#include <sys/mman.h>  // for mmap, munmap, MAP_FAILED
+#include <sys/stat.h>  // for fstat, stat
+#include <unistd.h>    // for close
+
+#include "../env_info.h"    // for GetUserName
+#include "../logging.h"     // for Log, LogErrno
+#include "../mlock_page.h"  // for MLOCK_PAGE
+#include "../util.h"        // for explicit_bzero
+#include "apr1.h"           // for Apr1Crypt, APR1_MAGIC, APR1_HASH_SIZE
+#include "authproto.h"      // for WritePacket, ReadPacket, PTYPE_*
+
+//! The password file, relative to $HOME.
+#define PASSWORD_FILE ".xsecurelock.pw"
+
+//! The maximum size of a password hash (including the NUL).
+#define MAX_HASH_SIZE 256
+
+//! Everything that depends on the password; mlock()d.
+static struct {
+  struct crypt_data crypt;
+  char apr1[APR1_HASH_SIZE];
+  char hash[MAX_HASH_SIZE];
+} * secrets;
+
+/*! \brief Finds the hash of the given user in the password file.
+ *
+ * The file is mapped once and unmapped again right away, so it is read before
+ * the user is prompted.
+ *
+ * \param user The user name.
+ * \param hash Receives the hash.
+ * \param hash_size The size of hash.
+ * \return 1 if the hash was found, 0 otherwise.
+ */
+static int LoadHash(const char *user, char *hash, size_t hash_size) {
+  const char *home = getenv("HOME");
+  if (home == NULL || *home == 0) {
+    Log("HOME is not set");
+    return 0;
+  }
+  char path[4096];
+  if ((size_t)snprintf(path, sizeof(path), "%s/%s", home, PASSWORD_FILE) >=
+      sizeof(path)) {
+    Log("Path of the password file too long");
+    return 0;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    LogErrno("open %s", path);
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    LogErrno("fstat %s", path);
+    close(fd);
+    return 0;
+  }
+  if (st.st_size == 0) {
+    Log("%s is empty", path);
+    close(fd);
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LogErrno("mmap %s", path);
+    return 0;
+  }
+
+  int found = 0;
+  size_t user_len = strlen(user);
+  const char *end = data + size;
+  for (const char *line = data; line < end && !found;) {
+    const char *eol = memchr(line, '\n', (size_t)(end - line));
+    if (eol == NULL) {
+      eol = end;
+    }
+    if ((size_t)(eol - line) > user_len && !memcmp(line, user, user_len) &&
+        line[user_len] == ':') {
+      const char *h = line + user_len + 1;
+      const char *h_end = h;
+      while (h_end < eol && *h_end != ':' && *h_end != '\r') {
+        ++h_end;
+      }
+      size_t len = (size_t)(h_end - h);
+      if (len == 0 || len >= hash_size) {
+        Log("Unsupported hash for user %s in %s", user, path);
+        break;
+      }
+      memcpy(hash, h, len);
+      hash[len] = 0;
+      found = 1;
+    }
+    line = eol + 1;
+  }
+  munmap((void *)data, size);
+  if (!found) {
+    Log("No hash for user %s in %s", user, path);
+  }
+  return found;
+}
+
+/*! \brief Compares two strings in time independent of their contents.
+ *
+ * Only the lengths leak, and those are known from the hash anyway.
+ */
+static int ConstantTimeEquals(const char *a, const char *b) {
+  size_t len = strlen(a);
+  if (strlen(b) != len) {
+    return 0;
+  }
+  volatile unsigned char diff = 0;
+  for (size_t i = 0; i < len; ++i) {
+    diff |= (unsigned char)(a[i] ^ b[i]);
+  }
+  return diff == 0;
+}
+
+/*! \brief Verifies a password against a hash.
+ *
+ * \return 1 if the password matches, 0 otherwise.
+ */
+static int VerifyPassword(const char *password, const char *hash) {
+  const char *computed = NULL;
+  if (!strncmp(hash, APR1_MAGIC, strlen(APR1_MAGIC))) {
+    if (Apr1Crypt(password, hash, secrets->apr1, sizeof(secrets->apr1))) {
+      computed = secrets->apr1;
+    }
+  } else {
+    computed = crypt_r(password, hash, &secrets->crypt);
+  }
+  int ok = 0;
+  if (computed == NULL || *computed == '*') {
+    Log("Unsupported hash type in %s", PASSWORD_FILE);
+  } else {
+    ok = ConstantTimeEquals(computed, hash);
+  }
+  // Even on failure, crypt_r may have left password-derived state behind.
+  explicit_bzero(secrets->apr1, sizeof(secrets->apr1));
+  explicit_bzero(&secrets->crypt, sizeof(secrets->crypt));
+  return ok;
+}
+
+int main() {
+  secrets = calloc(1, sizeof(*secrets));
+  if (secrets == NULL) {
+    LogErrno("calloc");
+    return 1;
+  }
+  if (MLOCK_PAGE(secrets, sizeof(*secrets)) < 0) {
+    LogErrno("mlock");
+    // We continue anyway, as the user being unable to unlock the screen is
+    // worse. But let's not allocate anything else.
+  }
+
+  char username[256];
+  if (!GetUserName(username, sizeof(username)) ||
+      !LoadHash(username, secrets->hash, sizeof(secrets->hash))) {
+    WritePacket(1, PTYPE_ERROR_MESSAGE, "Cannot read ~/" PASSWORD_FILE ".");
+    return 1;
+  }
+
+  WritePacket(1, PTYPE_PROMPT_LIKE_PASSWORD, "Enter password:");
+  char *password;
+  char type = ReadPacket(0, &password, 1);
+  switch (type) {
+    case PTYPE_RESPONSE_LIKE_PASSWORD: {
+      int ok = VerifyPassword(password, secrets->hash);
+      explicit_bzero(password, strlen(password));
+      free(password);
+      explicit_bzero(secrets->hash, sizeof(secrets->hash));
+      if (ok) {
+        WritePacket(1, PTYPE_INFO_MESSAGE, "I know you.");
+        return 0;
+      }
+      WritePacket(1, PTYPE_ERROR_MESSAGE, "Invalid password.");
+      return 1;
+    }
+    case PTYPE_RESPONSE_CANCELLED:
+    case 0:
+      break;
+    default:
+      Log("Unexpected packet type");
+      break;
+  }
+  if (type != 0) {
+    explicit_bzero(password, strlen(password));
+    free(password);
+  }
+  explicit_bzero(secrets->hash, sizeof(secrets->hash));
+  return 1;
+}
@@ -0,0 +1,356 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief authproto module that runs several authproto modules at once.
+ *
+ * Starts all modules listed in XSECURELOCK_AUTHPROTO_MULTIPLEX in parallel.
+ * Their prompts are shown one at a time, and each response goes to all
+ * modules waiting for the same kind of response; so modules that all ask for
+ * the password get it from a single prompt. Messages are passed through.
+ * The first module to succeed wins and the others are killed; if all of them
+ * fail, so do we.
+ */
+
+#include <errno.h>       // for errno, EINTR
+#include <fcntl.h>       // for fcntl, FD_CLOEXEC, F_SETFD
+#include <signal.h>      // for sigaction, sigemptyset, raise, SIGPIPE
+#include <stdlib.h>      // for abort, free
+#include <string.h>      // for memcpy, strchr, strcmp, strcspn, strlen,
+                         // strncmp, strrchr
+#include <sys/select.h>  // for select, FD_SET, FD_ZERO, FD_ISSET, fd_set
+#include <sys/time.h>    // for timeval
+#include <unistd.h>      // for close, pipe
+
+#include "../env_settings.h"  // for GetIntSetting, GetStringSetting
+#include "../logging.h"       // for Log, LogErrno
+#include "../util.h"          // for explicit_bzero
+#include "../wait_pgrp.h"     // for SpawnProcess, WaitPgrp, KillPgrp
+#include "authproto.h"        // for WritePacket, ReadPacket, PTYPE_*
+
+//! The maximum number of authproto modules to run at once.
+#define MAX_BACKENDS 8
+
+//! A running authproto module.
+typedef struct {
+  //! The executable; relative paths are within HELPER_PATH.
+  char path[256];
+  //! The process group of the module, or 0 if it is not running.
+  pid_t pid;
+  //! Its stdout; we read prompts and messages from it.
+  int request_fd;
+  //! Its stdin; we write responses to it.
+  int response_fd;
+  //! The type of the prompt it waits for a response to, or 0.
+  char prompt_type;
+  //! The text of that prompt.
+  char *prompt;
+} Backend;
+
+static Backend backends[MAX_BACKENDS];
+static size_t num_backends;
+
+static void HandleSIGTERM(int signo) {
+  for (size_t i = 0; i < num_backends; ++i) {
+    if (backends[i].pid != 0) {
+      KillPgrp(backends[i].pid, signo);  // Dirty, but quick.
+    }
+  }
+  raise(signo);  // The handler was reset, so this terminates us.
+}
+
+static void IgnoreSignal(int signo) { (void)signo; }
+
+/*! \brief Checks whether an entry of XSECURELOCK_AUTHPROTO_MULTIPLEX is
+ * acceptable, following the rules of GetExecutablePathSetting.
+ */
+static int IsValidBackend(const char *path) {
+  if (strchr(path, '/') && path[0] != '/') {
+    Log("Executable name '%s' must be either an absolute path or a file within "
+        "%s",
+        path, HELPER_PATH);
+    return 0;
+  }
+  const char *basename = strrchr(path, '/');
+  basename = basename == NULL ? path : basename + 1;
+  if (strncmp(basename, "authproto_", 10)) {
+    Log("Authproto executable name '%s' must start with authproto_", path);
+    return 0;
+  }
+  if (!strcmp(basename, "authproto_multiplex")) {
+    Log("authproto_multiplex cannot run itself");
+    return 0;
+  }
+  return 1;
+}
+
+/*! \brief Fills backends from a comma-separated list of modules.
+ *
+ * \return The number of modules found.
+ */
+static size_t ParseBackends(const char *list) {
+  for (;;) {
+    size_t len = strcspn(list, ",");
+    if (len > 0) {
+      if (num_backends == MAX_BACKENDS) {
+        Log("Too many authproto modules - skipping: %s", list);
+        break;
+      }
+      Backend *b = &backends[num_backends];
+      if (len < sizeof(b->path)) {
+        memcpy(b->path, list, len);
+        b->path[len] = 0;
+        if (IsValidBackend(b->path)) {
+          ++num_backends;
+        }
+      } else {
+        Log("Too long authproto module name - skipping: %s", list);
+      }
+    }
+    if (list[len] == 0) {
+      break;
+    }
+    list += len + 1;
+  }
+  return num_backends;
+}
+
+/*! \brief Starts an authproto module.
+ *
+ * \return 1 if it is running, 0 otherwise.
+ */
+static int StartBackend(Backend *b) {
+  b->pid = 0;
+  b->request_fd = -1;
+  b->response_fd = -1;
+  int requestfd[2], responsefd[2];
+  if (pipe(requestfd)) {
+    LogErrno("pipe");
+    return 0;
+  }
+  if (pipe(responsefd)) {
+    LogErrno("pipe");
+    close(requestfd[0]);
+    close(requestfd[1]);
+    return 0;
+  }
+  // Our ends of the pipes must not leak into this or other modules.
+  if (fcntl(requestfd[0], F_SETFD, FD_CLOEXEC) != 0 ||
+      fcntl(responsefd[1], F_SETFD, FD_CLOEXEC) != 0) {
+    LogErrno("fcntl");
+  }
+  const char *args[2] = {b->path, NULL};
+  pid_t pid = SpawnProcess(b->path, args, NULL, responsefd[0], requestfd[1],
+                           SPAWN_NEW_PGRP);
+  close(requestfd[1]);
+  close(responsefd[0]);
+  if (pid == -1) {
+    LogErrno("spawn %s", b->path);
+    close(requestfd[0]);
+    close(responsefd[1]);
+    return 0;
+  }
+  b->pid = pid;
+  b->request_fd = requestfd[0];
+  b->response_fd = responsefd[1];
+  return 1;
+}
+
+//! Forgets the prompt the module waits for a response to.
+static void ClearPrompt(Backend *b) {
+  free(b->prompt);
+  b->prompt = NULL;
+  b->prompt_type = 0;
+}
+
+//! Closes our ends of the pipes to the module.
+static void CloseBackend(Backend *b) {
+  DropBufferedPacketData(b->request_fd);
+  close(b->request_fd);
+  close(b->response_fd);
+  b->request_fd = -1;
+  b->response_fd = -1;
+  ClearPrompt(b);
+}
+
+/*! \brief Waits for a module that closed its stdout to exit.
+ *
+ * \return Its exit status.
+ */
+static int ReapBackend(Backend *b) {
+  CloseBackend(b);
+  int status;
+  if (!WaitPgrp(b->path, &b->pid, 1, 0, &status)) {
+    Log("WaitPgrp returned false but we were blocking");
+    abort();
+  }
+  return status;
+}
+
+/*! \brief Kills all modules that are still running.
+ *
+ * They are not waited for, so a module that is slow to die does not delay
+ * the result.
+ */
+static void KillBackends(void) {
+  for (size_t i = 0; i < num_backends; ++i) {
+    Backend *b = &backends[i];
+    if (b->pid != 0) {
+      KillPgrp(b->pid, SIGTERM);
+      CloseBackend(b);
+      b->pid = 0;
+    }
+  }
+}
+
+int main() {
+  if (GetIntSetting("XSECURELOCK_AUTHPROTO_WORKER", 0)) {
+    // Each attempt would need its own set of modules; let the caller fall
+    // back to starting us per attempt.
+    Log("authproto_multiplex does not support "
+        "XSECURELOCK_AUTHPROTO_PERSISTENT");
+    return 1;
+  }
+
+  // A module that goes away mid-conversation must not kill us. Not SIG_IGN,
+  // as that would be inherited by the modules.
+  struct sigaction sa;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;
+  sa.sa_handler = IgnoreSignal;
+  if (sigaction(SIGPIPE, &sa, NULL) != 0) {
+    LogErrno("sigaction(SIGPIPE)");
+  }
+  sa.sa_flags = SA_RESETHAND;
+  sa.sa_handler = HandleSIGTERM;
+  if (sigaction(SIGTERM, &sa, NULL) != 0) {
+    LogErrno("sigaction(SIGTERM)");
+  }
+
+  if (!ParseBackends(GetStringSetting("XSECURELOCK_AUTHPROTO_MULTIPLEX", ""))) {
+    Log("No authproto modules configured in XSECURELOCK_AUTHPROTO_MULTIPLEX");
+    return 1;
+  }
+  size_t running = 0;
+  for (size_t i = 0; i < num_backends; ++i) {
+    running += StartBackend(&backends[i]);
+  }
+
+  // The type of the prompt the user is answering, or 0.
+  char asked_type = 0;
+  while (running > 0) {
+    if (asked_type == 0) {
+      for (size_t i = 0; i < num_backends; ++i) {
+        Backend *b = &backends[i];
+        if (b->pid != 0 && b->prompt_type != 0) {
+          WritePacket(1, b->prompt_type, b->prompt);
+          asked_type = b->prompt_type;
+          break;
+        }
+      }
+    }
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    int maxfd = -1;
+    int buffered = 0;
+    if (asked_type != 0) {
+      FD_SET(0, &fds);
+      maxfd = 0;
+      buffered |= HaveBufferedPacketData(0);
+    }
+    for (size_t i = 0; i < num_backends; ++i) {
+      Backend *b = &backends[i];
+      if (b->pid != 0) {
+        FD_SET(b->request_fd, &fds);
+        if (b->request_fd > maxfd) {
+          maxfd = b->request_fd;
+        }
+        buffered |= HaveBufferedPacketData(b->request_fd);
+      }
+    }
+    struct timeval poll_only = {0, 0};
+    if (select(maxfd + 1, &fds, NULL, NULL, buffered ? &poll_only : NULL) <
+        0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LogErrno("select");
+      break;
+    }
+
+    // Modules first, so a success wins over whatever the user does next.
+    for (size_t i = 0; i < num_backends; ++i) {
+      Backend *b = &backends[i];
+      if (b->pid == 0 || (!FD_ISSET(b->request_fd, &fds) &&
+                          !HaveBufferedPacketData(b->request_fd))) {
+        continue;
+      }
+      char *message;
+      char type = ReadPacket(b->request_fd, &message, 1);
+      switch (type) {
+        case PTYPE_PROMPT_LIKE_USERNAME:
+        case PTYPE_PROMPT_LIKE_PASSWORD:
+          ClearPrompt(b);
+          b->prompt_type = type;
+          b->prompt = message;
+          break;
+        case 0:
+          if (ReapBackend(b) == 0) {
+            KillBackends();
+            return 0;
+          }
+          --running;
+          break;
+        default:
+          WritePacket(1, type, message);
+          explicit_bzero(message, strlen(message));
+          free(message);
+          break;
+      }
+    }
+
+    if (asked_type != 0 && (FD_ISSET(0, &fds) || HaveBufferedPacketData(0))) {
+      char *response;
+      char type = ReadPacket(0, &response, 1);
+      char prompt_type = type == PTYPE_RESPONSE_LIKE_USERNAME
+                             ? PTYPE_PROMPT_LIKE_USERNAME
+                             : type == PTYPE_RESPONSE_LIKE_PASSWORD
+                                   ? PTYPE_PROMPT_LIKE_PASSWORD
+                                   : 0;
+      if (prompt_type == 0) {
+        // Cancelled, or the auth module went away.
+        if (type != 0) {
+          explicit_bzero(response, strlen(response));
+          free(response);
+        }
+        break;
+      }
+      for (size_t i = 0; i < num_backends; ++i) {
+        Backend *b = &backends[i];
+        if (b->pid != 0 && b->prompt_type == prompt_type) {
+          WritePacket(b->response_fd, type, response);
+          ClearPrompt(b);
+        }
+      }
+      explicit_bzero(response, strlen(response));
+      free(response);
+      asked_type = 0;
+    }
+  }
+  KillBackends();
+  return 1;
+}
@@ -14,13 +14,18 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <fcntl.h>              // for open, O_RDWR
 #include <locale.h>             // for NULL, setlocale, LC_CTYPE
 #include <security/pam_appl.h>  // for pam_end, pam_start, pam_acct_mgmt
+#include <signal.h>             // for sigaction, sigemptyset, SIGPIPE
+#include <stdio.h>              // for snprintf
 #include <stdlib.h>             // for free, calloc, exit, getenv
 #include <string.h>             // for strchr
+#include <time.h>               // for clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>             // for close, dup2, fork, setsid, _exit
 
 #include "../env_info.h"      // for GetHostName, GetUserName
-#include "../env_settings.h"  // for GetStringSetting
+#include "../env_settings.h"  // for GetIntSetting, GetStringSetting
 #include "../logging.h"       // for Log
 #include "../util.h"          // for explicit_bzero
 #include "authproto.h"        // for WritePacket, ReadPacket, PTYPE_ERRO...
@@ -30,6 +35,55 @@ limitations under the License.
 //! Set if a conversation error has happened during the last PAM call.
 static int conv_error = 0;
 
+//! The fd to read user-to-PAM messages from.
+static int conv_in_fd = 0;
+
+//! The fd to write PAM-to-user messages to.
+static int conv_out_fd = 1;
+
+//! Timing: 0 = off, 1 = log a line per attempt, 2 = also send it as a packet.
+static int timing_level = 0;
+
+//! The timed stages of a PAM transaction.
+enum Stage {
+  STAGE_START,  // pam_start and setting items.
+  STAGE_AUTHENTICATE,
+  STAGE_ACCT_MGMT,
+  STAGE_CHAUTHTOK,
+  STAGE_SETCRED,
+  STAGE_END,
+  NUM_STAGES
+};
+
+static const char *const STAGE_NAMES[NUM_STAGES] = {
+    "start", "authenticate", "acct_mgmt", "chauthtok", "setcred", "end",
+};
+
+//! The timing of the current attempt.
+static struct {
+  //! Time spent in each stage, including waiting for the user.
+  long long stage_us[NUM_STAGES];
+  //! Number of calls per stage, i.e. 1 + retries.
+  int stage_calls[NUM_STAGES];
+  //! Time spent waiting for answers to prompts.
+  long long prompt_us;
+  int prompts;
+} timing;
+
+static long long NowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//! Charges the time since start to a stage.
+static void StageDone(enum Stage stage, long long start) {
+  if (timing_level) {
+    timing.stage_us[stage] += NowUs() - start;
+    timing.stage_calls[stage]++;
+  }
+}
+
 /*! \brief Perform a single PAM conversation step.
  *
  * \param msg The PAM message.
@@ -42,20 +96,30 @@ int ConverseOne(const struct pam_message *msg, struct pam_response *resp) {
   resp->resp_retcode = 0;  // Unused but should be set to zero.
   switch (msg->msg_style) {
     case PAM_PROMPT_ECHO_OFF: {
-      WritePacket(1, PTYPE_PROMPT_LIKE_PASSWORD, msg->msg);
-      char type = ReadPacket(0, &resp->resp, 0);
+      long long start = timing_level ? NowUs() : 0;
+      WritePacket(conv_out_fd, PTYPE_PROMPT_LIKE_PASSWORD, msg->msg);
+      char type = ReadPacket(conv_in_fd, &resp->resp, 0);
+      if (timing_level) {
+        timing.prompt_us += NowUs() - start;
+        timing.prompts++;
+      }
       return type == PTYPE_RESPONSE_LIKE_PASSWORD ? PAM_SUCCESS : PAM_CONV_ERR;
     }
     case PAM_PROMPT_ECHO_ON: {
-      WritePacket(1, PTYPE_PROMPT_LIKE_USERNAME, msg->msg);
-      char type = ReadPacket(0, &resp->resp, 0);
+      long long start = timing_level ? NowUs() : 0;
+      WritePacket(conv_out_fd, PTYPE_PROMPT_LIKE_USERNAME, msg->msg);
+      char type = ReadPacket(conv_in_fd, &resp->resp, 0);
+      if (timing_level) {
+        timing.prompt_us += NowUs() - start;
+        timing.prompts++;
+      }
       return type == PTYPE_RESPONSE_LIKE_USERNAME ? PAM_SUCCESS : PAM_CONV_ERR;
     }
     case PAM_ERROR_MSG:
-      WritePacket(1, PTYPE_ERROR_MESSAGE, msg->msg);
+      WritePacket(conv_out_fd, PTYPE_ERROR_MESSAGE, msg->msg);
       return PAM_SUCCESS;
     case PAM_TEXT_INFO:
-      WritePacket(1, PTYPE_INFO_MESSAGE, msg->msg);
+      WritePacket(conv_out_fd, PTYPE_INFO_MESSAGE, msg->msg);
       return PAM_SUCCESS;
     default:
       return PAM_CONV_ERR;
@@ -107,12 +171,14 @@ int Converse(int num_msg, const struct pam_message **msg,
 /*! \brief Perform a single PAM operation with retrying logic.
  */
 int CallPAMWithRetries(int (*pam_call)(pam_handle_t *, int), pam_handle_t *pam,
-                       int flags) {
+                       int flags, enum Stage stage) {
   int attempt = 0;
   for (;;) {
     conv_error = 0;
 
+    long long start = timing_level ? NowUs() : 0;
     int status = pam_call(pam, flags);
+    StageDone(stage, start);
     if (conv_error) {
       return status;
     }
@@ -134,14 +200,14 @@ int CallPAMWithRetries(int (*pam_call)(pam_handle_t *, int), pam_handle_t *pam,
   }
 }
 
-/*! \brief Perform PAM authentication.
+/*! \brief Set up a PAM transaction for the current user.
  *
  * \param conv The PAM conversation handler.
  * \param pam The PAM handle will be returned here.
- * \return The PAM status (PAM_SUCCESS after successful authentication, or
- *   anything else in case of error).
+ * \return The PAM status (PAM_SUCCESS if the transaction is ready for
+ *   authentication, or anything else in case of error).
  */
-int Authenticate(struct pam_conv *conv, pam_handle_t **pam) {
+int SetUpTransaction(struct pam_conv *conv, pam_handle_t **pam) {
   const char *service_name =
       GetStringSetting("XSECURELOCK_PAM_SERVICE", PAM_SERVICE_NAME);
   if (strchr(service_name, '/')) {
@@ -188,22 +254,48 @@ int Authenticate(struct pam_conv *conv, pam_handle_t **pam) {
     return status;
   }
 
-  status = CallPAMWithRetries(pam_authenticate, *pam, 0);
+  return PAM_SUCCESS;
+}
+
+/*! \brief Start a PAM transaction for the current user, and its timing.
+ *
+ * \param conv The PAM conversation handler.
+ * \param pam The PAM handle will be returned here.
+ * \return The PAM status (PAM_SUCCESS if the transaction is ready for
+ *   authentication, or anything else in case of error).
+ */
+int StartTransaction(struct pam_conv *conv, pam_handle_t **pam) {
+  memset(&timing, 0, sizeof(timing));
+  long long start = timing_level ? NowUs() : 0;
+  int status = SetUpTransaction(conv, pam);
+  StageDone(STAGE_START, start);
+  return status;
+}
+
+/*! \brief Perform PAM authentication in a started transaction.
+ *
+ * \param pam The PAM handle from StartTransaction().
+ * \return The PAM status (PAM_SUCCESS after successful authentication, or
+ *   anything else in case of error).
+ */
+int AuthenticateTransaction(pam_handle_t *pam) {
+  int status =
+      CallPAMWithRetries(pam_authenticate, pam, 0, STAGE_AUTHENTICATE);
   if (status != PAM_SUCCESS) {
     if (!conv_error) {
-      Log("pam_authenticate: %s", pam_strerror(*pam, status));
+      Log("pam_authenticate: %s", pam_strerror(pam, status));
     }
     return status;
   }
 
-  int status2 = CallPAMWithRetries(pam_acct_mgmt, *pam, 0);
+  int status2 = CallPAMWithRetries(pam_acct_mgmt, pam, 0, STAGE_ACCT_MGMT);
   if (status2 == PAM_NEW_AUTHTOK_REQD) {
-    status2 =
-        CallPAMWithRetries(pam_chauthtok, *pam, PAM_CHANGE_EXPIRED_AUTHTOK);
+    status2 = CallPAMWithRetries(pam_chauthtok, pam,
+                                 PAM_CHANGE_EXPIRED_AUTHTOK, STAGE_CHAUTHTOK);
 #ifdef PAM_CHECK_ACCOUNT_TYPE
     if (status2 != PAM_SUCCESS) {
       if (!conv_error) {
-        Log("pam_chauthtok: %s", pam_strerror(*pam, status2));
+        Log("pam_chauthtok: %s", pam_strerror(pam, status2));
       }
       return status2;
     }
@@ -217,26 +309,245 @@ int Authenticate(struct pam_conv *conv, pam_handle_t **pam) {
     // If this one is true, it must be coming from pam_acct_mgmt, as
     // pam_chauthtok's result already has been checked against PAM_SUCCESS.
     if (!conv_error) {
-      Log("pam_acct_mgmt: %s", pam_strerror(*pam, status2));
+      Log("pam_acct_mgmt: %s", pam_strerror(pam, status2));
     }
     return status2;
   }
 #endif
 
-  // Have the authentication module refresh Kerberos tickets and such
-  // if applicable.
-  int sc_status = pam_setcred(*pam, PAM_REFRESH_CRED);
+  return status;
+}
+
+/*! \brief Have the authentication module refresh Kerberos tickets and such
+ * if applicable.
+ *
+ * Failures are only logged.
+ *
+ * \param pam The PAM handle of a successful authentication.
+ */
+void RefreshCredentials(pam_handle_t *pam) {
+  long long start = timing_level ? NowUs() : 0;
+  int sc_status = pam_setcred(pam, PAM_REFRESH_CRED);
+  StageDone(STAGE_SETCRED, start);
   if (sc_status != PAM_SUCCESS) {
     Log("pam_setcred: status=%d", sc_status);
   }
+}
 
-  return status;
+/*! \brief Perform PAM authentication.
+ *
+ * \param conv The PAM conversation handler.
+ * \param pam The PAM handle will be returned here.
+ * \return The PAM status (PAM_SUCCESS after successful authentication, or
+ *   anything else in case of error).
+ */
+int Authenticate(struct pam_conv *conv, pam_handle_t **pam) {
+  int status = StartTransaction(conv, pam);
+  if (status != PAM_SUCCESS) {
+    return status;
+  }
+  return AuthenticateTransaction(*pam);
+}
+
+/*! \brief End a PAM transaction.
+ *
+ * \param pam The PAM handle; may be NULL.
+ * \param status The status of the transaction so far.
+ * \return The final status (PAM_SUCCESS only if both authentication and ending
+ *   the transaction succeeded).
+ */
+int EndTransaction(pam_handle_t *pam, int status) {
+  if (pam == NULL) {
+    return status;
+  }
+  long long start = timing_level ? NowUs() : 0;
+  int status2 = pam_end(pam, status);
+  StageDone(STAGE_END, start);
+  if (status != PAM_SUCCESS) {
+    // The caller already displayed an error.
+    return status;
+  }
+  if (status2 != PAM_SUCCESS) {
+    Log("pam_end: %s", pam_strerror(pam, status2));
+  }
+  return status2;
+}
+
+/*! \brief Refresh credentials and end the transaction in a detached process.
+ *
+ * \param pam The PAM handle of a successful authentication.
+ * \return 1 in the parent, which shall report success without touching the
+ *   handle any more, or 0 if that failed and the caller has to do it all.
+ */
+int FinishInBackground(pam_handle_t *pam) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    LogErrno("fork");
+    return 0;
+  }
+  if (pid != 0) {
+    return 1;
+  }
+
+  // Leave the process group of the auth child, which gets killed when it
+  // exits, and let go of all pipes so nobody waits for us.
+  if (setsid() == (pid_t)-1) {
+    LogErrno("setsid");
+  }
+  int devnull = open("/dev/null", O_RDWR);
+  if (devnull == -1) {
+    LogErrno("open(/dev/null)");
+    close(0);
+    close(1);
+  } else {
+    dup2(devnull, 0);
+    dup2(devnull, 1);
+    if (devnull > 1) {
+      close(devnull);
+    }
+  }
+  if (conv_in_fd > 1) {
+    close(conv_in_fd);
+  }
+  if (conv_out_fd > 1) {
+    close(conv_out_fd);
+  }
+  conv_in_fd = 0;
+  conv_out_fd = 1;
+
+  RefreshCredentials(pam);
+  EndTransaction(pam, PAM_SUCCESS);
+  _exit(0);
+}
+
+/*! \brief Finish a PAM transaction.
+ *
+ * After successful authentication, credentials are refreshed first. As this
+ * may take seconds (e.g. with Kerberos), it can be deferred; then the unlock
+ * does not wait for it, and its failures are only logged. Usage:
+ *
+ * XSECURELOCK_PAM_DEFERRED_SETCRED=1 xsecurelock
+ *
+ * \param pam The PAM handle; may be NULL.
+ * \param status The status of the transaction so far.
+ * \return The final status, as with EndTransaction().
+ */
+int FinishTransaction(pam_handle_t *pam, int status) {
+  if (status != PAM_SUCCESS) {
+    return EndTransaction(pam, status);
+  }
+  if (GetIntSetting("XSECURELOCK_PAM_DEFERRED_SETCRED", 0) &&
+      FinishInBackground(pam)) {
+    return PAM_SUCCESS;
+  }
+  RefreshCredentials(pam);
+  return EndTransaction(pam, status);
+}
+
+/*! \brief Report the timing of the attempt that just finished.
+ *
+ * Logs a single line of key=value pairs, and with timing level 2 also sends it
+ * to the auth module, which can log it along with its own statistics. Times
+ * are in milliseconds; "modules" is the time spent inside PAM, i.e. without
+ * waiting for answers to prompts. Stages that did not run, e.g. a deferred
+ * setcred, are omitted. Usage:
+ *
+ * XSECURELOCK_PAM_TIMING=1 xsecurelock
+ *
+ * \param status The final PAM status of the attempt.
+ */
+void ReportTiming(int status) {
+  if (!timing_level) {
+    return;
+  }
+  char line[512];
+  int len = snprintf(line, sizeof(line), "status=%d", status);
+  long long total_us = 0;
+  for (int s = 0; s < NUM_STAGES && len > 0 && (size_t)len < sizeof(line);
+       ++s) {
+    if (timing.stage_calls[s] == 0) {
+      continue;
+    }
+    total_us += timing.stage_us[s];
+    len += snprintf(line + len, sizeof(line) - len, " %s_ms=%.2f %s_calls=%d",
+                    STAGE_NAMES[s], timing.stage_us[s] / 1000.0,
+                    STAGE_NAMES[s], timing.stage_calls[s]);
+  }
+  if (len > 0 && (size_t)len < sizeof(line)) {
+    snprintf(line + len, sizeof(line) - len,
+             " prompt_ms=%.2f prompts=%d modules_ms=%.2f",
+             timing.prompt_us / 1000.0, timing.prompts,
+             (total_us - timing.prompt_us) / 1000.0);
+  }
+  Log("PAM timing: %s", line);
+  if (timing_level >= 2) {
+    WritePacket(conv_out_fd, PTYPE_TIMING, line);
+  }
+}
+
+//! Does nothing; unlike SIG_IGN, this is not inherited by PAM helpers.
+static void IgnoreSignal(int signo) { (void)signo; }
+
+/*! \brief Serve all authentication attempts of a lock session.
+ *
+ * The control socket is on stdin and stdout. Each attempt gets a fresh PAM transaction,
+ * which is started ahead of time, i.e. while the user is still typing; so an
+ * attempt only pays for pam_authenticate and what follows.
+ *
+ * \param conv The PAM conversation handler.
+ * \return 0 if an attempt was successful, anything else otherwise.
+ */
+int ServeAttempts(struct pam_conv *conv) {
+  // An auth module that goes away mid-conversation must not kill us.
+  struct sigaction sa;
+  sa.sa_flags = 0;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = IgnoreSignal;
+  if (sigaction(SIGPIPE, &sa, NULL) != 0) {
+    LogErrno("sigaction(SIGPIPE)");
+  }
+
+  // Before the slow part, so xsecurelock does not wait for us for long.
+  if (!SendAuthprotoReady(0)) {
+    return 1;
+  }
+
+  pam_handle_t *pam = NULL;
+  int status = StartTransaction(conv, &pam);
+  while (ReceiveAuthprotoAttempt(0, &conv_out_fd, &conv_in_fd)) {
+    if (status != PAM_SUCCESS) {
+      // Starting the transaction failed; maybe it works now.
+      EndTransaction(pam, status);
+      pam = NULL;
+      status = StartTransaction(conv, &pam);
+    }
+    if (status == PAM_SUCCESS) {
+      status = AuthenticateTransaction(pam);
+    }
+    status = FinishTransaction(pam, status);
+    pam = NULL;
+    ReportTiming(status);
+    WritePacket(conv_out_fd, PTYPE_RESULT, status == PAM_SUCCESS ? "0" : "1");
+    close(conv_out_fd);
+    DropBufferedPacketData(conv_in_fd);
+    close(conv_in_fd);
+    if (status == PAM_SUCCESS) {
+      return 0;
+    }
+    // Get the next attempt's transaction ready.
+    status = StartTransaction(conv, &pam);
+  }
+  EndTransaction(pam, status);
+  return 1;
 }
 
 /*! \brief The main program.
  *
  * Usage: ./authproto_pam; status=$?
  *
+ * Or, as the persistent authproto started by xsecurelock:
+ * XSECURELOCK_AUTHPROTO_WORKER=1 ./authproto_pam <control_socket >&0
+ *
  * \return 0 if authentication successful, anything else otherwise.
  */
 int main() {
@@ -246,18 +557,15 @@ int main() {
   conv.conv = Converse;
   conv.appdata_ptr = NULL;
 
-  pam_handle_t *pam = NULL;
-  int status = Authenticate(&conv, &pam);
-  int status2 = pam == NULL ? PAM_SUCCESS : pam_end(pam, status);
+  timing_level = GetIntSetting("XSECURELOCK_PAM_TIMING", 0);
 
-  if (status != PAM_SUCCESS) {
-    // The caller already displayed an error.
-    return 1;
-  }
-  if (status2 != PAM_SUCCESS) {
-    Log("pam_end: %s", pam_strerror(pam, status2));
-    return 1;
+  if (GetIntSetting("XSECURELOCK_AUTHPROTO_WORKER", 0)) {
+    return ServeAttempts(&conv);
   }
 
-  return 0;
+  pam_handle_t *pam = NULL;
+  int status = Authenticate(&conv, &pam);
+  status = FinishTransaction(pam, status);
+  ReportTiming(status);
+  return status != PAM_SUCCESS;
 }
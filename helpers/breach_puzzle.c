@@ -0,0 +1,399 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "breach_puzzle.h"
+
+#include <stdio.h>   // for snprintf
+#include <string.h>  // for memcpy, memset, memcmp
+#include <time.h>    // for clock_gettime, CLOCK_MONOTONIC, timespec
+
+//! How many solver nodes to visit between clock checks.
+#define SOLVER_CLOCK_INTERVAL 256
+
+//! How often to try cutting a target that differs from the earlier ones.
+#define TARGET_ATTEMPTS 8
+
+/*! \brief xorshift32 step.
+ */
+static uint32_t PuzzleRandom(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/*! \brief Microseconds elapsed since start.
+ */
+static long ElapsedMicros(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000L +
+         (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+void BuildTargetMatcher(TargetMatcher *m, const BreachPuzzle *p) {
+  // The string spelled by each state, used for the prefix_len table.
+  int depth[MATCHER_MAX_STATES];
+  int str[MATCHER_MAX_STATES][MAX_TARGET_LEN];
+  int fail[MATCHER_MAX_STATES];
+
+  // Trie of all targets.
+  memset(m->next, -1, sizeof(m->next));
+  memset(m->output, 0, sizeof(m->output));
+  m->num_states = 1;
+  depth[0] = 0;
+  for (int t = 0; t < p->num_targets; ++t) {
+    int s = 0;
+    for (int j = 0; j < p->targets[t].length; ++j) {
+      int c = p->targets[t].codes[j];
+      if (m->next[s][c] < 0) {
+        int n = m->num_states++;
+        m->next[s][c] = n;
+        depth[n] = depth[s] + 1;
+        memcpy(str[n], str[s], depth[s] * sizeof(str[n][0]));
+        str[n][depth[s]] = c;
+      }
+      s = m->next[s][c];
+    }
+    m->output[s] |= 1u << t;
+  }
+
+  // Breadth-first pass: failure links, folded into next[].
+  int queue[MATCHER_MAX_STATES];
+  int head = 0, tail = 0;
+  fail[0] = 0;
+  for (int c = 0; c < NUM_HEX_CODES; ++c) {
+    int u = m->next[0][c];
+    if (u < 0) {
+      m->next[0][c] = 0;
+    } else {
+      fail[u] = 0;
+      queue[tail++] = u;
+    }
+  }
+  while (head < tail) {
+    int s = queue[head++];
+    // fail[s] is shallower, so its output is already final.
+    m->output[s] |= m->output[fail[s]];
+    for (int c = 0; c < NUM_HEX_CODES; ++c) {
+      int u = m->next[s][c];
+      if (u < 0) {
+        m->next[s][c] = m->next[fail[s]][c];
+      } else {
+        fail[u] = m->next[fail[s]][c];
+        queue[tail++] = u;
+      }
+    }
+  }
+
+  // Any target prefix that is a buffer suffix is also a suffix of the state's
+  // string, so this table is exact.
+  for (int s = 0; s < m->num_states; ++s) {
+    for (int t = 0; t < p->num_targets; ++t) {
+      int k = depth[s] < p->targets[t].length ? depth[s] : p->targets[t].length;
+      for (; k > 0; --k) {
+        if (memcmp(str[s] + depth[s] - k, p->targets[t].codes,
+                   k * sizeof(str[s][0])) == 0) {
+          break;
+        }
+      }
+      m->prefix_len[s][t] = (unsigned char)k;
+    }
+  }
+}
+
+/*! \brief Set the dimensions of a puzzle and fill its matrix at random.
+ */
+static void InitPuzzle(BreachPuzzle *p, int grid_size, int buffer_size,
+                       int num_targets, uint32_t *rng) {
+  memset(p, 0, sizeof(*p));
+  p->grid_size = grid_size;
+  p->buffer_size = buffer_size;
+  p->num_targets = num_targets;
+  for (int row = 0; row < grid_size; ++row) {
+    for (int col = 0; col < grid_size; ++col) {
+      p->code_matrix[row][col] = PuzzleRandom(rng) % NUM_HEX_CODES;
+    }
+  }
+}
+
+/*! \brief Cut the targets out of a string of buffer_size codes.
+ *
+ * Lengths cycle through 2 to target_len; each target tries a few start
+ * positions to avoid repeating an earlier target.
+ */
+static void CutTargets(BreachPuzzle *p, const int *codes, int target_len,
+                       uint32_t *rng) {
+  for (int t = 0; t < p->num_targets; ++t) {
+    TargetSequence *target = &p->targets[t];
+    target->length = 2 + t % (target_len - 1);
+    for (int attempt = 0; attempt < TARGET_ATTEMPTS; ++attempt) {
+      int start =
+          PuzzleRandom(rng) % (unsigned)(p->buffer_size - target->length + 1);
+      memcpy(target->codes, codes + start,
+             target->length * sizeof(codes[0]));
+      int duplicate = 0;
+      for (int u = 0; u < t; ++u) {
+        if (p->targets[u].length == target->length &&
+            !memcmp(p->targets[u].codes, target->codes,
+                    target->length * sizeof(codes[0]))) {
+          duplicate = 1;
+          break;
+        }
+      }
+      if (!duplicate) {
+        break;
+      }
+    }
+    snprintf(target->name, sizeof(target->name), "DATAMINE_V%d", t % 100 + 1);
+  }
+}
+
+void BuildStaircasePuzzle(BreachPuzzle *p, int grid_size, int buffer_size,
+                          int num_targets, int target_len, uint32_t seed) {
+  uint32_t rng = seed ^ ((uint32_t)grid_size << 24) ^
+                 ((uint32_t)buffer_size << 16) ^
+                 ((uint32_t)num_targets << 8) ^ (uint32_t)target_len;
+  if (rng == 0) {
+    rng = 1;
+  }
+  InitPuzzle(p, grid_size, buffer_size, num_targets, &rng);
+
+  // Shuffle rows (keeping row 0 first, as the path starts there) and columns.
+  int rows[MAX_GRID_SIZE], cols[MAX_GRID_SIZE];
+  for (int i = 0; i < grid_size; ++i) {
+    rows[i] = cols[i] = i;
+  }
+  for (int i = grid_size - 1; i > 0; --i) {
+    int j = PuzzleRandom(&rng) % (unsigned)(i + 1);
+    int tmp = cols[i];
+    cols[i] = cols[j];
+    cols[j] = tmp;
+    if (i > 1) {
+      j = 1 + PuzzleRandom(&rng) % (unsigned)i;
+      tmp = rows[i];
+      rows[i] = rows[j];
+      rows[j] = tmp;
+    }
+  }
+
+  // Step k picks (k + 1) / 2, k / 2: alternately along a row and a column,
+  // never twice the same cell.
+  for (int k = 0; k < buffer_size; ++k) {
+    p->hack_sequence[k].row = rows[(k + 1) / 2];
+    p->hack_sequence[k].col = cols[k / 2];
+  }
+
+  int codes[MAX_BUFFER_SIZE];
+  for (int k = 0; k < buffer_size; ++k) {
+    codes[k] = p->code_matrix[p->hack_sequence[k].row]
+                             [p->hack_sequence[k].col];
+  }
+  CutTargets(p, codes, target_len, &rng);
+}
+
+//! Distance meaning "cannot be completed".
+#define SOLVER_UNREACHABLE 255
+
+//! Search state shared by all SolveStep levels.
+typedef struct {
+  const BreachPuzzle *p;
+  const TargetMatcher *m;
+  uint32_t want_mask;
+  GridBits all;
+  GridBits used_rows[MAX_GRID_SIZE];
+  GridBits used_cols[MAX_GRID_SIZE];
+  GridPos *path;
+  struct timespec start;
+  long budget_usec;
+  long nodes;
+  int out_of_time;
+  //! Fewest codes that take (state, installed targets) to want_mask,
+  //! ignoring the grid; a lower bound on the remaining steps.
+  unsigned char dist[MATCHER_MAX_STATES][1 << MAX_TARGETS];
+} Solver;
+
+/*! \brief Fill s->dist for all subsets of the wanted targets.
+ *
+ * Subsets are visited from want_mask down, so transitions that install a
+ * target refer to finished entries; transitions within the same subset are
+ * relaxed until nothing changes.
+ */
+static void ComputeDistances(Solver *s) {
+  const TargetMatcher *m = s->m;
+  uint32_t want = s->want_mask;
+  for (uint32_t mask = want;; mask = (mask - 1) & want) {
+    for (int state = 0; state < m->num_states; ++state) {
+      int best = SOLVER_UNREACHABLE;
+      if (mask == want) {
+        best = 0;
+      } else {
+        for (int c = 0; c < NUM_HEX_CODES; ++c) {
+          int next = m->next[state][c];
+          uint32_t next_mask = (mask | m->output[next]) & want;
+          if (next_mask != mask && 1 + s->dist[next][next_mask] < best) {
+            best = 1 + s->dist[next][next_mask];
+          }
+        }
+      }
+      s->dist[state][mask] = (unsigned char)best;
+    }
+    for (int changed = (mask != want); changed;) {
+      changed = 0;
+      for (int state = 0; state < m->num_states; ++state) {
+        for (int c = 0; c < NUM_HEX_CODES; ++c) {
+          int next = m->next[state][c];
+          if (((mask | m->output[next]) & want) == mask &&
+              1 + s->dist[next][mask] < s->dist[state][mask]) {
+            s->dist[state][mask] = (unsigned char)(1 + s->dist[next][mask]);
+            changed = 1;
+          }
+        }
+      }
+    }
+    if (mask == 0) {
+      break;
+    }
+  }
+}
+
+/*! \brief Extend the path from the given step.
+ *
+ * \param line The row (if horizontal) or column to pick from.
+ * \param state The automaton state after the previous steps.
+ * \param mask The wanted targets installed by the previous steps.
+ * \return 1 if the path could be completed.
+ */
+static int SolveStep(Solver *s, int step, int line, int horizontal, int state,
+                     uint32_t mask) {
+  int remaining = s->p->buffer_size - step;
+  if (s->dist[state][mask] > remaining) {
+    return 0;
+  }
+  if (remaining == 0) {
+    return 1;
+  }
+  if (++s->nodes % SOLVER_CLOCK_INTERVAL == 0 &&
+      ElapsedMicros(&s->start) >= s->budget_usec) {
+    s->out_of_time = 1;
+  }
+  if (s->out_of_time) {
+    return 0;
+  }
+
+  // Try the cells closest to installing all wanted targets first.
+  unsigned free_cells =
+      ~(unsigned)(horizontal ? s->used_rows[line] : s->used_cols[line]) &
+      s->all;
+  int order[MAX_GRID_SIZE], key[MAX_GRID_SIZE];
+  int count = 0;
+  while (free_cells) {
+    int k = __builtin_ctz(free_cells);
+    free_cells &= free_cells - 1;
+    int row = horizontal ? line : k;
+    int col = horizontal ? k : line;
+    int next = s->m->next[state][s->p->code_matrix[row][col]];
+    int d = s->dist[next][(mask | s->m->output[next]) & s->want_mask];
+    if (d >= remaining) {
+      continue;
+    }
+    int i = count++;
+    for (; i > 0 && key[i - 1] > d; --i) {
+      order[i] = order[i - 1];
+      key[i] = key[i - 1];
+    }
+    order[i] = k;
+    key[i] = d;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    int k = order[i];
+    int row = horizontal ? line : k;
+    int col = horizontal ? k : line;
+    int next = s->m->next[state][s->p->code_matrix[row][col]];
+    s->used_rows[row] |= (GridBits)(1u << col);
+    s->used_cols[col] |= (GridBits)(1u << row);
+    s->path[step].row = row;
+    s->path[step].col = col;
+    if (SolveStep(s, step + 1, horizontal ? col : row, !horizontal, next,
+                  (mask | s->m->output[next]) & s->want_mask)) {
+      return 1;
+    }
+    s->used_rows[row] &= (GridBits)~(1u << col);
+    s->used_cols[col] &= (GridBits)~(1u << row);
+  }
+  return 0;
+}
+
+int SolveBreachPuzzle(const BreachPuzzle *p, const TargetMatcher *m,
+                      uint32_t want_mask, GridPos *path, long budget_usec) {
+  Solver s;
+  memset(&s, 0, sizeof(s));
+  s.p = p;
+  s.m = m;
+  s.want_mask = want_mask;
+  s.all = (GridBits)((1u << p->grid_size) - 1);
+  s.path = path;
+  s.budget_usec = budget_usec;
+  clock_gettime(CLOCK_MONOTONIC, &s.start);
+  ComputeDistances(&s);
+  if (SolveStep(&s, 0, 0, 1, 0, 0)) {
+    return 1;
+  }
+  return s.out_of_time ? -1 : 0;
+}
+
+int GenerateBreachPuzzle(BreachPuzzle *p, int grid_size, int buffer_size,
+                         int num_targets, int target_len, uint32_t seed,
+                         long budget_usec) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint32_t rng = seed ? seed : 1;
+  uint32_t want_mask = (uint32_t)((1ull << num_targets) - 1);
+
+  for (;;) {
+    // The targets come from a random string of codes, so their overlaps fit
+    // a full buffer; whether the matrix has a path for them is up to the
+    // solver, whose path becomes the hack sequence.
+    InitPuzzle(p, grid_size, buffer_size, num_targets, &rng);
+    int codes[MAX_BUFFER_SIZE];
+    for (int k = 0; k < buffer_size; ++k) {
+      codes[k] = PuzzleRandom(&rng) % NUM_HEX_CODES;
+    }
+    CutTargets(p, codes, target_len, &rng);
+    TargetMatcher m;
+    BuildTargetMatcher(&m, p);
+    GridPos path[MAX_BUFFER_SIZE];
+    long left = budget_usec - ElapsedMicros(&start);
+    if (left <= 0) {
+      break;
+    }
+    int solved = SolveBreachPuzzle(p, &m, want_mask, path, left);
+    if (solved == 1) {
+      memcpy(p->hack_sequence, path, buffer_size * sizeof(path[0]));
+      return 1;
+    }
+    if (solved < 0) {
+      break;
+    }
+  }
+
+  BuildStaircasePuzzle(p, grid_size, buffer_size, num_targets, target_len,
+                       seed);
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef BREACH_PUZZLE_H
+#define BREACH_PUZZLE_H
+
+#include <stdint.h>  // for uint16_t, uint32_t
+
+//! Number of distinct codes a matrix cell can hold.
+#define NUM_HEX_CODES 4
+
+//! Bounds of the puzzle dimensions.
+#define MIN_GRID_SIZE 3
+#define MAX_GRID_SIZE 12
+#define MAX_BUFFER_SIZE 16
+#define MAX_TARGETS 8
+#define MAX_TARGET_LEN 8
+#define MAX_TARGET_NAME 16
+
+//! A position in the grid.
+typedef struct {
+  int row;
+  int col;
+} GridPos;
+
+//! A target sequence to complete.
+typedef struct {
+  char name[MAX_TARGET_NAME];
+  int codes[MAX_TARGET_LEN];  // indices into the code set
+  int length;
+} TargetSequence;
+
+//! One grid row (or a set of rows/columns) as a bitboard: bit i is cell i.
+typedef uint16_t GridBits;
+
+//! A puzzle: code matrix, hack path and targets.
+typedef struct {
+  int grid_size;
+  int buffer_size;
+  int num_targets;
+  int code_matrix[MAX_GRID_SIZE][MAX_GRID_SIZE];  // indices into the code set
+  //! The path the keypresses follow: alternately along a row and a column,
+  //! starting in row 0, never visiting a cell twice.
+  GridPos hack_sequence[MAX_BUFFER_SIZE];
+  TargetSequence targets[MAX_TARGETS];
+} BreachPuzzle;
+
+//! Upper bound on the number of TargetMatcher states.
+#define MATCHER_MAX_STATES (1 + MAX_TARGETS * MAX_TARGET_LEN)
+
+/*! \brief Aho-Corasick automaton over the targets of a puzzle.
+ *
+ * Each state stands for the longest suffix of the buffer that is a prefix of
+ * some target. Failure links are folded into next[], so feeding a code is a
+ * single table lookup.
+ */
+typedef struct {
+  int num_states;
+  int next[MATCHER_MAX_STATES][NUM_HEX_CODES];
+  //! Bit t: target t ends at this state.
+  uint32_t output[MATCHER_MAX_STATES];
+  //! Longest prefix of target t that is a suffix of this state's string.
+  unsigned char prefix_len[MATCHER_MAX_STATES][MAX_TARGETS];
+} TargetMatcher;
+
+#if MAX_TARGETS > 32
+#error Target masks cannot hold more than 32 targets.
+#endif
+#if MAX_GRID_SIZE > 16
+#error GridBits cannot hold more than 16 cells per row.
+#endif
+
+/*! \brief Build the automaton for the targets of a puzzle.
+ *
+ * \param m The automaton to fill in.
+ * \param p The puzzle.
+ */
+void BuildTargetMatcher(TargetMatcher *m, const BreachPuzzle *p);
+
+/*! \brief Build a puzzle deterministically, without searching.
+ *
+ * The path is a staircase (down one row, right one column) with its rows and
+ * columns shuffled, and the targets are cut out of the codes along it, so a
+ * full buffer installs all of them.
+ *
+ * \param p The puzzle to fill in.
+ * \param grid_size Matrix size, MIN_GRID_SIZE to MAX_GRID_SIZE.
+ * \param buffer_size Path length, 2 to 2 * grid_size - 1 (and at most
+ *   MAX_BUFFER_SIZE).
+ * \param num_targets Number of targets, 1 to MAX_TARGETS.
+ * \param target_len Longest target, 2 to buffer_size (and at most
+ *   MAX_TARGET_LEN).
+ * \param seed Seed for the matrix and the shuffles.
+ */
+void BuildStaircasePuzzle(BreachPuzzle *p, int grid_size, int buffer_size,
+                          int num_targets, int target_len, uint32_t seed);
+
+/*! \brief Generate a random puzzle within a time budget.
+ *
+ * Fills a random matrix and cuts the targets out of a random string of
+ * buffer_size codes, independently of the matrix. SolveBreachPuzzle then
+ * searches for a path through the matrix that installs all of them, which
+ * becomes the hack sequence; if there is none, it starts over. Falls back to
+ * BuildStaircasePuzzle when the budget runs out first.
+ *
+ * \param p The puzzle to fill in.
+ * \param grid_size As for BuildStaircasePuzzle.
+ * \param buffer_size As for BuildStaircasePuzzle.
+ * \param num_targets As for BuildStaircasePuzzle.
+ * \param target_len As for BuildStaircasePuzzle.
+ * \param seed Seed for all random choices.
+ * \param budget_usec Time budget in microseconds.
+ * \return 1 if the puzzle was generated and verified, 0 if it fell back.
+ */
+int GenerateBreachPuzzle(BreachPuzzle *p, int grid_size, int buffer_size,
+                         int num_targets, int target_len, uint32_t seed,
+                         long budget_usec);
+
+/*! \brief Search for a path that installs the wanted targets.
+ *
+ * Depth-first search over paths of buffer_size steps, using row and column
+ * bitboards for the free cells. Branches are pruned, and ordered, by the
+ * fewest codes that could still install the missing targets, which is
+ * precomputed per automaton state and set of installed targets.
+ *
+ * \param p The puzzle; its hack_sequence is ignored.
+ * \param m The automaton for the puzzle's targets.
+ * \param want_mask Bit t: target t must be installed.
+ * \param path Receives buffer_size steps if a path is found.
+ * \param budget_usec Time budget in microseconds.
+ * \return 1 if a path was found, 0 if there is none, -1 if the budget ran out.
+ */
+int SolveBreachPuzzle(const BreachPuzzle *p, const TargetMatcher *m,
+                      uint32_t want_mask, GridPos *path, long budget_usec);
+
+#endif
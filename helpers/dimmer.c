@@ -36,6 +36,7 @@ limitations under the License.
 #include "../env_settings.h"   // for GetIntSetting, GetDoubleSetting, GetSt...
 #include "../logging.h"        // for Log
 #include "../wm_properties.h"  // for SetWMProperties
+#include "../xrequest_stats.h"  // for BeginXRequestPhase, EndXRequestPhase
 
 // Get the entry of value index of the Bayer matrix for n = 2^power.
 void Bayer(int index, int power, int *x, int *y) {
@@ -309,6 +310,7 @@ int main(int argc, char **argv) {
     Log("Could not connect to $DISPLAY");
     return 1;
   }
+  InitXRequestStats(display);
   Window root_window = DefaultRootWindow(display);
 
   // Load global settings.
@@ -318,8 +320,10 @@ int main(int argc, char **argv) {
       "XSECURELOCK_DIM_FPS",
       GetDoubleSetting("XSECURELOCK_" /* REMOVE IN v2 */ "DIM_MIN_FPS", 60));
   dim_alpha = GetDoubleSetting("XSECURELOCK_DIM_ALPHA", 0.875);
+  BeginXRequestPhase(display, "HaveCompositor");
   int have_compositor = GetIntSetting(
       "XSECURELOCK_DIM_OVERRIDE_COMPOSITOR_DETECTION", HaveCompositor(display));
+  EndXRequestPhase(display);
 
   if (dim_alpha <= 0 || dim_alpha > 1) {
     Log("XSECURELOCK_DIM_ALPHA must be in ]0..1] - using default");
@@ -327,6 +331,7 @@ int main(int argc, char **argv) {
   }
 
   // Prepare the background color.
+  BeginXRequestPhase(display, "AllocColors");
   Colormap colormap = DefaultColormap(display, DefaultScreen(display));
   const char *color_name = GetStringSetting("XSECURELOCK_DIM_COLOR", "black");
   XParseColor(display, colormap, color_name, &dim_color);
@@ -338,6 +343,7 @@ int main(int argc, char **argv) {
     XQueryColor(display, colormap, &dim_color);
     Log("Could not allocate color or unknown color name: %s", color_name);
   }
+  EndXRequestPhase(display);
 
   // Set up the filter.
   struct DitherEffect dither_dimmer;
@@ -352,6 +358,7 @@ int main(int argc, char **argv) {
   }
 
   // Create a simple screen-filling window.
+  BeginXRequestPhase(display, "CreateWindow");
   int w = DisplayWidth(display, DefaultScreen(display));
   int h = DisplayHeight(display, DefaultScreen(display));
   XSetWindowAttributes dimattrs = {0};
@@ -366,6 +373,7 @@ int main(int argc, char **argv) {
   // forcing grabs.
   SetWMProperties(display, dim_window, "xsecurelock-dimmer", "dim", argc, argv);
   dimmer->PostCreateWindow(dimmer, display, dim_window);
+  EndXRequestPhase(display);
 
   // Precalculate the sleep time per step.
   unsigned long long sleep_time_ns =
@@ -376,7 +384,9 @@ int main(int argc, char **argv) {
   XMapRaised(display, dim_window);
   for (int i = 0; i < dimmer->frame_count; ++i) {
     // Advance the dim pattern by one step.
+    BeginXRequestPhase(display, "DrawFrame");
     dimmer->DrawFrame(dimmer, display, dim_window, i, w, h);
+    EndXRequestPhase(display);
     // Sleep a while. Yes, even at the end now - we want the user to see this
     // after all.
     nanosleep(&sleep_ts, NULL);
@@ -21,13 +21,15 @@ limitations under the License.
 #include <stdlib.h>      // for setenv
 #include <string.h>      // for memcmp, memcpy
 #include <sys/select.h>  // for select, FD_SET, FD_ZERO, fd_set
+#include <sys/time.h>    // for timeval
 #include <unistd.h>      // for sleep
 
 #include "../env_settings.h"      // for GetStringSetting
 #include "../logging.h"           // for Log, LogErrno
-#include "../saver_child.h"       // for MAX_SAVERS
+#include "../saver_child.h"       // for MAX_SAVERS, WatchSaverChild, Sa...
 #include "../wait_pgrp.h"         // for InitWaitPgrp
 #include "../wm_properties.h"     // for SetWMProperties
+#include "../xrequest_stats.h"    // for BeginXRequestPhase, EndXRequestPhase
 #include "../xscreensaver_api.h"  // for ReadWindowID
 #include "monitors.h"             // for IsMonitorChangeEvent, Monitor, Sele...
 
@@ -97,6 +99,7 @@ int main(int argc, char** argv) {
     Log("Could not connect to $DISPLAY");
     return 1;
   }
+  InitXRequestStats(display);
   int x11_fd = ConnectionNumber(display);
 
   Window parent = ReadWindowID();
@@ -108,10 +111,14 @@ int main(int argc, char** argv) {
   saver_executable =
       GetExecutablePathSetting("XSECURELOCK_SAVER", SAVER_EXECUTABLE, 0);
 
+  BeginXRequestPhase(display, "GetMonitors");
   SelectMonitorChangeEvents(display, parent);
   num_monitors = GetMonitors(display, parent, monitors, MAX_MONITORS);
+  EndXRequestPhase(display);
 
+  BeginXRequestPhase(display, "SpawnSavers");
   SpawnSavers(parent, argc, argv);
+  EndXRequestPhase(display);
 
   struct sigaction sa;
   sigemptyset(&sa.sa_mask);
@@ -132,14 +139,19 @@ int main(int argc, char** argv) {
     fd_set in_fds;
     FD_ZERO(&in_fds);
     FD_SET(x11_fd, &in_fds);
-    select(x11_fd + 1, &in_fds, 0, 0, NULL);
+    // Wake up in time to restart savers that exited.
+    int timeout_ms = SaverChildRestartTimeoutMs();
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    select(x11_fd + 1, &in_fds, 0, 0, timeout_ms < 0 ? NULL : &timeout);
     WatchSavers();
     XEvent ev;
     while (XPending(display) && (XNextEvent(display, &ev), 1)) {
       if (IsMonitorChangeEvent(display, ev.type)) {
         Monitor new_monitors[MAX_SAVERS];
+        BeginXRequestPhase(display, "GetMonitors");
         size_t new_num_monitors =
             GetMonitors(display, parent, new_monitors, MAX_SAVERS);
+        EndXRequestPhase(display);
         if (new_num_monitors != num_monitors ||
             memcmp(new_monitors, monitors, sizeof(monitors)) != 0) {
           KillSavers();
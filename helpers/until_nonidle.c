@@ -34,7 +34,7 @@ limitations under the License.
 #include <string.h>    // for memcpy, NULL, strcmp, strcspn
 #include <sys/time.h>  // for gettimeofday, timeval
 #include <time.h>      // for nanosleep, timespec
-#include <unistd.h>    // for _exit, execvp, fork, setsid
+#include <unistd.h>    // for pid_t
 
 #ifdef HAVE_XSCREENSAVER_EXT
 #include <X11/extensions/scrnsaver.h>  // for XScreenSaverAllocInfo, XScreen...
@@ -47,7 +47,8 @@ limitations under the License.
 
 #include "../env_settings.h"  // for GetIntSetting, GetStringSetting
 #include "../logging.h"       // for Log, LogErrno
-#include "../wait_pgrp.h"     // for KillPgrp, WaitPgrp
+#include "../wait_pgrp.h"     // for KillPgrp, WaitPgrp, SpawnProcess
+#include "../xrequest_stats.h"  // for BeginXRequestPhase, EndXRequestPhase
 
 #ifdef HAVE_XSCREENSAVER_EXT
 int have_xscreensaver_ext;
@@ -151,9 +152,11 @@ int main(int argc, char **argv) {
     Log("Could not connect to $DISPLAY.");
     return 1;
   }
+  InitXRequestStats(display);
   Window root_window = DefaultRootWindow(display);
 
   // Initialize the extensions.
+  BeginXRequestPhase(display, "InitExtensions");
 #ifdef HAVE_XSCREENSAVER_EXT
   have_xscreensaver_ext = 0;
   int scrnsaver_event_base, scrnsaver_error_base;
@@ -171,6 +174,7 @@ int main(int argc, char **argv) {
     xsync_counters = XSyncListSystemCounters(display, &num_xsync_counters);
   }
 #endif
+  EndXRequestPhase(display);
 
   // Capture the initial idle time.
   uint64_t prev_idle = GetIdleTime(display, root_window, timers);
@@ -180,18 +184,12 @@ int main(int argc, char **argv) {
   }
 
   // Start the subprocess.
-  childpid = ForkWithoutSigHandlers();
+  childpid = SpawnProcess(argv[1], (const char *const *)argv + 1, NULL, -1, -1,
+                          SPAWN_NEW_PGRP | SPAWN_SEARCH_PATH);
   if (childpid == -1) {
-    LogErrno("fork");
+    LogErrno("spawn %s", argv[1]);
     return 1;
   }
-  if (childpid == 0) {
-    // Child process.
-    StartPgrp();
-    execvp(argv[1], argv + 1);
-    LogErrno("execvp");
-    _exit(EXIT_FAILURE);
-  }
 
   // Parent process.
   struct sigaction sa;
@@ -210,7 +208,9 @@ int main(int argc, char **argv) {
   while (childpid != 0) {
     nanosleep(&(const struct timespec){0, 10000000L}, NULL);  // 10ms.
 
+    BeginXRequestPhase(display, "GetIdleTime");
     uint64_t cur_idle = GetIdleTime(display, root_window, timers);
+    EndXRequestPhase(display);
     still_idle = cur_idle >= prev_idle;
     prev_idle = cur_idle;
 
@@ -0,0 +1,319 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "xkb_state.h"
+
+#include <X11/X.h>     // for None, LockMask, ShiftMask, ...
+#include <X11/Xlib.h>  // for XFree, XGetAtomName, Display
+#include <string.h>    // for memcpy, strlen
+
+#ifdef HAVE_XKB_EXT
+#include <X11/XKBlib.h>             // for XkbEvent, XkbGetNames, XkbSelect...
+#include <X11/extensions/XKB.h>     // for XkbUseCoreKbd, XkbStateNotify, ...
+#include <X11/extensions/XKBstr.h>  // for _XkbDesc, XkbStateRec, _XkbControls
+#endif
+
+#include "../logging.h"  // for Log
+
+#ifdef HAVE_XKB_EXT
+static Display* initialized_for = NULL;
+static int event_base;
+static int show_layout;
+static int show_locks;
+
+//! Keyboard description holding the controls and names we care about.
+static XkbDescPtr xkb = NULL;
+
+//! The parts of the keyboard state we display.
+static int group;
+static unsigned int implicit_mods;
+static unsigned int istate;
+
+//! Names resolved from the atoms in xkb->names; NULL if unset.
+static char* group_names[XkbNumKbdGroups];
+static char* symbols_name;
+static char* indicator_names[XkbNumIndicators];
+
+//! The cached display string and flags derived from the state above.
+static char buf[128];
+static int have_output;
+static int caps_warning;
+static int multiple_layouts;
+
+static void FreeName(char** name) {
+  if (*name != NULL) {
+    XFree(*name);
+    *name = NULL;
+  }
+}
+
+static void ResolveName(Display* dpy, Atom a, char** name) {
+  FreeName(name);
+  if (a != None) {
+    *name = XGetAtomName(dpy, a);
+  }
+}
+
+/*! \brief Re-fetch names; the only place where atom names are resolved.
+ */
+static int RefreshNames(Display* dpy) {
+  if (XkbGetNames(
+          dpy, XkbIndicatorNamesMask | XkbGroupNamesMask | XkbSymbolsNameMask,
+          xkb) != Success) {
+    Log("XkbGetNames failed");
+    return 0;
+  }
+  for (int i = 0; i < XkbNumKbdGroups; i++) {
+    ResolveName(dpy, xkb->names->groups[i], &group_names[i]);
+  }
+  ResolveName(dpy, xkb->names->symbols, &symbols_name);
+  for (int i = 0; i < XkbNumIndicators; i++) {
+    ResolveName(dpy, xkb->names->indicators[i], &indicator_names[i]);
+  }
+  return 1;
+}
+
+static int RefreshControls(Display* dpy) {
+  if (XkbGetControls(dpy, XkbGroupsWrapMask, xkb) != Success) {
+    Log("XkbGetControls failed");
+    return 0;
+  }
+  return 1;
+}
+
+static int RefreshState(Display* dpy) {
+  XkbStateRec state;
+  if (XkbGetState(dpy, XkbUseCoreKbd, &state) != Success) {
+    Log("XkbGetState failed");
+    return 0;
+  }
+  group = state.group;
+  implicit_mods = state.latched_mods | state.locked_mods;
+  if (XkbGetIndicatorState(dpy, XkbUseCoreKbd, &istate) != Success) {
+    Log("XkbGetIndicatorState failed");
+    return 0;
+  }
+  return 1;
+}
+
+/*! \brief Appends a string to buf.
+ *
+ * \return 1 if it fit, 0 if buf is full; then nothing is appended.
+ */
+static int Append(char** p, const char* s) {
+  size_t n = strlen(s);
+  if (n >= sizeof(buf) - (*p - buf)) {
+    Log("Not enough space to store '%s'", s);
+    return 0;
+  }
+  memcpy(*p, s, n);
+  *p += n;
+  return 1;
+}
+
+/*! \brief Appends a modifier or indicator name to buf, separated by ", ".
+ *
+ * \return 1 if it fit, 0 if buf is full; then no more items should follow.
+ */
+static int AppendItem(char** p, const char* s) {
+  if (have_output && !Append(p, ", ")) {
+    return 0;
+  }
+  if (!Append(p, s)) {
+    return 0;
+  }
+  have_output = 1;
+  return 1;
+}
+
+/*! \brief Rebuild buf from the cached state. Does not talk to the server.
+ */
+static void RebuildString(void) {
+  char* p = buf;
+  have_output = 0;
+  caps_warning = (implicit_mods & LockMask) != 0;
+  multiple_layouts = xkb->ctrls->num_groups > 1;
+
+  if (!Append(&p, "Keyboard: ")) {
+    *p = 0;
+    return;
+  }
+
+  if (show_layout) {
+    const char* layout = NULL;
+    if (group >= 0 && group < XkbNumKbdGroups) {
+      layout = group_names[group];
+    }
+    if (layout == NULL) {
+      layout = symbols_name;
+    }
+    if (layout != NULL) {
+      if (!Append(&p, layout)) {
+        *p = 0;
+        return;
+      }
+      have_output = 1;
+    }
+  }
+
+  if (show_locks) {
+    static const struct {
+      unsigned int mask;
+      const char* name;
+    } mods[] = {
+        {ShiftMask, "Shift"}, {LockMask, "Lock"}, {ControlMask, "Control"},
+        {Mod1Mask, "Mod1"},   {Mod2Mask, "Mod2"}, {Mod3Mask, "Mod3"},
+        {Mod4Mask, "Mod4"},   {Mod5Mask, "Mod5"},
+    };
+    for (size_t i = 0; i < sizeof(mods) / sizeof(*mods); i++) {
+      if ((implicit_mods & mods[i].mask) && !AppendItem(&p, mods[i].name)) {
+        break;
+      }
+    }
+  } else {
+    for (int i = 0; i < XkbNumIndicators; i++) {
+      if ((istate & (1U << i)) && indicator_names[i] != NULL &&
+          !AppendItem(&p, indicator_names[i])) {
+        break;
+      }
+    }
+  }
+  *p = 0;
+}
+#endif
+
+int InitXkbState(Display* dpy, int show_keyboard_layout,
+                 int show_locks_and_latches) {
+#ifdef HAVE_XKB_EXT
+  int opcode, error_base;
+  int major = XkbMajorVersion, minor = XkbMinorVersion;
+  if (!XkbQueryExtension(dpy, &opcode, &event_base, &error_base, &major,
+                         &minor)) {
+    return 0;
+  }
+  show_layout = show_keyboard_layout;
+  show_locks = show_locks_and_latches;
+
+  xkb = XkbGetMap(dpy, 0, XkbUseCoreKbd);
+  if (xkb == NULL) {
+    Log("XkbGetMap failed");
+    return 0;
+  }
+  if (!RefreshControls(dpy) || !RefreshNames(dpy) || !RefreshState(dpy)) {
+    XkbFreeKeyboard(xkb, 0, True);
+    xkb = NULL;
+    return 0;
+  }
+
+  // Only the locked/latched parts of the state matter; selecting all state
+  // changes would wake us up for every Shift press.
+  XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbStateNotify,
+                        XkbAllStateComponentsMask,
+                        XkbGroupStateMask | XkbModifierLatchMask |
+                            XkbModifierLockMask);
+  XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbNamesNotify,
+                        XkbAllNamesMask,
+                        XkbIndicatorNamesMask | XkbGroupNamesMask |
+                            XkbSymbolsNameMask);
+  XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbIndicatorStateNotify,
+                        XkbAllIndicatorsMask, XkbAllIndicatorsMask);
+  XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbControlsNotify,
+                        XkbAllControlsMask, XkbGroupsWrapMask);
+  XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbNewKeyboardNotify,
+                        XkbAllNewKeyboardEventsMask,
+                        XkbAllNewKeyboardEventsMask);
+
+  initialized_for = dpy;
+  RebuildString();
+  return 1;
+#else
+  (void)dpy;
+  (void)show_keyboard_layout;
+  (void)show_locks_and_latches;
+  return 0;
+#endif
+}
+
+int HandleXkbStateEvent(Display* dpy, const XEvent* ev) {
+#ifdef HAVE_XKB_EXT
+  if (dpy != initialized_for || ev->type != event_base) {
+    return 0;
+  }
+  const XkbEvent* xev = (const XkbEvent*)ev;
+  switch (xev->any.xkb_type) {
+    case XkbStateNotify:
+      group = xev->state.group;
+      implicit_mods = xev->state.latched_mods | xev->state.locked_mods;
+      break;
+    case XkbIndicatorStateNotify:
+      istate = xev->indicators.state;
+      break;
+    case XkbNamesNotify:
+      RefreshNames(dpy);
+      break;
+    case XkbControlsNotify:
+      RefreshControls(dpy);
+      break;
+    case XkbNewKeyboardNotify:
+      RefreshControls(dpy);
+      RefreshNames(dpy);
+      RefreshState(dpy);
+      break;
+    default:
+      return 0;
+  }
+  RebuildString();
+  return 1;
+#else
+  (void)dpy;
+  (void)ev;
+  return 0;
+#endif
+}
+
+const char* GetXkbIndicators(int* warning, int* have_multiple_layouts) {
+#ifdef HAVE_XKB_EXT
+  if (initialized_for == NULL) {
+    return "";
+  }
+  if (caps_warning) {
+    *warning = 1;
+  }
+  if (multiple_layouts) {
+    *have_multiple_layouts = 1;
+  }
+  return have_output ? buf : "";
+#else
+  (void)warning;
+  (void)have_multiple_layouts;
+  return "";
+#endif
+}
+
+void SwitchXkbGroup(Display* dpy) {
+#ifdef HAVE_XKB_EXT
+  if (dpy != initialized_for) {
+    return;
+  }
+  if (xkb->ctrls->num_groups < 1) {
+    Log("XkbGetControls returned less than 1 group");
+    return;
+  }
+  XkbLockGroup(dpy, XkbUseCoreKbd, (group + 1) % xkb->ctrls->num_groups);
+#else
+  (void)dpy;
+#endif
+}
@@ -0,0 +1,60 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef XKB_STATE_H
+#define XKB_STATE_H
+
+#include <X11/Xlib.h>  // for Display, XEvent
+
+/*! \brief Start tracking the keyboard layout and indicator state.
+ *
+ * Subscribes to Xkb state, names, indicator and controls notifications and
+ * fetches the initial state. After this, the state is only re-queried when the
+ * server says it changed.
+ *
+ * \param dpy The current display.
+ * \param show_keyboard_layout Whether to include the layout name.
+ * \param show_locks_and_latches Whether to show locked and latched modifiers
+ *   instead of the keyboard indicators.
+ * \return 1 if Xkb is available and tracking started, 0 otherwise.
+ */
+int InitXkbState(Display* dpy, int show_keyboard_layout,
+                 int show_locks_and_latches);
+
+/*! \brief Update the cached state from an Xkb event.
+ *
+ * \param dpy The current display.
+ * \param ev The received event.
+ * \return 1 if the event was an Xkb event that changed the cached state (so
+ *   the caller should redraw), 0 otherwise.
+ */
+int HandleXkbStateEvent(Display* dpy, const XEvent* ev);
+
+/*! \brief Return the cached "Keyboard: layout, indicators" string.
+ *
+ * Costs no round trips.
+ *
+ * \param warning Set to 1 if Caps Lock is on.
+ * \param have_multiple_layouts Set to 1 if more than one layout is configured.
+ * \return The string, or "" if there is nothing to show.
+ */
+const char* GetXkbIndicators(int* warning, int* have_multiple_layouts);
+
+/*! \brief Lock the next keyboard layout group.
+ */
+void SwitchXkbGroup(Display* dpy);
+
+#endif
@@ -28,16 +28,17 @@ limitations under the License.
 #include <X11/Xutil.h>       // for XLookupString
 #include <X11/cursorfont.h>  // for XC_arrow
 #include <X11/keysym.h>      // for XK_BackSpace, XK_Tab, XK_o
+#include <errno.h>           // for errno, EINTR
 #include <fcntl.h>           // for fcntl, FD_CLOEXEC, F_GETFD
 #include <locale.h>          // for NULL, setlocale, LC_CTYPE
+#include <poll.h>            // for poll, pollfd, POLLIN
 #include <signal.h>          // for sigaction, raise, sa_handler
 #include <stdio.h>           // for printf, size_t, snprintf
 #include <stdlib.h>          // for exit, system, EXIT_FAILURE
-#include <string.h>          // for memset, strcmp, strncmp
-#include <sys/select.h>      // for select, timeval, fd_set, FD_SET
-#include <sys/time.h>        // for gettimeofday
+#include <string.h>          // for strcmp, strncmp
+#include <sys/time.h>        // for gettimeofday, timeval
 #include <time.h>            // for nanosleep, timespec
-#include <unistd.h>          // for _exit, chdir, close, execvp
+#include <unistd.h>          // for chdir, close, pipe, read, write
 
 #ifdef HAVE_DPMS_EXT
 #include <X11/Xmd.h>  // for BOOL, CARD16
@@ -66,21 +67,25 @@ limitations under the License.
 #include "logging.h"        // for Log, LogErrno
 #include "mlock_page.h"     // for MLOCK_PAGE
 #include "saver_child.h"    // for WatchSaverChild, KillAllSaver...
+#include "trace.h"          // for TRACE_BEGIN, TRACE_END, TraceInit
 #include "unmap_all.h"      // for ClearUnmapAllWindowsState
 #include "util.h"           // for explicit_bzero
 #include "version.h"        // for git_version
 #include "wait_pgrp.h"      // for WaitPgrp
 #include "wm_properties.h"  // for SetWMProperties
+#include "xrequest_stats.h"  // for BeginXRequestPhase, EndXRequestPhase
 
-/*! \brief How often (in times per second) to watch child processes.
+/*! \brief How often (in times per second) to retry things that failed.
  *
- * This defines the minimum frequency to call WatchChildren().
+ * Otherwise the main loop sleeps until an X11 event, a signal (including
+ * SIGCHLD from a child process) or the blank timer wakes it up. Things that
+ * need polling, such as reacquiring lost grabs, are retried this often.
  */
-#define WATCH_CHILDREN_HZ 10
+#define RETRY_HZ 10
 
 /*! \brief Try to reinstate grabs in regular intervals.
  *
- * This will reinstate the grabs WATCH_CHILDREN_HZ times per second. This
+ * This will reinstate the grabs RETRY_HZ times per second. This
  * appears to be required with some XScreenSaver hacks that cause XSecureLock to
  * lose MotionNotify events, but nothing else.
  */
@@ -172,6 +177,9 @@ int must_disable_dpms = 0;
 //! If set by signal handler we should wake up and prompt for auth.
 static volatile sig_atomic_t signal_wakeup = 0;
 
+//! Pipe that signal handlers write to in order to wake up the main loop.
+static int main_loop_wakeup_fds[2] = {-1, -1};
+
 void ResetBlankScreenTimer(void) {
   if (blank_timeout < 0) {
     return;
@@ -260,6 +268,61 @@ void UnblankScreen(Display *display) {
   ResetBlankScreenTimer();
 }
 
+/*! \brief Returns the time in ms until the screen should be blanked.
+ *
+ * \return The time until MaybeBlankScreen() has to be called, or -1 if it
+ *   needs not be.
+ */
+int TimeToBlankScreenMs(void) {
+  if (blank_timeout < 0 || blanked) {
+    return -1;
+  }
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  long ms = (time_to_blank.tv_sec - now.tv_sec) * 1000L +
+            (time_to_blank.tv_usec - now.tv_usec + 999) / 1000;
+  return ms < 0 ? 0 : (int)ms;
+}
+
+/*! \brief Wakes up the main loop. Async signal safe.
+ */
+static void WakeUpMainLoop(void) {
+  int saved_errno = errno;
+  // If the pipe is full, the main loop is going to wake up anyway.
+  if (write(main_loop_wakeup_fds[1], "", 1) < 0) {
+    // Nothing to do.
+  }
+  errno = saved_errno;
+}
+
+/*! \brief Creates the pipe that WakeUpMainLoop() writes to.
+ *
+ * \return Zero if and only if successful.
+ */
+static int InitMainLoopWakeup(void) {
+  if (pipe(main_loop_wakeup_fds) != 0) {
+    LogErrno("pipe");
+    return -1;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (fcntl(main_loop_wakeup_fds[i], F_SETFD, FD_CLOEXEC) != 0 ||
+        fcntl(main_loop_wakeup_fds[i], F_SETFL, O_NONBLOCK) != 0) {
+      LogErrno("fcntl");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*! \brief Consumes all pending main loop wakeups.
+ */
+static void DrainMainLoopWakeup(void) {
+  char buf[64];
+  while (read(main_loop_wakeup_fds[0], buf, sizeof(buf)) > 0) {
+    // Just discard.
+  }
+}
+
 static void HandleSIGTERM(int signo) {
   KillAllSaverChildrenSigHandler(signo);  // Dirty, but quick.
   KillAuthChildSigHandler(signo);         // More dirty.
@@ -270,6 +333,14 @@ static void HandleSIGTERM(int signo) {
 static void HandleSIGUSR2(int unused_signo) {
   (void)unused_signo;
   signal_wakeup = 1;
+  TraceRequestDump();
+  WakeUpMainLoop();
+}
+
+static void HandleSIGCHLD(int unused_signo) {
+  (void)unused_signo;
+  // WatchChildren() will find out which one.
+  WakeUpMainLoop();
 }
 
 enum WatchChildrenState {
@@ -326,6 +397,8 @@ int WatchChildren(Display *dpy, Window auth_win, Window saver_win,
         KillAllSaverChildrenSigHandler(SIGUSR1);
       }
     }
+  } else {
+    WatchStandbyAuthChild(auth_win, auth_executable);
   }
 
   // Show the screen saver.
@@ -646,17 +719,23 @@ int AcquireGrabs(Display *display, Window root_window, Window *ignored_windows,
   grab_state.cursor = cursor;
   grab_state.silent = silent;
 
+  BeginXRequestPhase(display, "AcquireGrabs");
   if (!force) {
     // Easy case.
-    return TryAcquireGrabs(None, &grab_state);
+    int ok = TryAcquireGrabs(None, &grab_state);
+    EndXRequestPhase(display);
+    return ok;
   }
 
   XGrabServer(display);  // Critical section.
   UnmapAllWindowsState unmap_state;
   int ok;
-  if (InitUnmapAllWindowsState(&unmap_state, display, root_window,
-                               ignored_windows, n_ignored_windows,
-                               "xsecurelock", NULL, force > 1)) {
+  BeginXRequestPhase(display, "InitUnmapAllWindowsState");
+  int have_unmap_state = InitUnmapAllWindowsState(
+      &unmap_state, display, root_window, ignored_windows, n_ignored_windows,
+      "xsecurelock", NULL, force > 1);
+  EndXRequestPhase(display);
+  if (have_unmap_state) {
     Log("Trying to force grabbing by unmapping all windows. BAD HACK");
     ok = UnmapAllWindows(&unmap_state, TryAcquireGrabs, &grab_state);
     RemapAllWindows(&unmap_state);
@@ -671,6 +750,7 @@ int AcquireGrabs(Display *display, Window root_window, Window *ignored_windows,
   // grabbed for as long as needed, and to make absolutely sure that
   // remapping did happen.
   XFlush(display);
+  EndXRequestPhase(display);
 
   return ok;
 }
@@ -689,16 +769,13 @@ void NotifyOfLock(int xss_sleep_lock_fd) {
     }
   }
   if (notify_command != NULL && *notify_command != NULL) {
-    pid_t pid = ForkWithoutSigHandlers();
+    pid_t pid = SpawnProcess(notify_command[0],
+                             (const char *const *)notify_command, NULL, -1, -1,
+                             SPAWN_SEARCH_PATH);
     if (pid == -1) {
-      LogErrno("fork");
-    } else if (pid == 0) {
-      // Child process.
-      execvp(notify_command[0], notify_command);
-      LogErrno("execvp");
-      _exit(EXIT_FAILURE);
+      LogErrno("spawn %s", notify_command[0]);
     } else {
-      // Parent process after successful fork.
+      // Parent process after successful spawn.
       notify_command_pid = pid;
     }
   }
@@ -753,6 +830,7 @@ int CheckLockingEffectiveness() {
  */
 int main(int argc, char **argv) {
   setlocale(LC_CTYPE, "");
+  TraceInit("xsecurelock");
 
   int xss_sleep_lock_fd = GetIntSetting("XSS_SLEEP_LOCK_FD", -1);
   if (xss_sleep_lock_fd != -1) {
@@ -804,6 +882,7 @@ int main(int argc, char **argv) {
     Log("Could not connect to $DISPLAY");
     return 1;
   }
+  InitXRequestStats(display);
 
   // TODO(divVerent): Support that?
   if (ScreenCount(display) != 1) {
@@ -829,6 +908,7 @@ int main(int argc, char **argv) {
 #endif
 
   // Prepare some nice window attributes for a screen saver window.
+  BeginXRequestPhase(display, "AllocColors");
   XColor black;
   black.pixel = BlackPixel(display, DefaultScreen(display));
   XQueryColor(display, DefaultColormap(display, DefaultScreen(display)),
@@ -844,6 +924,7 @@ int main(int argc, char **argv) {
   if (status != XcmsFailure) {
     background_pixel = xcolor_background.pixel;
   }
+  EndXRequestPhase(display);
 
   Pixmap bg = XCreateBitmapFromData(display, root_window, "\0", 1, 1);
   Cursor default_cursor = XCreateFontCursor(display, XC_arrow);
@@ -995,6 +1076,7 @@ int main(int argc, char **argv) {
 #endif
 
   // Initialize XInput so we can get multibyte key events.
+  BeginXRequestPhase(display, "XOpenIM");
   XIM xim = XOpenIM(display, NULL, NULL, NULL);
   if (xim == NULL) {
     Log("XOpenIM failed. Assuming Latin-1 encoding");
@@ -1024,6 +1106,7 @@ int main(int argc, char **argv) {
       Log("XCreateIC failed. Assuming Latin-1 encoding");
     }
   }
+  EndXRequestPhase(display);
 
 #ifdef HAVE_XSCREENSAVER_EXT
   // If we support the screen saver extension, that'd be good.
@@ -1082,6 +1165,10 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  if (InitMainLoopWakeup() != 0) {
+    return EXIT_FAILURE;
+  }
+
   struct sigaction sa;
   sigemptyset(&sa.sa_mask);
   sa.sa_flags = 0;
@@ -1100,6 +1187,11 @@ int main(int argc, char **argv) {
   }
 
   InitWaitPgrp();
+  sa.sa_flags = 0;
+  sa.sa_handler = HandleSIGCHLD;  // Replaces InitWaitPgrp's to also wake up.
+  if (sigaction(SIGCHLD, &sa, NULL) != 0) {
+    LogErrno("sigaction(SIGCHLD)");
+  }
 
   // Need to flush the display so savers sure can access the window.
   XFlush(display);
@@ -1161,28 +1253,51 @@ int main(int argc, char **argv) {
   int background_window_mapped = 0, background_window_visible = 0,
       auth_window_mapped = 0, saver_window_mapped = 0,
       need_to_reinstate_grabs = 0, xss_lock_notified = 0;
+  enum WatchChildrenState watched_saver_state = xss_requested_saver_state;
   for (;;) {
-    // Watch children WATCH_CHILDREN_HZ times per second.
-    fd_set in_fds;
-    memset(&in_fds, 0, sizeof(in_fds));  // For clang-analyzer.
-    FD_ZERO(&in_fds);
-    FD_SET(x11_fd, &in_fds);
-    struct timeval tv;
-    tv.tv_usec = 1000000 / WATCH_CHILDREN_HZ;
-    tv.tv_sec = 0;
-    select(x11_fd + 1, &in_fds, 0, 0, &tv);
-
     // Make sure to shut down the saver when blanked. Saves power.
     enum WatchChildrenState requested_saver_state =
       (saver_stop_on_blank && blanked) ? WATCH_CHILDREN_SAVER_DISABLED : xss_requested_saver_state;
 
+    // Sleep until something happens that we need to act on. Events that
+    // changed the requested saver state need to be acted on right away.
+    int timeout_ms = TimeToBlankScreenMs();
+#if defined(ALWAYS_REINSTATE_GRABS) || defined(AUTO_RAISE)
+    int poll_periodically = 1;
+#else
+    int poll_periodically = need_to_reinstate_grabs;
+#endif
+    if (poll_periodically &&
+        (timeout_ms < 0 || timeout_ms > 1000 / RETRY_HZ)) {
+      timeout_ms = 1000 / RETRY_HZ;
+    }
+    int restart_ms = SaverChildRestartTimeoutMs();
+    if (restart_ms >= 0 && (timeout_ms < 0 || timeout_ms > restart_ms)) {
+      timeout_ms = restart_ms;
+    }
+    if (requested_saver_state != watched_saver_state ||
+        XEventsQueued(display, QueuedAfterFlush) > 0) {
+      timeout_ms = 0;
+    }
+    struct pollfd fds[2];
+    fds[0].fd = x11_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = main_loop_wakeup_fds[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR) {
+      LogErrno("poll");
+    }
+    DrainMainLoopWakeup();
+
     // Now check status of our children.
+    watched_saver_state = requested_saver_state;
     if (WatchChildren(display, auth_window, saver_window, requested_saver_state,
                       NULL)) {
       goto done;
     }
 
-    // If something changed our cursor, change it back.
+    // If something changed our cursor, change it back. Any pointer motion
+    // wakes us up, so this happens before the cursor can be seen.
     XUndefineCursor(display, saver_window);
 
 #ifdef ALWAYS_REINSTATE_GRABS
@@ -1336,6 +1451,7 @@ int main(int argc, char **argv) {
           }
           break;
         case KeyPress: {
+          TRACE_BEGIN("KeyPress");
           // Keyboard events launch the auth child.
           ScreenNoLongerBlanked(display);
           Status status = XLookupNone;
@@ -1429,6 +1545,7 @@ int main(int argc, char **argv) {
                          : 0;
           // Clear out keypress data immediately.
           explicit_bzero(&priv, sizeof(priv));
+          TRACE_END();
           if (authenticated) {
             goto done;
           }
@@ -17,16 +17,42 @@ limitations under the License.
 #include "saver_child.h"
 
 #include <signal.h>  // for sigemptyset, sigprocmask, SIG_SETMASK
-#include <stdlib.h>  // for NULL, EXIT_FAILURE
-#include <unistd.h>  // for pid_t, _exit, execl, fork, setsid, sleep
+#include <stdlib.h>  // for NULL
+#include <time.h>    // for clock_gettime, CLOCK_MONOTONIC, timespec
+#include <unistd.h>  // for pid_t
 
 #include "logging.h"           // for LogErrno, Log
-#include "wait_pgrp.h"         // for KillPgrp, WaitPgrp
+#include "wait_pgrp.h"         // for KillPgrp, WaitPgrp, SpawnProcess
 #include "xscreensaver_api.h"  // for ExportWindowID and ExportSaverIndex
 
+/*! \brief How long to wait before restarting a saver child that exited.
+ *
+ * Keeps a saver that exits right away from being restarted in a tight loop;
+ * this is as often as the main loop used to poll for it.
+ */
+#define SAVER_RESTART_DELAY_MS 100
+
+/*! \brief How long to wait before trying again if a saver child could not be
+ * started at all.
+ *
+ * Matches the sleep in a child that failed to exec, which posix_spawn does not
+ * have; this keeps a missing saver from flooding the log.
+ */
+#define SAVER_SPAWN_FAILURE_DELAY_MS 2000
+
 //! The PIDs of currently running saver children, or 0 if not running.
 static pid_t saver_child_pid[MAX_SAVERS] = {0};
 
+//! The NowMs() before which a saver child must not be started again.
+static long saver_child_not_before[MAX_SAVERS] = {0};
+
+//! Returns the time on the monotonic clock, in milliseconds.
+static long NowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
 void KillAllSaverChildrenSigHandler(int signo) {
   // This is a signal handler, so we're not going to make this too
   // complicated. Just kill 'em all.
@@ -54,31 +80,45 @@ void WatchSaverChild(Display* dpy, Window w, int index, const char* executable,
                  !should_be_running, &status)) {
       // Now is the time to remove anything the child may have displayed.
       XClearWindow(dpy, w);
+      if (should_be_running) {
+        // It exited on its own; don't restart it right away.
+        saver_child_not_before[index] = NowMs() + SAVER_RESTART_DELAY_MS;
+      }
     }
   }
 
-  if (should_be_running && saver_child_pid[index] == 0) {
-    pid_t pid = ForkWithoutSigHandlers();
+  if (should_be_running && saver_child_pid[index] == 0 &&
+      NowMs() >= saver_child_not_before[index]) {
+    char window_id_env[EXPORT_ENV_SIZE], saver_index_env[EXPORT_ENV_SIZE];
+    ExportWindowID(w, window_id_env);
+    ExportSaverIndex(index, saver_index_env);
+    const char* env[3] = {window_id_env, saver_index_env, NULL};
+    const char* args[3] = {
+        executable,
+        "-root",  // For XScreenSaver hacks, unused by our own.
+        NULL};
+    pid_t pid = SpawnProcess(executable, args, env, -1, -1, SPAWN_NEW_PGRP);
     if (pid == -1) {
-      LogErrno("fork");
-    } else if (pid == 0) {
-      // Child process.
-      StartPgrp();
-      ExportWindowID(w);
-      ExportSaverIndex(index);
-
-      {
-        const char* args[3] = {
-            executable,
-            "-root",  // For XScreenSaver hacks, unused by our own.
-            NULL};
-        ExecvHelper(executable, args);
-        sleep(2);  // Reduce log spam or other effects from failed execv.
-        _exit(EXIT_FAILURE);
-      }
+      LogErrno("spawn %s", executable);
+      saver_child_not_before[index] = NowMs() + SAVER_SPAWN_FAILURE_DELAY_MS;
     } else {
-      // Parent process after successful fork.
+      // Parent process after successful spawn.
       saver_child_pid[index] = pid;
     }
   }
 }
+
+int SaverChildRestartTimeoutMs(void) {
+  long now = NowMs();
+  int timeout_ms = -1;
+  for (int i = 0; i < MAX_SAVERS; ++i) {
+    if (saver_child_pid[i] != 0 || saver_child_not_before[i] <= now) {
+      continue;
+    }
+    int ms = (int)(saver_child_not_before[i] - now);
+    if (timeout_ms < 0 || ms < timeout_ms) {
+      timeout_ms = ms;
+    }
+  }
+  return timeout_ms;
+}
@@ -42,4 +42,14 @@ void KillAllSaverChildrenSigHandler(int signo);
 void WatchSaverChild(Display* dpy, Window w, int index, const char* executable,
                      int should_be_running);
 
+/*! \brief Returns how long until a saver child may be restarted.
+ *
+ * A saver child that exited, or could not be started, is only restarted after
+ * a delay; the main loop must call WatchSaverChild() again by then.
+ *
+ * \return The time in ms until the next saver child may be restarted, or -1
+ *   if none is waiting for that.
+ */
+int SaverChildRestartTimeoutMs(void);
+
 #endif
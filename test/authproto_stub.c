@@ -0,0 +1,50 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief Stand-in authproto module for benchmarks.
+ *
+ * Asks for a password once and succeeds if it matches
+ * XSECURELOCK_STUB_PASSWORD, or if that is unset, on any password. Does not
+ * touch PAM or any password database, so it adds no latency of its own.
+ *
+ * Usage: XSECURELOCK_AUTHPROTO=/path/to/authproto_stub auth_x11_grid
+ */
+
+#include <stdlib.h>  // for getenv, free
+#include <string.h>  // for strcmp, strlen
+
+#include "../helpers/authproto.h"  // for WritePacket, ReadPacket, PTYPE_*
+#include "../util.h"               // for explicit_bzero
+
+int main() {
+  WritePacket(1, PTYPE_PROMPT_LIKE_PASSWORD, "Password:");
+  char *response;
+  char type = ReadPacket(0, &response, 1);
+  if (type == 0) {
+    return 1;
+  }
+  const char *want = getenv("XSECURELOCK_STUB_PASSWORD");
+  int ok = type == PTYPE_RESPONSE_LIKE_PASSWORD &&
+           (want == NULL || !strcmp(response, want));
+  explicit_bzero(response, strlen(response));
+  free(response);
+  if (!ok) {
+    WritePacket(1, PTYPE_ERROR_MESSAGE, "Wrong password");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,370 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief Rendering benchmark for auth_x11_grid under Xvfb.
+ *
+ * Usage: bench_auth_x11_grid <auth_x11_grid> <authproto_stub> [seconds]
+ *
+ * For each screen configuration, starts a private Xvfb (split into fake
+ * XRandR monitors where asked for), creates a window like xsecurelock's auth
+ * window and runs auth_x11_grid on it with authproto_stub as its authproto
+ * module. Scripted keystrokes are then fed to its stdin for `seconds`
+ * (default 5), followed by Enter.
+ *
+ * Frames and key-to-frame latencies are taken from the trace auth_x11_grid
+ * writes with XSECURELOCK_TRACE, CPU time and peak RSS from wait4(). The
+ * results are printed to stdout as one JSON object. Exits with status 77 if
+ * Xvfb cannot be started, so it can be skipped like an automake test.
+ */
+
+// For mkdtemp and wait4.
+#define _GNU_SOURCE
+
+#include <X11/Xlib.h>      // for XOpenDisplay, XCreateWindow, XMapRaised
+#include <signal.h>        // for kill, SIGKILL
+#include <stdio.h>         // for printf, fprintf, snprintf, fopen, perror
+#include <stdlib.h>        // for atoi, malloc, free, mkdtemp, setenv
+#include <string.h>        // for strcmp
+#include <sys/resource.h>  // for rusage
+#include <sys/wait.h>      // for wait4, WNOHANG
+#include <unistd.h>        // for fork, execl, pipe, dup2, write, close
+
+#ifdef HAVE_XRANDR_EXT
+#include <X11/extensions/Xrandr.h>  // for XRRAllocateMonitor, XRRSetMonitor
+#include <X11/extensions/randr.h>   // for RANDR_MAJOR, RANDR_MINOR
+#if RANDR_MAJOR > 1 || (RANDR_MAJOR == 1 && RANDR_MINOR >= 5)
+#define HAVE_XRANDR15_EXT
+#endif
+#endif
+
+#include "../helpers/monitors.h"  // for GetMonitors, Monitor
+#include "bench_util.h"           // for Samples, StartXvfb, ReadTraceLine
+
+//! Interval between scripted keystrokes.
+#define KEY_INTERVAL_US 50000
+
+//! Time to let auth_x11_grid start up before the first keystroke.
+#define STARTUP_US 1000000
+
+//! Time auth_x11_grid gets to exit after Enter.
+#define EXIT_TIMEOUT_US 10000000
+
+//! Trace ring size; enough for minutes of frames at hundreds of frames/s.
+#define TRACE_EVENTS "262144"
+
+//! The keystrokes, repeated: fill part of the buffer, then rewind it.
+static const char kKeys[] = "abcd\177\177\177\177";
+
+//! A benchmarked screen configuration.
+typedef struct {
+  int width;
+  int height;
+  int monitors;
+} Config;
+
+static const Config kConfigs[] = {
+    {1280, 720, 1},  {1920, 1080, 1}, {3840, 2160, 1},
+    {3840, 1080, 2}, {5760, 1080, 3},
+};
+
+/*! \brief Splits the screen into side-by-side fake XRandR monitors.
+ *
+ * \return The number of monitors auth_x11_grid will see on window w.
+ */
+static size_t SetUpMonitors(Display *display, Window w,
+                            const Config *config) {
+#ifdef HAVE_XRANDR15_EXT
+  if (config->monitors > 1) {
+    for (int i = 0; i < config->monitors; ++i) {
+      char name[32];
+      snprintf(name, sizeof(name), "BENCH-%d", i);
+      XRRMonitorInfo *m = XRRAllocateMonitor(display, 0);
+      m->name = XInternAtom(display, name, False);
+      m->primary = (i == 0);
+      m->automatic = False;
+      m->x = config->width * i / config->monitors;
+      m->y = 0;
+      m->width = config->width * (i + 1) / config->monitors - m->x;
+      m->height = config->height;
+      m->mwidth = m->width / 4;
+      m->mheight = m->height / 4;
+      XRRSetMonitor(display, DefaultRootWindow(display), m);
+      XRRFreeMonitors(m);
+    }
+    XSync(display, False);
+  }
+#else
+  (void)config;
+#endif
+  Monitor monitors[16];
+  return GetMonitors(display, w, monitors, 16);
+}
+
+/*! \brief Collects frames and key-to-frame latencies from a trace file.
+ *
+ * \param path The trace written by auth_x11_grid.
+ * \param key_times When each byte was written to stdin.
+ * \param num_keys Number of bytes written.
+ * \param frame_us Receives the duration of each frame.
+ * \param key_us Receives the time from each write to the end of the frame
+ *   showing it.
+ * \param frames_begin Receives the start of the first frame.
+ * \param frames_end Receives the end of the last frame.
+ * \return 1 on success, 0 if the trace could not be read.
+ */
+static int ReadTrace(const char *path, const long *key_times, size_t num_keys,
+                     Samples *frame_us, Samples *key_us, long *frames_begin,
+                     long *frames_end) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return 0;
+  }
+  int frame_tid = -1;
+  long frame_start = -1;
+  size_t pending[256];
+  size_t num_pending = 0;
+  *frames_begin = *frames_end = 0;
+  TraceLine ev;
+  while (ReadTraceLine(f, &ev)) {
+    if (ev.ph == 'B' && !strcmp(ev.name, "Frame")) {
+      frame_tid = ev.tid;
+      frame_start = ev.ts;
+      num_pending = 0;
+    } else if (ev.ph == 'f' && ev.tid == frame_tid && frame_start >= 0) {
+      size_t offset =
+          (size_t)(ev.id & ((1UL << TRACE_FLOW_OFFSET_BITS) - 1));
+      if (offset < num_keys &&
+          num_pending < sizeof(pending) / sizeof(*pending)) {
+        pending[num_pending++] = offset;
+      }
+    } else if (ev.ph == 'E' && ev.tid == frame_tid && frame_start >= 0) {
+      // Frame spans do not nest, so this closes the frame.
+      AddSample(frame_us, ev.ts - frame_start);
+      for (size_t i = 0; i < num_pending; ++i) {
+        AddSample(key_us, ev.ts - key_times[pending[i]]);
+      }
+      if (*frames_begin == 0) {
+        *frames_begin = frame_start;
+      }
+      *frames_end = ev.ts;
+      frame_start = -1;
+      num_pending = 0;
+    }
+  }
+  fclose(f);
+  return 1;
+}
+
+/*! \brief Runs one configuration and prints its JSON object.
+ *
+ * \return 0 on success, 1 on failure, 77 if Xvfb is unavailable.
+ */
+static int RunConfig(const Config *config, const char *grid, const char *stub,
+                     int seconds, int first) {
+  char display_name[32];
+  pid_t xvfb = StartXvfb(config->width, config->height, display_name,
+                         sizeof(display_name));
+  if (xvfb == -1) {
+    fprintf(stderr, "Could not start Xvfb\n");
+    return 77;
+  }
+  Display *display = XOpenDisplay(display_name);
+  if (display == NULL) {
+    fprintf(stderr, "Could not connect to %s\n", display_name);
+    StopXvfb(xvfb);
+    return 1;
+  }
+
+  // Same window layout as xsecurelock: the auth window is a child of a
+  // screen-filling window.
+  XSetWindowAttributes attrs = {0};
+  attrs.override_redirect = 1;
+  Window background = XCreateWindow(
+      display, DefaultRootWindow(display), 0, 0, config->width, config->height,
+      0, CopyFromParent, InputOutput, CopyFromParent, CWOverrideRedirect,
+      &attrs);
+  Window auth = XCreateWindow(display, background, 0, 0, config->width,
+                              config->height, 0, CopyFromParent, InputOutput,
+                              CopyFromParent, 0, &attrs);
+  XMapRaised(display, background);
+  XMapRaised(display, auth);
+  size_t num_monitors = SetUpMonitors(display, background, config);
+
+  char trace_dir[] = "/tmp/bench_auth_x11_grid.XXXXXX";
+  if (mkdtemp(trace_dir) == NULL) {
+    perror("mkdtemp");
+    XCloseDisplay(display);
+    StopXvfb(xvfb);
+    return 1;
+  }
+
+  // Type for the given time, ending with an empty buffer, then press Enter.
+  size_t keys_per_round = sizeof(kKeys) - 1;
+  size_t num_keys =
+      ((size_t)seconds * 1000000 / KEY_INTERVAL_US / keys_per_round + 1) *
+      keys_per_round;
+  long *key_times = malloc((num_keys + 1) * sizeof(*key_times));
+  if (key_times == NULL) {
+    perror("malloc");
+    rmdir(trace_dir);
+    XCloseDisplay(display);
+    StopXvfb(xvfb);
+    return 1;
+  }
+
+  int stdin_fds[2];
+  if (pipe(stdin_fds) != 0) {
+    perror("pipe");
+    free(key_times);
+    rmdir(trace_dir);
+    XCloseDisplay(display);
+    StopXvfb(xvfb);
+    return 1;
+  }
+  long start = NowMicros();
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    close(stdin_fds[0]);
+    close(stdin_fds[1]);
+    free(key_times);
+    rmdir(trace_dir);
+    XCloseDisplay(display);
+    StopXvfb(xvfb);
+    return 1;
+  }
+  if (pid == 0) {
+    char window_str[32];
+    snprintf(window_str, sizeof(window_str), "%lu", (unsigned long)auth);
+    setenv("DISPLAY", display_name, 1);
+    setenv("XSCREENSAVER_WINDOW", window_str, 1);
+    setenv("XSECURELOCK_AUTHPROTO", stub, 1);
+    setenv("XSECURELOCK_TRACE", trace_dir, 1);
+    setenv("XSECURELOCK_TRACE_EVENTS", TRACE_EVENTS, 1);
+    setenv("XSECURELOCK_BURNIN_MITIGATION", "0", 1);
+    unsetenv("XSECURELOCK_TRACE_FLOW");
+    unsetenv("XSECURELOCK_STUB_PASSWORD");
+    close(stdin_fds[1]);
+    dup2(stdin_fds[0], 0);
+    close(stdin_fds[0]);
+    execl(grid, grid, (char *)NULL);
+    perror(grid);
+    _exit(127);
+  }
+  close(stdin_fds[0]);
+
+  SleepMicros(STARTUP_US);
+  int status = 0;
+  for (size_t i = 0; i <= num_keys; ++i) {
+    char key = i < num_keys ? kKeys[i % keys_per_round] : '\n';
+    key_times[i] = NowMicros();
+    if (write(stdin_fds[1], &key, 1) != 1) {
+      perror("write");
+      status = 1;
+      break;
+    }
+    SleepMicros(KEY_INTERVAL_US);
+  }
+  close(stdin_fds[1]);
+
+  struct rusage usage = {0};
+  int wstatus = 0;
+  long deadline = NowMicros() + EXIT_TIMEOUT_US;
+  pid_t got;
+  while ((got = wait4(pid, &wstatus, WNOHANG, &usage)) == 0 &&
+         NowMicros() < deadline) {
+    SleepMicros(10000);
+  }
+  if (got == 0) {
+    fprintf(stderr, "auth_x11_grid did not exit\n");
+    kill(pid, SIGKILL);
+    wait4(pid, &wstatus, 0, &usage);
+    status = 1;
+  } else if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+    fprintf(stderr, "auth_x11_grid failed\n");
+    status = 1;
+  }
+
+  Samples frame_us = {0}, key_us = {0};
+  long frames_begin = 0, frames_end = 0;
+  char trace_path[128];
+  snprintf(trace_path, sizeof(trace_path), "%s/auth_x11_grid-%ld.json",
+           trace_dir, (long)pid);
+  if (!ReadTrace(trace_path, key_times, num_keys, &frame_us, &key_us,
+                 &frames_begin, &frames_end)) {
+    status = 1;
+  }
+  unlink(trace_path);
+  rmdir(trace_dir);
+
+  double frame_secs = (frames_end - frames_begin) / 1e6;
+  printf("%s\n{\"width\":%d,\"height\":%d,\"monitors\":%d,"
+         "\"monitors_detected\":%zu,\"status\":%d,\"frames\":%zu,"
+         "\"fps\":%.1f,\"first_frame_us\":%ld,\"cpu_user_s\":%.3f,"
+         "\"cpu_sys_s\":%.3f,\"max_rss_kb\":%ld,",
+         first ? "" : ",", config->width, config->height, config->monitors,
+         num_monitors, status, frame_us.n,
+         frame_secs > 0 ? frame_us.n / frame_secs : 0.0,
+         frames_begin ? frames_begin - start : -1,
+         usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+         usage.ru_maxrss);
+  PrintPercentiles("frame_us", &frame_us);
+  printf(",");
+  PrintPercentiles("key_to_frame_us", &key_us);
+  printf("}");
+  fflush(stdout);
+
+  free(frame_us.v);
+  free(key_us.v);
+  free(key_times);
+  XCloseDisplay(display);
+  StopXvfb(xvfb);
+  return status;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: %s <auth_x11_grid> <authproto_stub> [seconds]\n",
+            argv[0]);
+    return 2;
+  }
+  int seconds = argc > 3 ? atoi(argv[3]) : 5;
+  if (seconds <= 0) {
+    fprintf(stderr, "Usage: %s <auth_x11_grid> <authproto_stub> [seconds]\n",
+            argv[0]);
+    return 2;
+  }
+
+  int status = 0;
+  printf("{\"benchmark\":\"auth_x11_grid\",\"seconds\":%d,\"configs\":[",
+         seconds);
+  for (size_t i = 0; i < sizeof(kConfigs) / sizeof(kConfigs[0]); ++i) {
+    int config_status = RunConfig(&kConfigs[i], argv[1], argv[2], seconds,
+                                  i == 0);
+    if (config_status == 77) {
+      printf("]}\n");
+      return i == 0 ? 77 : 1;
+    }
+    if (config_status != 0) {
+      status = 1;
+    }
+  }
+  printf("\n]}\n");
+  return status;
+}
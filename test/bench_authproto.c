@@ -0,0 +1,137 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief Microbenchmark for the authproto packet codec.
+ *
+ * Usage: bench_authproto [iterations]
+ *
+ * Forks a peer that plays the authproto side of a conversation over two
+ * pipes, and measures:
+ *
+ * - round_trip_us: from writing a password to reading the next prompt, which
+ *   the peer only sends once it has read the password.
+ * - burst_ns_per_packet: the time to read `iterations` info messages the peer
+ *   writes back to back, as with chatty PAM modules, per message.
+ *
+ * Both go through WritePacket and ReadPacket on both ends, `iterations`
+ * (default 20000) times. Prints the distributions as one JSON object.
+ */
+
+#include <signal.h>    // for signal, SIGPIPE, SIG_IGN
+#include <stdio.h>     // for printf, fprintf, perror
+#include <stdlib.h>    // for atoi, free
+#include <string.h>    // for strcmp
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for fork, pipe, close, _exit
+
+#include "../helpers/authproto.h"  // for WritePacket, ReadPacket, PTYPE_*
+#include "bench_util.h"            // for Samples, NowMicros, PrintPercentiles
+
+//! The prompt the peer sends, as authproto_pam typically would.
+#define PROMPT "Password: "
+
+//! The password we answer with.
+#define PASSWORD "correct horse battery staple"
+
+//! The info message the peer sends in bursts.
+#define INFO "Please touch the device."
+
+/*! \brief Plays the authproto side.
+ *
+ * \param in The fd to read responses from.
+ * \param out The fd to write prompts and messages to.
+ */
+static void RunPeer(int in, int out, int iterations) {
+  for (int i = 0; i < iterations; ++i) {
+    WritePacket(out, PTYPE_PROMPT_LIKE_PASSWORD, PROMPT);
+    char *response;
+    if (ReadPacket(in, &response, 0) != PTYPE_RESPONSE_LIKE_PASSWORD) {
+      _exit(1);
+    }
+    free(response);
+  }
+  for (int i = 0; i < iterations; ++i) {
+    WritePacket(out, PTYPE_INFO_MESSAGE, INFO);
+  }
+  _exit(0);
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+  if (argc > 2 || iterations <= 0) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 2;
+  }
+  int requestfd[2], responsefd[2];
+  if (pipe(requestfd) || pipe(responsefd)) {
+    perror("pipe");
+    return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return 2;
+  }
+  if (pid == 0) {
+    close(requestfd[0]);
+    close(responsefd[1]);
+    RunPeer(responsefd[0], requestfd[1], iterations);
+  }
+  close(requestfd[1]);
+  close(responsefd[0]);
+
+  Samples round_trip_us = {0};
+  int ok = 1;
+  long answered = 0;
+  for (int i = 0; ok && i < iterations; ++i) {
+    char *message;
+    if (ReadPacket(requestfd[0], &message, 0) != PTYPE_PROMPT_LIKE_PASSWORD ||
+        strcmp(message, PROMPT)) {
+      ok = 0;
+    }
+    free(message);
+    if (i > 0) {
+      AddSample(&round_trip_us, NowMicros() - answered);
+    }
+    WritePacket(responsefd[1], PTYPE_RESPONSE_LIKE_PASSWORD, PASSWORD);
+    answered = NowMicros();
+  }
+  long burst_start = NowMicros();
+  for (int i = 0; ok && i < iterations; ++i) {
+    char *message;
+    if (ReadPacket(requestfd[0], &message, 0) != PTYPE_INFO_MESSAGE ||
+        strcmp(message, INFO)) {
+      ok = 0;
+    }
+    free(message);
+  }
+  long burst_us = NowMicros() - burst_start;
+  close(requestfd[0]);
+  close(responsefd[1]);
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0 || !ok) {
+    fprintf(stderr, "Conversation failed\n");
+    return 1;
+  }
+
+  printf("{\"benchmark\":\"authproto\",\"iterations\":%d,", iterations);
+  PrintPercentiles("round_trip_us", &round_trip_us);
+  printf(",\"burst_ns_per_packet\":%ld}\n", burst_us * 1000 / iterations);
+  return 0;
+}
@@ -0,0 +1,217 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief Benchmark for authproto_multiplex racing authproto modules.
+ *
+ * Usage: bench_authproto_multiplex /path/to/authproto_multiplex [iterations]
+ *
+ * Writes htpasswd-style stand-in modules into a temporary directory, which
+ * take FAST_MS or SLOW_MS to check the password, and succeed or fail. Then
+ * runs `iterations` (default 20) attempts each of:
+ *
+ * - fast, slow: a stand-in on its own.
+ * - multiplex_fast_slow: both succeeding stand-ins behind the multiplexer;
+ *   should take as long as fast.
+ * - multiplex_fastfail_slow: the fast one fails; should take as long as slow.
+ *
+ * Each attempt waits for the prompt and a bit of typing time, then sends the
+ * password; the time from then until the module exited is reported, as one
+ * JSON object.
+ */
+
+// For mkdtemp.
+#define _GNU_SOURCE
+
+#include <signal.h>    // for signal, SIGPIPE, SIG_IGN
+#include <stdio.h>     // for printf, fprintf, perror, snprintf, fopen
+#include <stdlib.h>    // for atoi, free, mkdtemp, setenv, EXIT_FAILURE
+#include <sys/stat.h>  // for chmod
+#include <sys/wait.h>  // for waitpid, WIFEXITED, WEXITSTATUS
+#include <unistd.h>    // for close, dup2, execl, fork, pipe, unlink, rmdir
+
+#include "../helpers/authproto.h"  // for WritePacket, ReadPacket, PTYPE_*
+#include "bench_util.h"            // for Samples, NowMicros, PrintPercentiles
+
+//! How long the fast stand-in takes to check the password.
+#define FAST_MS 10
+
+//! How long the slow stand-in takes to check the password.
+#define SLOW_MS 100
+
+//! How long the user takes to type; by then all modules have prompted.
+#define TYPING_MS 50
+
+//! The password the stand-ins accept.
+#define PASSWORD "hunter2"
+
+//! The stand-in modules, all speaking the protocol like authproto_htpasswd.
+static const struct {
+  const char *name;
+  int delay_ms;
+  int succeed;
+} STAND_INS[] = {
+    {"authproto_fast", FAST_MS, 1},
+    {"authproto_slow", SLOW_MS, 1},
+    {"authproto_fastfail", FAST_MS, 0},
+};
+
+//! The temporary directory the stand-ins are in.
+static char dir[] = "/tmp/bench_authproto_multiplex.XXXXXX";
+
+//! Writes a stand-in module.
+static int WriteStandIn(const char *name, int delay_ms, int succeed) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror("fopen");
+    return 0;
+  }
+  fprintf(f,
+          "#!/bin/sh\n"
+          "echo \"P 15\"\n"
+          "echo \"Enter password:\"\n"
+          "read -r ptype len\n"
+          "head -c \"$((len+1))\" >/dev/null\n"
+          "sleep %d.%03d\n",
+          delay_ms / 1000, delay_ms % 1000);
+  if (succeed) {
+    fprintf(f, "echo \"i 11\"\necho \"I know you.\"\nexit 0\n");
+  } else {
+    fprintf(f, "echo \"e 17\"\necho \"Invalid password.\"\nexit 1\n");
+  }
+  if (fclose(f) != 0 || chmod(path, 0755) != 0) {
+    perror(path);
+    return 0;
+  }
+  return 1;
+}
+
+/*! \brief Runs one authentication attempt.
+ *
+ * \return The microseconds from sending the password until the module
+ *   exited, or -1 if it did not succeed.
+ */
+static long Attempt(const char *authproto) {
+  int requestfd[2], responsefd[2];
+  if (pipe(requestfd) || pipe(responsefd)) {
+    perror("pipe");
+    return -1;
+  }
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    dup2(responsefd[0], 0);
+    dup2(requestfd[1], 1);
+    close(requestfd[0]);
+    close(requestfd[1]);
+    close(responsefd[0]);
+    close(responsefd[1]);
+    execl(authproto, authproto, (char *)NULL);
+    _exit(EXIT_FAILURE);
+  }
+  close(requestfd[1]);
+  close(responsefd[0]);
+  char *message;
+  char type = ReadPacket(requestfd[0], &message, 0);
+  free(message);
+  long start = -1;
+  if (type == PTYPE_PROMPT_LIKE_PASSWORD) {
+    SleepMicros(TYPING_MS * 1000L);
+    start = NowMicros();
+    WritePacket(responsefd[1], PTYPE_RESPONSE_LIKE_PASSWORD, PASSWORD);
+    while (ReadPacket(requestfd[0], &message, 1) != 0) {
+      free(message);
+    }
+  }
+  DropBufferedPacketData(requestfd[0]);
+  close(requestfd[0]);
+  close(responsefd[1]);
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0 || start < 0) {
+    return -1;
+  }
+  return NowMicros() - start;
+}
+
+//! Measures attempts with the given module, and prints them as "name":{...}.
+static int Measure(const char *name, const char *authproto, int iterations) {
+  Samples attempt_us = {0};
+  for (int i = 0; i < iterations; ++i) {
+    long us = Attempt(authproto);
+    if (us < 0) {
+      fprintf(stderr, "%s: attempt failed\n", name);
+      return 0;
+    }
+    AddSample(&attempt_us, us);
+  }
+  PrintPercentiles(name, &attempt_us);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 2 ? atoi(argv[2]) : 20;
+  if (argc < 2 || argc > 3 || iterations <= 0) {
+    fprintf(stderr, "Usage: %s /path/to/authproto_multiplex [iterations]\n",
+            argv[0]);
+    return 2;
+  }
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 2;
+  }
+  size_t num_stand_ins = sizeof(STAND_INS) / sizeof(*STAND_INS);
+  int ok = 1;
+  for (size_t i = 0; ok && i < num_stand_ins; ++i) {
+    ok = WriteStandIn(STAND_INS[i].name, STAND_INS[i].delay_ms,
+                      STAND_INS[i].succeed);
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  char fast[4096], slow[4096], list[8192];
+  snprintf(fast, sizeof(fast), "%s/authproto_fast", dir);
+  snprintf(slow, sizeof(slow), "%s/authproto_slow", dir);
+  if (ok) {
+    printf("{\"benchmark\":\"authproto_multiplex\",\"iterations\":%d,"
+           "\"fast_ms\":%d,\"slow_ms\":%d,",
+           iterations, FAST_MS, SLOW_MS);
+    ok = Measure("fast", fast, iterations);
+    printf(",");
+    ok = ok && Measure("slow", slow, iterations);
+    printf(",");
+    snprintf(list, sizeof(list), "%s,%s", fast, slow);
+    setenv("XSECURELOCK_AUTHPROTO_MULTIPLEX", list, 1);
+    ok = ok && Measure("multiplex_fast_slow", argv[1], iterations);
+    printf(",");
+    snprintf(list, sizeof(list), "%s/authproto_fastfail,%s", dir, slow);
+    setenv("XSECURELOCK_AUTHPROTO_MULTIPLEX", list, 1);
+    ok = ok && Measure("multiplex_fastfail_slow", argv[1], iterations);
+    printf("}\n");
+  }
+
+  for (size_t i = 0; i < num_stand_ins; ++i) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, STAND_INS[i].name);
+    unlink(path);
+  }
+  rmdir(dir);
+  return !ok;
+}
@@ -0,0 +1,130 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief Microbenchmark for the breach puzzle generator and solver.
+ *
+ * Usage: bench_breach_puzzle [iterations]
+ *
+ * For each puzzle size, generates `iterations` puzzles and reports the
+ * generation time percentiles and how many fell back to the staircase
+ * puzzle, then solves each generated puzzle again and reports the solver
+ * throughput. Exits with status 1 if any generation exceeded its budget.
+ */
+
+#include <stdio.h>   // for printf, fprintf, snprintf, perror
+#include <stdlib.h>  // for atoi, malloc, free, qsort
+#include <time.h>    // for clock_gettime, CLOCK_MONOTONIC
+
+#include "../helpers/breach_puzzle.h"
+
+//! Budget slack allowed for timer granularity and scheduling.
+#define BUDGET_SLACK_US 200
+
+//! A benchmarked puzzle size.
+typedef struct {
+  int grid_size;
+  int buffer_size;
+  int num_targets;
+  int target_len;
+  long budget_usec;
+} Size;
+
+static const Size kSizes[] = {
+    {5, 6, 3, 4, 1000},     {6, 8, 4, 4, 10000},   {8, 10, 5, 5, 10000},
+    {10, 12, 6, 6, 10000},  {12, 16, 8, 8, 10000},
+};
+
+static long NowMicros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static int CompareLong(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  if (iterations <= 0) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 2;
+  }
+  long *times = malloc(iterations * sizeof(*times));
+  BreachPuzzle *puzzles = malloc(iterations * sizeof(*puzzles));
+  if (times == NULL || puzzles == NULL) {
+    perror("malloc");
+    return 2;
+  }
+
+  int over_budget = 0;
+  printf("%-8s %8s %8s %8s %8s %9s %12s\n", "size", "p50_us", "p99_us",
+         "max_us", "budget", "fallback", "solves/s");
+  for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+    const Size *sz = &kSizes[s];
+
+    int fallbacks = 0;
+    for (int i = 0; i < iterations; ++i) {
+      long t0 = NowMicros();
+      if (!GenerateBreachPuzzle(&puzzles[i], sz->grid_size, sz->buffer_size,
+                                sz->num_targets, sz->target_len,
+                                (uint32_t)(i + 1), sz->budget_usec)) {
+        ++fallbacks;
+      }
+      times[i] = NowMicros() - t0;
+    }
+    qsort(times, iterations, sizeof(*times), CompareLong);
+    long max_us = times[iterations - 1];
+    if (max_us > sz->budget_usec + BUDGET_SLACK_US) {
+      over_budget = 1;
+    }
+
+    uint32_t want_mask = (uint32_t)((1ull << sz->num_targets) - 1);
+    long t0 = NowMicros();
+    int solved = 0;
+    for (int i = 0; i < iterations; ++i) {
+      TargetMatcher m;
+      GridPos path[MAX_BUFFER_SIZE];
+      BuildTargetMatcher(&m, &puzzles[i]);
+      if (SolveBreachPuzzle(&puzzles[i], &m, want_mask, path, 1000000L) ==
+          1) {
+        ++solved;
+      }
+    }
+    long elapsed = NowMicros() - t0;
+    if (elapsed <= 0) {
+      elapsed = 1;
+    }
+
+    char name[16];
+    snprintf(name, sizeof(name), "%dx%d/%d", sz->grid_size, sz->grid_size,
+             sz->buffer_size);
+    printf("%-8s %8ld %8ld %8ld %8ld %9d %12.0f\n", name,
+           times[iterations / 2], times[iterations * 99 / 100], max_us,
+           sz->budget_usec, fallbacks, solved * 1e6 / elapsed);
+    if (solved != iterations) {
+      fprintf(stderr, "%s: only %d of %d puzzles solved\n", name, solved,
+              iterations);
+      over_budget = 1;
+    }
+  }
+
+  free(puzzles);
+  free(times);
+  return over_budget;
+}
@@ -0,0 +1,174 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief Benchmark for the per-attempt latency of htpasswd authprotos.
+ *
+ * Usage: bench_htpasswd iterations authproto...
+ *
+ * Writes a ~/.xsecurelock.pw with a bcrypt, a SHA-512-crypt and an APR1 hash
+ * into a temporary HOME, then runs each given authproto (e.g.
+ * authproto_htpasswd_native and helpers/authproto_htpasswd) `iterations`
+ * times per hash type, answering its prompt with the correct password.
+ * Reports the time from starting the authproto until it has accepted the
+ * password and exited, as one JSON object. Authprotos that are not
+ * executable are reported as null.
+ */
+
+// For mkdtemp.
+#define _GNU_SOURCE
+
+#include <pwd.h>        // for getpwuid, passwd
+#include <signal.h>     // for signal, SIGPIPE, SIG_IGN
+#include <stdio.h>      // for printf, fprintf, perror, snprintf, fopen
+#include <stdlib.h>     // for atoi, mkdtemp, setenv, EXIT_FAILURE
+#include <string.h>     // for strlen
+#include <sys/wait.h>   // for waitpid, WIFEXITED, WEXITSTATUS
+#include <unistd.h>     // for access, close, dup2, execl, fork, pipe, read,
+                        // write, unlink, rmdir
+
+#include "bench_util.h"  // for Samples, NowMicros, PrintPercentiles
+
+//! The password all hashes are of.
+#define PASSWORD "hunter2"
+
+//! The hashes to measure; all with low-cost settings as htpasswd writes them.
+static const struct {
+  const char *name;
+  const char *hash;
+} HASHES[] = {
+    {"bcrypt", "$2y$05$abcdefghijklmnopqrstuuoXuKqgZXLiJqzfmMXDDhSFPIvxV7t8."},
+    {"sha512",
+     "$6$abcdefghijklmnop$EC.xeLW9zNWcX0r23FSpQaV7PG.Ibd4QnLe3w6UC47i3/"
+     "vkPQouEDwvUpGtqFiad5mzQG96cD/LywQiXv9WfH/"},
+    {"apr1", "$apr1$abcdefgh$ckT15POyCRlen.h6XtGAZ1"},
+};
+
+//! Writes the password file with the given hash for the given user.
+static int WritePasswordFile(const char *home, const char *user,
+                             const char *hash) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/.xsecurelock.pw", home);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror("fopen");
+    return 0;
+  }
+  fprintf(f, "nobody-else:*\n%s:%s\n", user, hash);
+  return fclose(f) == 0;
+}
+
+//! Runs one authentication attempt, and returns whether it succeeded.
+static int Attempt(const char *authproto) {
+  int in[2], out[2];
+  if (pipe(in) || pipe(out)) {
+    perror("pipe");
+    return 0;
+  }
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return 0;
+  }
+  if (pid == 0) {
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    execl(authproto, authproto, (char *)NULL);
+    _exit(EXIT_FAILURE);
+  }
+  close(in[0]);
+  close(out[1]);
+  // Answer right away; the response waits in the pipe for the prompt.
+  char response[64];
+  int len = snprintf(response, sizeof(response), "p %d\n%s\n",
+                     (int)strlen(PASSWORD), PASSWORD);
+  if (write(in[1], response, (size_t)len) != len) {
+    perror("write");
+  }
+  close(in[1]);
+  char buf[256];
+  while (read(out[0], buf, sizeof(buf)) > 0) {
+  }
+  close(out[0]);
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 0;
+  if (iterations <= 0) {
+    fprintf(stderr, "Usage: %s iterations authproto...\n", argv[0]);
+    return 2;
+  }
+  struct passwd *pwd = getpwuid(getuid());
+  if (pwd == NULL) {
+    perror("getpwuid");
+    return 2;
+  }
+  char home[] = "/tmp/bench_htpasswd.XXXXXX";
+  if (mkdtemp(home) == NULL) {
+    perror("mkdtemp");
+    return 2;
+  }
+  // The shell version looks up $USER, the native one getpwuid().
+  setenv("HOME", home, 1);
+  setenv("USER", pwd->pw_name, 1);
+  signal(SIGPIPE, SIG_IGN);
+
+  int ok = 1;
+  printf("{\"benchmark\":\"htpasswd\",\"iterations\":%d,\"authprotos\":{",
+         iterations);
+  for (int a = 2; a < argc; ++a) {
+    printf("%s\"%s\":", a > 2 ? "," : "", argv[a]);
+    if (access(argv[a], X_OK)) {
+      printf("null");
+      continue;
+    }
+    printf("{");
+    for (size_t h = 0; h < sizeof(HASHES) / sizeof(*HASHES); ++h) {
+      Samples attempt_us = {0};
+      if (!WritePasswordFile(home, pwd->pw_name, HASHES[h].hash)) {
+        ok = 0;
+        break;
+      }
+      for (int i = 0; i < iterations; ++i) {
+        long start = NowMicros();
+        if (!Attempt(argv[a])) {
+          fprintf(stderr, "%s rejected the %s hash\n", argv[a],
+                  HASHES[h].name);
+          ok = 0;
+          break;
+        }
+        AddSample(&attempt_us, NowMicros() - start);
+      }
+      printf("%s", h > 0 ? "," : "");
+      PrintPercentiles(HASHES[h].name, &attempt_us);
+    }
+    printf("}");
+  }
+  printf("}}\n");
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/.xsecurelock.pw", home);
+  unlink(path);
+  rmdir(home);
+  return !ok;
+}
@@ -0,0 +1,285 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief End-to-end lock and unlock latency benchmark under Xvfb.
+ *
+ * Usage: bench_lock_latency <xsecurelock> <auth> <authproto_stub> [iterations]
+ *
+ * Starts a private Xvfb, then repeatedly (default 20 times) locks it with
+ * xsecurelock, wakes the auth dialog with a key, types the password accepted
+ * by authproto_stub and presses Enter, using xdotool. Measures:
+ *
+ * - lock_us: from starting xsecurelock to its notify command running, i.e.
+ *   the screen being covered and grabbed.
+ * - key_to_auth_frame_us: from xsecurelock receiving the first key to the
+ *   auth dialog finishing its first frame.
+ * - enter_to_exit_us: from xsecurelock receiving Enter to it exiting.
+ *
+ * Key arrival and frame times come from the XSECURELOCK_TRACE output, so they
+ * exclude xdotool's own startup; the auth frame needs an auth module that
+ * traces, such as auth_x11_grid. Other helpers (saver, global saver) are
+ * taken from the environment as usual. Prints the distributions as one JSON
+ * object, and exits with status 77 if Xvfb or xdotool are missing.
+ */
+
+// For mkdtemp.
+#define _GNU_SOURCE
+
+#include <dirent.h>    // for opendir, readdir, closedir
+#include <signal.h>    // for kill, SIGKILL
+#include <stdio.h>     // for printf, fprintf, snprintf, fopen, perror
+#include <stdlib.h>    // for atoi, mkdtemp, setenv
+#include <string.h>    // for strcmp, strncmp
+#include <sys/select.h>  // for select, fd_set, FD_SET
+#include <sys/wait.h>    // for waitpid, WNOHANG
+#include <unistd.h>      // for fork, execl, execvp, pipe, dup2, close
+
+#include "bench_util.h"  // for Samples, StartXvfb, ReadTraceLine
+
+//! The password typed; authproto_stub is told to accept only this one.
+#define PASSWORD "hunter2"
+
+//! Time xsecurelock gets to lock, and to exit after Enter.
+#define TIMEOUT_US 10000000
+
+//! Time the auth dialog gets to come up before the password is typed.
+#define AUTH_STARTUP_US 1000000
+
+/*! \brief Runs a command and waits for it.
+ *
+ * \return Its exit status, or -1 if it did not exit normally.
+ */
+static int RunCommand(char *const *argv) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+/*! \brief Waits for a child with a timeout, killing it when it runs out.
+ *
+ * \return Its exit status, or -1 if it timed out or did not exit normally.
+ */
+static int WaitWithTimeout(pid_t pid, long timeout_us) {
+  long deadline = NowMicros() + timeout_us;
+  int status;
+  pid_t got;
+  while ((got = waitpid(pid, &status, WNOHANG)) == 0 &&
+         NowMicros() < deadline) {
+    SleepMicros(1000);
+  }
+  if (got == 0) {
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return -1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*! \brief Finds the first and last begin of a span in a trace.
+ */
+static void FindSpans(const char *path, const char *name, char ph,
+                      long *first, long *last) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return;
+  }
+  TraceLine ev;
+  int open = 0;
+  while (ReadTraceLine(f, &ev)) {
+    if (ev.ph == 'B') {
+      open = !strcmp(ev.name, name);
+      if (open && ph == 'B') {
+        if (*first == 0 || ev.ts < *first) {
+          *first = ev.ts;
+        }
+        *last = ev.ts;
+      }
+    } else if (ev.ph == 'E' && open && ph == 'E') {
+      // The spans looked for do not nest.
+      if (*first == 0 || ev.ts < *first) {
+        *first = ev.ts;
+      }
+      *last = ev.ts;
+      open = 0;
+    }
+  }
+  fclose(f);
+}
+
+/*! \brief Runs one lock/unlock cycle.
+ *
+ * \return 1 if all latencies were measured, 0 otherwise.
+ */
+static int RunIteration(const char *xsecurelock, const char *auth,
+                        const char *stub, Samples *lock_us,
+                        Samples *key_to_auth_us, Samples *enter_to_exit_us) {
+  char trace_dir[] = "/tmp/bench_lock_latency.XXXXXX";
+  if (mkdtemp(trace_dir) == NULL) {
+    perror("mkdtemp");
+    return 0;
+  }
+  int notify_fds[2];
+  if (pipe(notify_fds) != 0) {
+    perror("pipe");
+    return 0;
+  }
+
+  long start = NowMicros();
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return 0;
+  }
+  if (pid == 0) {
+    setenv("XSECURELOCK_AUTH", auth, 1);
+    setenv("XSECURELOCK_AUTHPROTO", stub, 1);
+    setenv("XSECURELOCK_STUB_PASSWORD", PASSWORD, 1);
+    setenv("XSECURELOCK_TRACE", trace_dir, 1);
+    close(notify_fds[0]);
+    // The notify command reports the lock on fd 3.
+    if (notify_fds[1] != 3) {
+      dup2(notify_fds[1], 3);
+      close(notify_fds[1]);
+    }
+    execl(xsecurelock, xsecurelock, "--", "sh", "-c", "echo >&3",
+          (char *)NULL);
+    perror(xsecurelock);
+    _exit(127);
+  }
+  close(notify_fds[1]);
+
+  int ok = 1;
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(notify_fds[0], &set);
+  struct timeval tv = {TIMEOUT_US / 1000000, TIMEOUT_US % 1000000};
+  char c;
+  if (select(notify_fds[0] + 1, &set, NULL, NULL, &tv) == 1 &&
+      read(notify_fds[0], &c, 1) == 1) {
+    AddSample(lock_us, NowMicros() - start);
+  } else {
+    fprintf(stderr, "xsecurelock did not lock\n");
+    ok = 0;
+  }
+  close(notify_fds[0]);
+
+  char *wake[] = {"xdotool", "key", "space", NULL};
+  char *type[] = {"xdotool", "type", PASSWORD, NULL};
+  char *enter[] = {"xdotool", "key", "Return", NULL};
+  if (ok) {
+    RunCommand(wake);
+    SleepMicros(AUTH_STARTUP_US);
+    RunCommand(type);
+    RunCommand(enter);
+  }
+  int status = WaitWithTimeout(pid, ok ? TIMEOUT_US : 0);
+  long exited = NowMicros();
+  if (status != 0) {
+    fprintf(stderr, "xsecurelock did not unlock\n");
+    ok = 0;
+  }
+
+  // Collect the traces and clean up.
+  long first_key = 0, last_key = 0, first_frame = 0, last_frame = 0;
+  DIR *dir = opendir(trace_dir);
+  struct dirent *ent;
+  while (dir != NULL && (ent = readdir(dir)) != NULL) {
+    if (ent->d_name[0] == '.') {
+      continue;
+    }
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", trace_dir, ent->d_name);
+    if (!strncmp(ent->d_name, "xsecurelock-", 12)) {
+      FindSpans(path, "KeyPress", 'B', &first_key, &last_key);
+    } else {
+      FindSpans(path, "Frame", 'E', &first_frame, &last_frame);
+    }
+    unlink(path);
+  }
+  if (dir != NULL) {
+    closedir(dir);
+  }
+  rmdir(trace_dir);
+
+  if (ok && first_key != 0 && first_frame != 0) {
+    AddSample(key_to_auth_us, first_frame - first_key);
+  }
+  if (ok && last_key != 0) {
+    AddSample(enter_to_exit_us, exited - last_key);
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4 || argc > 5) {
+    fprintf(stderr,
+            "Usage: %s <xsecurelock> <auth> <authproto_stub> [iterations]\n",
+            argv[0]);
+    return 2;
+  }
+  int iterations = argc > 4 ? atoi(argv[4]) : 20;
+  if (iterations <= 0) {
+    fprintf(stderr, "Invalid number of iterations: %s\n", argv[4]);
+    return 2;
+  }
+
+  char display_name[32];
+  pid_t xvfb = StartXvfb(1920, 1080, display_name, sizeof(display_name));
+  if (xvfb == -1) {
+    fprintf(stderr, "Could not start Xvfb\n");
+    return 77;
+  }
+  setenv("DISPLAY", display_name, 1);
+  unsetenv("XSECURELOCK_TRACE_FLOW");
+  char *version[] = {"xdotool", "version", NULL};
+  if (RunCommand(version) != 0) {
+    fprintf(stderr, "Could not run xdotool\n");
+    StopXvfb(xvfb);
+    return 77;
+  }
+
+  Samples lock_us = {0}, key_to_auth_us = {0}, enter_to_exit_us = {0};
+  int failures = 0;
+  for (int i = 0; i < iterations; ++i) {
+    if (!RunIteration(argv[1], argv[2], argv[3], &lock_us, &key_to_auth_us,
+                      &enter_to_exit_us)) {
+      ++failures;
+    }
+  }
+  StopXvfb(xvfb);
+
+  printf("{\"benchmark\":\"lock_latency\",\"iterations\":%d,\"failures\":%d,",
+         iterations, failures);
+  PrintPercentiles("lock_us", &lock_us);
+  printf(",");
+  PrintPercentiles("key_to_auth_frame_us", &key_to_auth_us);
+  printf(",");
+  PrintPercentiles("enter_to_exit_us", &enter_to_exit_us);
+  printf("}\n");
+  return failures != 0;
+}
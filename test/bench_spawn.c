@@ -0,0 +1,110 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ * \brief Microbenchmark for launching helpers: SpawnProcess vs. fork + exec.
+ *
+ * Usage: bench_spawn [resident_mb] [iterations]
+ *
+ * Makes this process touch resident_mb (default 256) MB of memory, standing
+ * in for a helper that has fonts and rendering state loaded, then starts
+ * true(1) `iterations` (default 200) times each way. Reports how long the
+ * parent is blocked in the launch call, and how long until the child has
+ * exited and was reaped, as one JSON object.
+ */
+
+#include <stdio.h>     // for printf, fprintf, perror
+#include <stdlib.h>    // for atoi, malloc, EXIT_FAILURE
+#include <string.h>    // for memset
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for _exit, execvp
+
+#include "../wait_pgrp.h"  // for SpawnProcess, ForkWithoutSigHandlers
+#include "bench_util.h"    // for Samples, NowMicros, PrintPercentiles
+
+//! Launches the child the way the helpers used to.
+static pid_t ForkExec(const char *const argv[]) {
+  pid_t pid = ForkWithoutSigHandlers();
+  if (pid == 0) {
+    execvp(argv[0], (char *const *)argv);
+    _exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+//! Launches the child with SpawnProcess.
+static pid_t Spawn(const char *const argv[]) {
+  return SpawnProcess(argv[0], argv, NULL, -1, -1, SPAWN_SEARCH_PATH);
+}
+
+//! Measures one way of launching a child.
+static int Measure(pid_t (*launch)(const char *const argv[]), int iterations,
+                   Samples *blocked_us, Samples *total_us) {
+  const char *const argv[] = {"true", NULL};
+  for (int i = 0; i < iterations; ++i) {
+    long start = NowMicros();
+    pid_t pid = launch(argv);
+    long launched = NowMicros();
+    if (pid == -1) {
+      perror("launch");
+      return 0;
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Child failed\n");
+      return 0;
+    }
+    AddSample(blocked_us, launched - start);
+    AddSample(total_us, NowMicros() - start);
+  }
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  int resident_mb = argc > 1 ? atoi(argv[1]) : 256;
+  int iterations = argc > 2 ? atoi(argv[2]) : 200;
+  if (argc > 3 || resident_mb < 0 || iterations <= 0) {
+    fprintf(stderr, "Usage: %s [resident_mb] [iterations]\n", argv[0]);
+    return 2;
+  }
+  size_t resident_bytes = (size_t)resident_mb << 20;
+  char *resident = malloc(resident_bytes + 1);
+  if (resident == NULL) {
+    perror("malloc");
+    return 2;
+  }
+  memset(resident, 1, resident_bytes);
+
+  Samples fork_blocked = {0}, fork_total = {0};
+  Samples spawn_blocked = {0}, spawn_total = {0};
+  if (!Measure(ForkExec, iterations, &fork_blocked, &fork_total) ||
+      !Measure(Spawn, iterations, &spawn_blocked, &spawn_total)) {
+    return 1;
+  }
+
+  printf("{\"benchmark\":\"spawn\",\"resident_mb\":%d,\"iterations\":%d,",
+         resident_mb, iterations);
+  PrintPercentiles("fork_exec_blocked_us", &fork_blocked);
+  printf(",");
+  PrintPercentiles("fork_exec_total_us", &fork_total);
+  printf(",");
+  PrintPercentiles("spawn_blocked_us", &spawn_blocked);
+  printf(",");
+  PrintPercentiles("spawn_total_us", &spawn_total);
+  printf(",\"touched\":%d}\n", resident[resident_bytes / 2]);
+  return 0;
+}
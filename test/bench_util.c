@@ -0,0 +1,165 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "bench_util.h"
+
+#include <errno.h>       // for errno, EINTR
+#include <fcntl.h>       // for open, O_WRONLY
+#include <signal.h>      // for kill, SIGTERM, SIGKILL
+#include <stdlib.h>      // for realloc, qsort, exit, strtoull
+#include <string.h>      // for strstr, strlen, strcspn
+#include <sys/select.h>  // for select, fd_set, FD_SET
+#include <sys/wait.h>    // for waitpid
+#include <time.h>        // for clock_gettime, nanosleep, CLOCK_MONOTONIC
+#include <unistd.h>      // for fork, execlp, pipe, dup2, read, close
+
+long NowMicros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void SleepMicros(long us) {
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+}
+
+void AddSample(Samples *s, long v) {
+  if (s->n == s->cap) {
+    s->cap = s->cap ? 2 * s->cap : 256;
+    s->v = realloc(s->v, s->cap * sizeof(*s->v));
+    if (s->v == NULL) {
+      perror("realloc");
+      exit(2);
+    }
+  }
+  s->v[s->n++] = v;
+}
+
+static int CompareLong(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+void PrintPercentiles(const char *name, Samples *s) {
+  if (s->n == 0) {
+    printf("\"%s\":null", name);
+    return;
+  }
+  qsort(s->v, s->n, sizeof(*s->v), CompareLong);
+  printf("\"%s\":{\"n\":%zu,\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"max\":%ld}",
+         name, s->n, s->v[s->n / 2], s->v[s->n * 9 / 10], s->v[s->n * 99 / 100],
+         s->v[s->n - 1]);
+}
+
+pid_t StartXvfb(int width, int height, char *name, size_t name_size) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return -1;
+  }
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    char fd_str[16], screen_str[32];
+    snprintf(fd_str, sizeof(fd_str), "%d", fds[1]);
+    snprintf(screen_str, sizeof(screen_str), "%dx%dx24", width, height);
+    close(fds[0]);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+      dup2(null_fd, 2);
+    }
+    execlp("Xvfb", "Xvfb", "-displayfd", fd_str, "-screen", "0", screen_str,
+           "-nolisten", "tcp", (char *)NULL);
+    _exit(127);
+  }
+  close(fds[1]);
+
+  // Xvfb writes the display number once it accepts connections.
+  char buf[16];
+  size_t len = 0;
+  long deadline = NowMicros() + 10000000L;
+  while (len < sizeof(buf) - 1 && (len == 0 || buf[len - 1] != '\n')) {
+    long remaining = deadline - NowMicros();
+    if (remaining <= 0) {
+      break;
+    }
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fds[0], &set);
+    struct timeval tv = {remaining / 1000000, remaining % 1000000};
+    if (select(fds[0] + 1, &set, NULL, NULL, &tv) <= 0) {
+      continue;
+    }
+    ssize_t got = read(fds[0], buf + len, sizeof(buf) - 1 - len);
+    if (got <= 0) {
+      break;
+    }
+    len += got;
+  }
+  close(fds[0]);
+  if (len == 0 || buf[len - 1] != '\n') {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+  buf[len - 1] = 0;
+  snprintf(name, name_size, ":%s", buf);
+  return pid;
+}
+
+void StopXvfb(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+static unsigned long long TraceField(const char *line, const char *key) {
+  const char *p = strstr(line, key);
+  return p ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+int ReadTraceLine(FILE *f, TraceLine *ev) {
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    const char *ph = strstr(line, "\"ph\":\"");
+    if (ph == NULL) {
+      continue;
+    }
+    ev->ph = ph[6];
+    ev->ts = (long)TraceField(line, "\"ts\":");
+    ev->tid = (int)TraceField(line, "\"tid\":");
+    ev->id = TraceField(line, "\"id\":");
+    ev->name[0] = 0;
+    const char *name = strstr(line, "\"name\":\"");
+    if (name != NULL) {
+      name += 8;
+      size_t len = strcspn(name, "\"");
+      if (len >= sizeof(ev->name)) {
+        len = sizeof(ev->name) - 1;
+      }
+      memcpy(ev->name, name, len);
+      ev->name[len] = 0;
+    }
+    return 1;
+  }
+  return 0;
+}
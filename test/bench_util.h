@@ -0,0 +1,82 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdio.h>      // for FILE
+#include <sys/types.h>  // for pid_t, size_t
+
+//! Bits of a trace flow id that hold the byte offset (see trace.c).
+#define TRACE_FLOW_OFFSET_BITS 20
+
+//! A growable array of samples in microseconds.
+typedef struct {
+  long *v;
+  size_t n;
+  size_t cap;
+} Samples;
+
+//! One event of a trace written by XSECURELOCK_TRACE.
+typedef struct {
+  char ph;
+  char name[32];
+  long ts;
+  int tid;
+  unsigned long long id;
+} TraceLine;
+
+/*! \brief Returns CLOCK_MONOTONIC in microseconds, the clock of the traces.
+ */
+long NowMicros(void);
+
+/*! \brief Sleeps, resuming after signals.
+ */
+void SleepMicros(long us);
+
+/*! \brief Appends a sample; exits on allocation failure.
+ */
+void AddSample(Samples *s, long v);
+
+/*! \brief Prints "name":{...} with the count and percentiles of the samples.
+ *
+ * Sorts the samples. Prints "name":null if there are none.
+ */
+void PrintPercentiles(const char *name, Samples *s);
+
+/*! \brief Starts Xvfb with a single screen of the given size.
+ *
+ * \param width Screen width.
+ * \param height Screen height.
+ * \param name Receives the display name.
+ * \param name_size Size of name.
+ * \return The pid of Xvfb, or -1 if it could not be started.
+ */
+pid_t StartXvfb(int width, int height, char *name, size_t name_size);
+
+/*! \brief Stops an Xvfb started by StartXvfb.
+ */
+void StopXvfb(pid_t pid);
+
+/*! \brief Reads the next event from a trace file.
+ *
+ * \param f The trace file.
+ * \param ev Receives the event.
+ * \return 1 if an event was read, 0 at the end of the file.
+ */
+int ReadTraceLine(FILE *f, TraceLine *ev);
+
+#endif
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Renders a fixed sequence of Breach Protocol frames headlessly under Xvfb and
+# prints per-frame render timings.
+#
+# Usage: run-grid-render.sh <auth_x11_grid> <outdir> [<golden-dir>]
+#
+# If a golden directory is given, the rendered images are compared against the
+# images of the same name in it, and the script fails on any difference.
+
+set -e
+
+grid=$1
+outdir=$2
+golden=$3
+
+mkdir -p "$outdir"
+
+script=$(mktemp -t xsecurelock-grid-render.XXXXXX)
+trap 'rm -f "$script"' EXIT
+cat > "$script" <<'END'
+# Fixed seed and clock, so images are reproducible.
+seed 1
+size 1920 1080
+frame 0 10000 10000 0
+frame 1 9000 10000 1000
+frame 3 5000 10000 2500
+frame 6 2000 10000 4000
+size 3840 2160
+frame 2 8000 10000 1500
+# Timing only.
+repeat 20
+frame 4 6000 10000 3000
+END
+
+XSECURELOCK_BURNIN_MITIGATION=0 \
+  xvfb-run -a -s '-screen 0 3840x2160x24' \
+  "$grid" --render "$script" "$outdir/frame"
+
+if [ -n "$golden" ]; then
+  status=0
+  for f in "$golden"/*.ppm; do
+    if ! cmp -s "$f" "$outdir/${f##*/}"; then
+      echo "Mismatch: ${f##*/}"
+      status=1
+    fi
+  done
+  exit $status
+fi
@@ -0,0 +1,229 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "trace.h"
+
+#include <signal.h>  // for sigaction, sig_atomic_t, SIGUSR2, SIG_DFL
+#include <stdio.h>   // for fprintf, fopen, fclose, snprintf, rename
+#include <stdlib.h>  // for calloc, atexit
+#include <string.h>  // for memset
+#include <time.h>    // for clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>  // for getpid
+
+#include "env_settings.h"  // for GetStringSetting, GetUnsignedLongLongSetting
+#include "logging.h"       // for Log, LogErrno
+
+//! Default number of events kept; older ones are overwritten.
+#define TRACE_DEFAULT_RING_SIZE 4096
+
+//! Bits of a flow id that hold the byte offset.
+#define TRACE_FLOW_OFFSET_BITS 20
+
+//! Bits of a flow base that count the children spawned by a process.
+#define TRACE_FLOW_SPAWN_BITS 10
+
+//! Bits of a flow base that hold the pid (Linux pids have at most 22).
+//! Together with the above, flow ids fit in 52 bits, so trace viewers that
+//! parse them as doubles keep them apart, and flow bases fit in 32 bits.
+#define TRACE_FLOW_PID_BITS 22
+
+//! A recorded event. Only pointers to literals and numbers, never input.
+typedef struct {
+  const char *name;
+  unsigned long long ts_usec;
+  unsigned long long id;
+  int tid;
+  //! Chrome trace phase ('B', 'E', 's', 't', 'f'); 0 while being written.
+  volatile char ph;
+} TraceEvent;
+
+int trace_enabled = 0;
+
+static const char *trace_process_name;
+static char trace_path[4096];
+static TraceEvent *trace_ring;
+static unsigned long trace_ring_size;
+static unsigned long trace_next;
+static int trace_next_tid;
+static __thread int trace_tid;
+static volatile sig_atomic_t trace_dump_requested;
+
+static unsigned long long TraceNowUsec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL +
+         (unsigned long long)ts.tv_nsec / 1000;
+}
+
+static void HandleTraceSignal(int unused_signo) {
+  (void)unused_signo;
+  TraceRequestDump();
+}
+
+static void TraceRecord(char ph, const char *name, unsigned long long id) {
+  if (trace_tid == 0) {
+    trace_tid = __sync_add_and_fetch(&trace_next_tid, 1);
+  }
+  unsigned long slot = __sync_fetch_and_add(&trace_next, 1) % trace_ring_size;
+  TraceEvent *e = &trace_ring[slot];
+  e->ph = 0;
+  __sync_synchronize();
+  e->name = name;
+  e->ts_usec = TraceNowUsec();
+  e->id = id;
+  e->tid = trace_tid;
+  __sync_synchronize();
+  e->ph = ph;
+
+  if (trace_dump_requested &&
+      __sync_bool_compare_and_swap(&trace_dump_requested, 1, 0)) {
+    TraceDump();
+  }
+}
+
+void TraceInit(const char *process_name) {
+  const char *dir = GetStringSetting("XSECURELOCK_TRACE", "");
+  if (*dir == 0) {
+    return;
+  }
+  int len = snprintf(trace_path, sizeof(trace_path), "%s/%s-%ld.json", dir,
+                     process_name, (long)getpid());
+  if (len <= 0 || (size_t)len >= sizeof(trace_path)) {
+    Log("Trace path doesn't fit into buffer");
+    return;
+  }
+  trace_ring_size = (unsigned long)GetUnsignedLongLongSetting(
+      "XSECURELOCK_TRACE_EVENTS", TRACE_DEFAULT_RING_SIZE);
+  if (trace_ring_size == 0) {
+    trace_ring_size = TRACE_DEFAULT_RING_SIZE;
+  }
+  trace_ring = calloc(trace_ring_size, sizeof(*trace_ring));
+  if (trace_ring == NULL) {
+    LogErrno("calloc");
+    return;
+  }
+  trace_process_name = process_name;
+  trace_enabled = 1;
+  atexit(TraceDump);
+
+  struct sigaction sa;
+  if (sigaction(SIGUSR2, NULL, &sa) == 0 && sa.sa_handler == SIG_DFL) {
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = HandleTraceSignal;
+    if (sigaction(SIGUSR2, &sa, NULL) != 0) {
+      LogErrno("sigaction(SIGUSR2)");
+    }
+  }
+}
+
+void TraceBegin(const char *name) { TraceRecord('B', name, 0); }
+
+void TraceEnd(void) { TraceRecord('E', NULL, 0); }
+
+void TraceFlow(char phase, unsigned long long id) {
+  TraceRecord(phase, "input", id);
+}
+
+unsigned long long TraceInputFlowId(unsigned long base, unsigned long offset) {
+  return ((unsigned long long)base << TRACE_FLOW_OFFSET_BITS) |
+         (offset & ((1UL << TRACE_FLOW_OFFSET_BITS) - 1));
+}
+
+unsigned long TraceFlowBase(void) {
+  return (unsigned long)GetUnsignedLongLongSetting(
+      "XSECURELOCK_TRACE_FLOW", (unsigned long long)getpid());
+}
+
+unsigned long TraceNewFlowBase(void) {
+  static unsigned long spawned = 0;
+  unsigned long pid =
+      (unsigned long)getpid() & ((1UL << TRACE_FLOW_PID_BITS) - 1);
+  return (pid << TRACE_FLOW_SPAWN_BITS) |
+         (++spawned & ((1UL << TRACE_FLOW_SPAWN_BITS) - 1));
+}
+
+const char *TraceExportFlowBase(unsigned long base, char *buf, size_t size) {
+  if (!trace_enabled) {
+    return NULL;
+  }
+  int len = snprintf(buf, size, "XSECURELOCK_TRACE_FLOW=%lu", base);
+  if (len <= 0 || (size_t)len >= size) {
+    return NULL;
+  }
+  return buf;
+}
+
+void TraceRequestDump(void) { trace_dump_requested = 1; }
+
+void TraceDump(void) {
+  if (!trace_enabled) {
+    return;
+  }
+  char tmp_path[sizeof(trace_path) + 8];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", trace_path);
+  FILE *f = fopen(tmp_path, "w");
+  if (f == NULL) {
+    LogErrno("fopen(%s)", tmp_path);
+    return;
+  }
+  long pid = (long)getpid();
+  fprintf(f,
+          "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,"
+          "\"args\":{\"name\":\"%s\"}}",
+          pid, trace_process_name);
+  unsigned long end = trace_next;
+  unsigned long begin = end > trace_ring_size ? end - trace_ring_size : 0;
+  for (unsigned long i = begin; i < end; ++i) {
+    const TraceEvent *e = &trace_ring[i % trace_ring_size];
+    char ph = e->ph;
+    __sync_synchronize();
+    switch (ph) {
+      case 'B':
+        fprintf(f,
+                ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%llu,\"pid\":%ld,"
+                "\"tid\":%d}",
+                e->name, e->ts_usec, pid, e->tid);
+        break;
+      case 'E':
+        fprintf(f, ",\n{\"ph\":\"E\",\"ts\":%llu,\"pid\":%ld,\"tid\":%d}",
+                e->ts_usec, pid, e->tid);
+        break;
+      case 's':
+      case 't':
+      case 'f':
+        fprintf(f,
+                ",\n{\"name\":\"%s\",\"cat\":\"input\",\"ph\":\"%c\","
+                "\"id\":%llu,\"ts\":%llu,\"pid\":%ld,\"tid\":%d%s}",
+                e->name, ph, e->id, e->ts_usec, pid, e->tid,
+                ph == 'f' ? ",\"bp\":\"e\"" : "");
+        break;
+      default:
+        // Still being written, or never written.
+        break;
+    }
+  }
+  fprintf(f, "\n]}\n");
+  if (fclose(f) != 0) {
+    LogErrno("fclose(%s)", tmp_path);
+    return;
+  }
+  if (rename(tmp_path, trace_path) != 0) {
+    LogErrno("rename(%s)", trace_path);
+  }
+}
@@ -0,0 +1,124 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>  // for size_t
+
+/*! \brief Whether tracing is enabled in this process.
+ *
+ * Set by TraceInit when XSECURELOCK_TRACE names a directory. All TRACE_*
+ * macros reduce to a test of this flag when tracing is off.
+ */
+extern int trace_enabled;
+
+/*! \brief Enables tracing if XSECURELOCK_TRACE is set.
+ *
+ * Allocates the event ring and arranges for it to be written to
+ * XSECURELOCK_TRACE/<process_name>-<pid>.json (Chrome trace event format) on
+ * exit, and on SIGUSR2 unless the process already handles that signal (in
+ * which case its handler should call TraceRequestDump).
+ *
+ * \param process_name The name to show for this process; must be a literal.
+ */
+void TraceInit(const char *process_name);
+
+/*! \brief Opens a span on the calling thread.
+ *
+ * \param name The span name; must be a literal, as only the pointer is kept.
+ */
+void TraceBegin(const char *name);
+
+/*! \brief Closes the innermost span opened on the calling thread.
+ */
+void TraceEnd(void);
+
+/*! \brief Records a step of a cross-process flow.
+ *
+ * Flows link spans in different processes: the step is bound to the span
+ * currently open on the calling thread.
+ *
+ * \param phase 's' to start, 't' to continue or 'f' to finish the flow.
+ * \param id The flow id, usually from TraceInputFlowId.
+ */
+void TraceFlow(char phase, unsigned long long id);
+
+/*! \brief Returns the flow id of a byte of auth child input.
+ *
+ * The id only depends on the flow base and the byte's offset in the stream,
+ * never on its value, so both ends of the pipe agree on it without recording
+ * anything about the keys typed.
+ *
+ * \param base The flow base the parent picked for the auth child.
+ * \param offset The number of bytes sent (or received) before this one.
+ */
+unsigned long long TraceInputFlowId(unsigned long base, unsigned long offset);
+
+/*! \brief Returns the flow base this process should use for its input.
+ *
+ * This is XSECURELOCK_TRACE_FLOW if the parent exported it, or the pid.
+ */
+unsigned long TraceFlowBase(void);
+
+/*! \brief Picks a new flow base for a child that is about to be spawned.
+ *
+ * Unique within this trace, as it is made of our pid and a counter of the
+ * children we spawned (which wraps after 1024). It fits in 32 bits, so the
+ * flow ids derived from it stay below 2^53 and survive JSON parsers that use
+ * doubles.
+ */
+unsigned long TraceNewFlowBase(void);
+
+/*! \brief Exports a flow base to the environment of a child.
+ *
+ * \param base The flow base, from TraceNewFlowBase().
+ * \param buf Receives "XSECURELOCK_TRACE_FLOW=...", for SpawnProcess().
+ * \param size The size of buf.
+ * \return buf, or NULL if tracing is disabled (or buf is too small).
+ */
+const char *TraceExportFlowBase(unsigned long base, char *buf, size_t size);
+
+/*! \brief Asks for the ring to be written at the next trace call.
+ *
+ * Async-signal-safe.
+ */
+void TraceRequestDump(void);
+
+/*! \brief Writes the ring to the trace file now.
+ */
+void TraceDump(void);
+
+#define TRACE_BEGIN(name)  \
+  do {                     \
+    if (trace_enabled) {   \
+      TraceBegin(name);    \
+    }                      \
+  } while (0)
+#define TRACE_END()      \
+  do {                   \
+    if (trace_enabled) { \
+      TraceEnd();        \
+    }                    \
+  } while (0)
+#define TRACE_FLOW(phase, id)  \
+  do {                         \
+    if (trace_enabled) {       \
+      TraceFlow(phase, id);    \
+    }                          \
+  } while (0)
+
+#endif
@@ -14,19 +14,29 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+// For POSIX_SPAWN_SETSID and posix_spawn_file_actions_addchdir_np.
+#define _GNU_SOURCE
+
 #include "wait_pgrp.h"
 
 #include <errno.h>   // for errno, ECHILD, EINTR, ESRCH
 #include <signal.h>  // for kill, sigaddset, sigemptyset, sigprocmask,
                      // sigsuspend, SIGCHLD, SIGTERM
+#include <spawn.h>   // for posix_spawn, posix_spawnattr_t
 #include <stdio.h>
 #include <stdlib.h>  // for EXIT_SUCCESS, WEXITSTATUS, WIFEXITED, WIFSIGNALED
-#include <string.h>
-#include <sys/wait.h>  // for waitpid, WNOHANG
-#include <unistd.h>    // for pid_t
+#include <string.h>    // for memset, strchr, strncmp
+#include <sys/wait.h>  // for waitpid, waitid, WNOHANG, WNOWAIT
+#include <unistd.h>    // for pid_t, environ
 
 #include "logging.h"  // for Log, LogErrno
 
+#if defined(POSIX_SPAWN_SETSID) && \
+    defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+//! posix_spawn can do all that SpawnProcess needs.
+#define HAVE_FULL_POSIX_SPAWN
+#endif
+
 static void HandleSIGCHLD(int unused_signo) {
   // No handling needed - we just want to interrupt select() or sigsuspend()
   // calls.
@@ -84,33 +94,9 @@ void StartPgrp(void) {
   if (setsid() == (pid_t)-1) {
     LogErrno("setsid");
   }
-  // To avoid a race condition when killing the process group after the leader
-  // is already dead (which could then kill another new process group with the
-  // same ID), we'll create a dummy process that never dies until we signal the
-  // process group explicitly.
-  pid_t pid = fork();
-  if (pid == -1) {
-    LogErrno("StartPgrp -> fork; expect potential race in KillPgrp");
-    // We ignore this error, as everything else can still work in this case;
-    // however in this case the aforementioned race condition in KillPgrp can
-    // happen.
-  } else if (pid == 0) {
-    // Child process.
-    // Just wait forever. We'll get SIGTERM'd when it's time to go.
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sa.sa_handler = SIG_IGN;  // Don't die of SIGUSR1 (saver reset).
-    if (sigaction(SIGUSR1, &sa, NULL) != 0) {
-      LogErrno("sigaction(SIGUSR1)");
-    }
-    {
-      const char *args[2] = {"pgrp_placeholder", NULL};
-      ExecvHelper("pgrp_placeholder", args);
-      sleep(2);  // Reduce log spam or other effects from failed execv.
-      _exit(EXIT_FAILURE);
-    }
-  }
+  // No need to keep the process group ID alive with an extra process: we
+  // never reap the leader before killing the process group (see WaitPgrp),
+  // and the kernel does not reuse the ID while the leader is a zombie.
 }
 
 int ExecvHelper(const char *path, const char *const argv[]) {
@@ -130,12 +116,177 @@ int ExecvHelper(const char *path, const char *const argv[]) {
   return -1;
 }
 
+/*! \brief Builds the environment for a child process.
+ *
+ * \param env Variables to set, as "NAME=value" entries, or NULL.
+ * \return The current environment with env applied; free() the array only.
+ */
+static char **MakeChildEnvironment(const char *const env[]) {
+  size_t n = 0, n_env = 0;
+  while (environ[n] != NULL) {
+    ++n;
+  }
+  while (env != NULL && env[n_env] != NULL) {
+    ++n_env;
+  }
+  char **result = malloc((n + n_env + 1) * sizeof(*result));
+  if (result == NULL) {
+    return NULL;
+  }
+  size_t k = 0;
+  for (size_t i = 0; i < n; ++i) {
+    int overridden = 0;
+    for (size_t j = 0; j < n_env; ++j) {
+      size_t name_len = (size_t)(strchr(env[j], '=') - env[j]);
+      if (!strncmp(environ[i], env[j], name_len + 1)) {
+        overridden = 1;
+        break;
+      }
+    }
+    if (!overridden) {
+      result[k++] = environ[i];
+    }
+  }
+  for (size_t j = 0; j < n_env; ++j) {
+    result[k++] = (char *)env[j];
+  }
+  result[k] = NULL;
+  return result;
+}
+
+#ifdef HAVE_FULL_POSIX_SPAWN
+static pid_t DoSpawnProcess(const char *path, const char *const argv[],
+                            const char *const env[], int stdin_fd,
+                            int stdout_fd, int flags) {
+  char **envp = MakeChildEnvironment(env);
+  if (envp == NULL) {
+    return -1;
+  }
+
+  // Same signals as in ForkWithoutSigHandlers.
+  sigset_t mask, defaults;
+  sigemptyset(&mask);
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGUSR1);
+  sigaddset(&defaults, SIGTERM);
+  sigaddset(&defaults, SIGCHLD);
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setflags(
+      &attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF |
+                 ((flags & SPAWN_NEW_PGRP) ? POSIX_SPAWN_SETSID : 0));
+
+  // Same as the dup2 dance in the children of fork, and ExecvHelper.
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (stdin_fd != -1 && stdin_fd != 0) {
+    posix_spawn_file_actions_adddup2(&actions, stdin_fd, 0);
+  }
+  if (stdout_fd != -1 && stdout_fd != 1) {
+    posix_spawn_file_actions_adddup2(&actions, stdout_fd, 1);
+  }
+  if (stdin_fd > 1 && stdin_fd != stdout_fd) {
+    posix_spawn_file_actions_addclose(&actions, stdin_fd);
+  }
+  if (stdout_fd > 1) {
+    posix_spawn_file_actions_addclose(&actions, stdout_fd);
+  }
+  if (!(flags & SPAWN_SEARCH_PATH)) {
+    posix_spawn_file_actions_addchdir_np(&actions, HELPER_PATH);
+  }
+
+  pid_t pid;
+  int err = ((flags & SPAWN_SEARCH_PATH) ? posix_spawnp : posix_spawn)(
+      &pid, path, &actions, &attr, (char *const *)argv, envp);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  free(envp);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+#else
+static pid_t DoSpawnProcess(const char *path, const char *const argv[],
+                            const char *const env[], int stdin_fd,
+                            int stdout_fd, int flags) {
+  char **envp = MakeChildEnvironment(env);
+  if (envp == NULL) {
+    return -1;
+  }
+  pid_t pid = ForkWithoutSigHandlers();
+  if (pid != 0) {
+    int saved_errno = errno;
+    free(envp);
+    errno = saved_errno;
+    return pid;
+  }
+
+  // Child process.
+  if (flags & SPAWN_NEW_PGRP) {
+    StartPgrp();
+  }
+  environ = envp;
+  if (stdin_fd != -1 && stdin_fd != 0) {
+    if (dup2(stdin_fd, 0) == -1) {
+      LogErrno("dup2");
+      _exit(EXIT_FAILURE);
+    }
+  }
+  if (stdout_fd != -1 && stdout_fd != 1) {
+    if (dup2(stdout_fd, 1) == -1) {
+      LogErrno("dup2");
+      _exit(EXIT_FAILURE);
+    }
+  }
+  if (stdin_fd > 1 && stdin_fd != stdout_fd) {
+    close(stdin_fd);
+  }
+  if (stdout_fd > 1) {
+    close(stdout_fd);
+  }
+  if (flags & SPAWN_SEARCH_PATH) {
+    execvp(path, (char *const *)argv);
+    LogErrno("execvp %s", path);
+  } else {
+    ExecvHelper(path, argv);
+  }
+  sleep(2);  // Reduce log spam or other effects from failed execv.
+  _exit(EXIT_FAILURE);
+}
+#endif
+
+pid_t SpawnProcess(const char *path, const char *const argv[],
+                   const char *const env[], int stdin_fd, int stdout_fd,
+                   int flags) {
+  // Make sure that setting up stdin does not clobber the future stdout.
+  int moved_stdout_fd = -1;
+  if (stdout_fd == 0 && stdin_fd != -1 && stdin_fd != 0) {
+    moved_stdout_fd = dup(stdout_fd);
+    if (moved_stdout_fd == -1) {
+      return -1;
+    }
+    stdout_fd = moved_stdout_fd;
+  }
+  pid_t pid =
+      DoSpawnProcess(path, argv, env, stdin_fd, stdout_fd, flags);
+  if (moved_stdout_fd != -1) {
+    int saved_errno = errno;
+    close(moved_stdout_fd);
+    errno = saved_errno;
+  }
+  return pid;
+}
+
 int KillPgrp(pid_t pid, int signo) {
   int ret = kill(-pid, signo);
   if (ret < 0 && errno == ESRCH) {
-    // Note: this shouldn't happen as StartPgrp() should ensure that we never
-    // get here. Remove this workaround once we made sure this really does not
-    // happen. TODO(divVerent).
+    // Note: this shouldn't happen as the leader is only reaped after killing
+    // the process group. Remove this workaround once we made sure this really
+    // does not happen. TODO(divVerent).
     LogErrno("Unable to kill process group %d - falling back to leader only",
              (int)pid);
     // Might mean the process is not a process group leader - but might also
@@ -146,16 +297,37 @@ int KillPgrp(pid_t pid, int signo) {
   return ret;
 }
 
+/*! \brief Checks whether a child process exited, without reaping it.
+ *
+ * \param pid The process ID.
+ * \param do_block Whether to wait for the process to exit.
+ * \return True if the process exited and is now a zombie.
+ */
+static int ExitedButNotReaped(pid_t pid, int do_block) {
+  for (;;) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, (id_t)pid, &info,
+               WEXITED | WNOWAIT | (do_block ? 0 : WNOHANG)) == 0) {
+      return info.si_pid == pid;
+    }
+    if (errno != EINTR) {
+      // WaitProc will find out and log what is wrong.
+      return 0;
+    }
+  }
+}
+
 int WaitPgrp(const char *name, pid_t *pid, int do_block, int already_killed,
              int *exit_status) {
-  int pid_saved = *pid;
-  int result = WaitProc(name, pid, do_block, already_killed, exit_status);
-  if (result && !already_killed) {
-    if (KillPgrp(pid_saved, SIGTERM) < 0) {
+  // Kill the rest of the process group while the leader is a zombie, as then
+  // its ID cannot have been reused for another process group yet.
+  if (!already_killed && ExitedButNotReaped(*pid, do_block)) {
+    if (KillPgrp(*pid, SIGTERM) < 0) {
       LogErrno("KillPgrp %s", name);
     }
   }
-  return result;
+  return WaitProc(name, pid, do_block, already_killed, exit_status);
 }
 
 int WaitProc(const char *name, pid_t *pid, int do_block, int already_killed,
@@ -39,10 +39,8 @@ pid_t ForkWithoutSigHandlers(void);
 /*! \brief Starts a new process group.
  *
  * Must be called from a child process, which will become the process group
- * leader. The process group will never die, unless killed using KillPgrp (which
- * WaitPgrp calls implicitly when the leader process terminates).
- *
- * \return Zero if the operation succeeded.
+ * leader. The rest of the process group is killed by WaitPgrp when the leader
+ * process terminates.
  */
 void StartPgrp(void);
 
@@ -56,6 +54,34 @@ void StartPgrp(void);
  */
 int ExecvHelper(const char *path, const char *const argv[]);
 
+//! SpawnProcess flag: the child starts a new process group, like StartPgrp.
+#define SPAWN_NEW_PGRP 1
+
+//! SpawnProcess flag: look up path in $PATH, and do not change directories.
+#define SPAWN_SEARCH_PATH 2
+
+/*! \brief Spawns a helper process.
+ *
+ * Like ForkWithoutSigHandlers() followed by StartPgrp(), redirecting stdin and
+ * stdout, and ExecvHelper() in the child, but uses posix_spawn() where it can
+ * do all that, which does not copy our address space (and page tables) just
+ * to replace it right away. The child gets an empty signal mask.
+ *
+ * \param path The executable; relative paths are within HELPER_PATH, unless
+ *   SPAWN_SEARCH_PATH is set.
+ * \param argv The arguments, like for execv().
+ * \param env Environment variables to set, as NULL terminated list of
+ *   "NAME=value" entries, or NULL.
+ * \param stdin_fd The file descriptor to become stdin, or -1 to inherit.
+ * \param stdout_fd The file descriptor to become stdout, or -1 to inherit.
+ * \param flags A combination of the SPAWN_* flags.
+ * \return The pid of the child, or -1 (with errno set) if it could not be
+ *   started.
+ */
+pid_t SpawnProcess(const char *path, const char *const argv[],
+                   const char *const env[], int stdin_fd, int stdout_fd,
+                   int flags);
+
 /*! \brief Kills the given process group.
  *
  * \param pid The process group ID.
@@ -65,7 +91,7 @@ int ExecvHelper(const char *path, const char *const argv[]);
 int KillPgrp(pid_t pid, int signo);
 
 /*! \brief Waits for the given process group to terminate, or checks its status.
- *         If the leader process died, kill the entire group.
+ *         If the leader process died, kill the entire group before reaping it.
  *
  * \param name The name of the process group for logging.
  * \param pid The process group ID; it is set to zero if the process group died.
@@ -0,0 +1,146 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "xrequest_stats.h"
+
+#include <X11/Xlib.h>  // for NextRequest, LastKnownRequestProcessed
+#include <stdlib.h>    // for atexit, NULL
+#include <string.h>    // for strcmp
+
+#include "env_settings.h"  // for GetIntSetting
+#include "logging.h"       // for Log
+
+//! Number of distinct phase names tracked.
+#define MAX_PHASES 32
+
+//! Nesting depth of phases tracked; deeper phases are ignored.
+#define MAX_PHASE_DEPTH 8
+
+//! Accumulated counts of a phase.
+typedef struct {
+  const char *name;
+  unsigned long runs;
+  unsigned long requests;
+  unsigned long round_trips;
+} PhaseStats;
+
+//! A phase that has begun and not ended yet.
+typedef struct {
+  PhaseStats *stats;
+  unsigned long first_request;
+  unsigned long first_round_trip;
+} OpenPhase;
+
+static int enabled = 0;
+static unsigned long first_request;
+//! NextRequest as of the last Xlib call; the display may be closed on exit.
+static unsigned long next_request;
+static unsigned long round_trips;
+static unsigned long last_request_read;
+static int (*previous_after_function)(Display *);
+
+static PhaseStats phases[MAX_PHASES];
+static size_t num_phases;
+static OpenPhase open_phases[MAX_PHASE_DEPTH];
+static size_t depth;
+
+/*! \brief Xlib after function: counts calls that waited for a reply.
+ *
+ * Requests are only processed asynchronously otherwise, so the last request
+ * known to be processed only catches up with the last one sent when Xlib read
+ * a reply (or an error, or an event, which makes this an estimate).
+ */
+static int CountRoundTrips(Display *display) {
+  unsigned long processed = LastKnownRequestProcessed(display);
+  next_request = NextRequest(display);
+  if (processed != last_request_read) {
+    last_request_read = processed;
+    if (processed == next_request - 1) {
+      ++round_trips;
+    }
+  }
+  if (previous_after_function != NULL) {
+    return previous_after_function(display);
+  }
+  return 0;
+}
+
+static void LogXRequestStats(void) {
+  Log("X requests in total: %lu requests, %lu round trips",
+      next_request - first_request, round_trips);
+  for (size_t i = 0; i < num_phases; ++i) {
+    Log("X requests in %s: %lu runs, %lu requests, %lu round trips",
+        phases[i].name, phases[i].runs, phases[i].requests,
+        phases[i].round_trips);
+  }
+}
+
+void InitXRequestStats(Display *display) {
+  if (!GetIntSetting("XSECURELOCK_DEBUG_X_REQUESTS", 0)) {
+    return;
+  }
+  enabled = 1;
+  first_request = next_request = NextRequest(display);
+  last_request_read = LastKnownRequestProcessed(display);
+  previous_after_function = XSetAfterFunction(display, CountRoundTrips);
+  atexit(LogXRequestStats);
+}
+
+void BeginXRequestPhase(Display *display, const char *phase) {
+  if (!enabled) {
+    return;
+  }
+  if (depth++ >= MAX_PHASE_DEPTH) {
+    return;
+  }
+  PhaseStats *stats = NULL;
+  for (size_t i = 0; i < num_phases; ++i) {
+    if (!strcmp(phases[i].name, phase)) {
+      stats = &phases[i];
+      break;
+    }
+  }
+  if (stats == NULL && num_phases < MAX_PHASES) {
+    stats = &phases[num_phases++];
+    stats->name = phase;
+  }
+  // Phases beyond MAX_PHASES stay open, but are not accounted.
+  open_phases[depth - 1].stats = stats;
+  open_phases[depth - 1].first_request = NextRequest(display);
+  open_phases[depth - 1].first_round_trip = round_trips;
+}
+
+void EndXRequestPhase(Display *display) {
+  if (!enabled || depth == 0) {
+    return;
+  }
+  if (depth-- > MAX_PHASE_DEPTH) {
+    return;
+  }
+  OpenPhase *open = &open_phases[depth];
+  if (open->stats == NULL) {
+    return;
+  }
+  unsigned long requests = NextRequest(display) - open->first_request;
+  unsigned long trips = round_trips - open->first_round_trip;
+  PhaseStats *stats = open->stats;
+  if (stats->runs++ == 0) {
+    Log("X requests in %s: %lu requests, %lu round trips", stats->name,
+        requests, trips);
+  }
+  stats->requests += requests;
+  stats->round_trips += trips;
+}
@@ -0,0 +1,51 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef XREQUEST_STATS_H
+#define XREQUEST_STATS_H
+
+#include <X11/Xlib.h>  // for Display
+
+/*! \brief Enables X request accounting if XSECURELOCK_DEBUG_X_REQUESTS is set.
+ *
+ * Installs an Xlib after function on the display that counts round trips,
+ * i.e. calls that waited for a reply, and arranges for a per-phase summary to
+ * be logged on exit.
+ *
+ * \param display The display to account requests on.
+ */
+void InitXRequestStats(Display *display);
+
+/*! \brief Starts accounting requests to a named phase.
+ *
+ * Phases may nest up to a small depth; requests are charged to all open
+ * phases. Does nothing unless InitXRequestStats enabled accounting.
+ *
+ * \param display The display passed to InitXRequestStats.
+ * \param phase The phase name; must be a literal, as only the pointer is kept.
+ */
+void BeginXRequestPhase(Display *display, const char *phase);
+
+/*! \brief Ends the innermost phase.
+ *
+ * The first time a phase ends, its counts are logged right away; afterwards
+ * they are only added to the totals logged on exit.
+ *
+ * \param display The display passed to InitXRequestStats.
+ */
+void EndXRequestPhase(Display *display);
+
+#endif
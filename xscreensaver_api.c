@@ -17,32 +17,29 @@ limitations under the License.
 #include "xscreensaver_api.h"
 
 #include <X11/X.h>   // for Window
-#include <stdio.h>   // for fprintf, stderr
-#include <stdlib.h>  // for setenv
+#include <stdio.h>   // for snprintf
 
 #include "env_settings.h"  // for GetUnsignedLongLongSetting
 #include "logging.h"
 
-void ExportWindowID(Window w) {
-  char window_id_str[32];
-  int window_id_len = snprintf(window_id_str, sizeof(window_id_str), "%llu",
+void ExportWindowID(Window w, char *buf) {
+  int window_id_len = snprintf(buf, EXPORT_ENV_SIZE, "XSCREENSAVER_WINDOW=%llu",
                                (unsigned long long)w);
-  if (window_id_len <= 0 || (size_t)window_id_len >= sizeof(window_id_str)) {
+  if (window_id_len <= 0 || (size_t)window_id_len >= EXPORT_ENV_SIZE) {
     Log("Window ID doesn't fit into buffer");
-    return;
+    // Still a valid entry, just not the right one.
+    snprintf(buf, EXPORT_ENV_SIZE, "XSCREENSAVER_WINDOW=");
   }
-  setenv("XSCREENSAVER_WINDOW", window_id_str, 1);
 }
 
-void ExportSaverIndex(int index) {
-  char saver_index_str[32];
-  int saver_index_len = snprintf(saver_index_str, sizeof(saver_index_str), "%llu",
-                                 (unsigned long long)index);
-  if (saver_index_len <= 0 || (size_t)saver_index_len >= sizeof(saver_index_str)) {
+void ExportSaverIndex(int index, char *buf) {
+  int saver_index_len =
+      snprintf(buf, EXPORT_ENV_SIZE, "XSCREENSAVER_SAVER_INDEX=%llu",
+               (unsigned long long)index);
+  if (saver_index_len <= 0 || (size_t)saver_index_len >= EXPORT_ENV_SIZE) {
     Log("Saver index doesn't fit into buffer");
-    return;
+    snprintf(buf, EXPORT_ENV_SIZE, "XSCREENSAVER_SAVER_INDEX=");
   }
-  setenv("XSCREENSAVER_SAVER_INDEX", saver_index_str, 1);
 }
 
 Window ReadWindowID(void) {
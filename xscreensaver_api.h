@@ -19,21 +19,26 @@ limitations under the License.
 
 #include <X11/X.h>  // for Window
 
+//! Size of the buffers receiving environment entries from Export*().
+#define EXPORT_ENV_SIZE 64
+
 /*! \brief Export the given window ID to the environment for a saver/auth child.
  *
- * This simply sets $XSCREENSAVER_WINDOW.
+ * This simply formats "XSCREENSAVER_WINDOW=..." for SpawnProcess().
  *
  * \param w The window the child should draw on.
+ * \param buf Receives the entry; must hold EXPORT_ENV_SIZE bytes.
  */
-void ExportWindowID(Window w);
+void ExportWindowID(Window w, char *buf);
 
 /*! \brief Export the given saver index to the environment for a saver/auth child.
  *
- * This simply sets $XSCREENSAVER_SAVER_INDEX.
+ * This simply formats "XSCREENSAVER_SAVER_INDEX=..." for SpawnProcess().
  *
  * \param index The index of the saver.
+ * \param buf Receives the entry; must hold EXPORT_ENV_SIZE bytes.
  */
-void ExportSaverIndex(int index);
+void ExportSaverIndex(int index, char *buf);
 
 /*! \brief Reads the window ID to draw on from the environment.
  *